@@ -0,0 +1,483 @@
+/**
+ * Benchmark suite
+ *
+ * This program measures the performance of REBOUND for each
+ * gravity, collision and integrator module as well as for
+ * periodic and shearing sheet boundary conditions. Every
+ * benchmark is run for a sweep of particle numbers N and
+ * OpenMP thread counts. Initial conditions are generated
+ * with a fixed random seed, so runs are reproducible and
+ * can be compared between commits and machines.
+ *
+ * Run it with `make bench` from the main directory.
+ * The results are written to a CSV file (default: bench.csv)
+ * with the following columns:
+ *
+ *   benchmark, N, threads, steps, time, steps_per_second,
+ *   particle_steps_per_second, efficiency, label, host
+ *
+ * The efficiency is the speedup relative to the single thread
+ * run divided by the number of threads. The label can be set
+ * with -l and defaults to the current git commit when the
+ * benchmark is run via make.
+ *
+ * Usage: ./benchmark [-o file] [-b name] [-n N1,N2,...]
+ *                    [-t T1,T2,...] [-s seconds] [-r seed]
+ *                    [-l label] [-q]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
+#include "rebound.h"
+
+#define BENCHMARK_N_MAX 16		///< Maximum length of the N and thread sweeps.
+
+/**
+ * @brief One benchmark: a setup function and the default sweep in N.
+ */
+struct benchmark {
+	const char* name;				///< Name of the benchmark (used in output and with -b).
+	void (*setup)(struct reb_simulation* const r, const int N);	///< Creates the initial conditions for N particles.
+	int N[BENCHMARK_N_MAX];				///< Default particle numbers (zero terminated).
+};
+
+static double benchmark_clock(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+}
+
+/**
+ * \name Setup functions
+ * @{
+ */
+
+/**
+ * @brief Self-gravitating cloud of N particles in open space.
+ */
+static void setup_cloud(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_LEAPFROG;
+	r->G		= 1;
+	r->softening	= 0.01;
+	r->dt		= 1e-3;
+	for (int i=0;i<N;i++){
+		struct reb_particle p = {0};
+		double d;
+		do{
+			p.x = reb_random_uniform(-1.,1.);
+			p.y = reb_random_uniform(-1.,1.);
+			p.z = reb_random_uniform(-1.,1.);
+			d = p.x*p.x + p.y*p.y + p.z*p.z;
+		}while(d>1.);
+		p.vx = reb_random_normal(0.01);
+		p.vy = reb_random_normal(0.01);
+		p.vz = reb_random_normal(0.01);
+		p.m = 1./(double)N;
+		reb_add(r, p);
+	}
+}
+
+static void setup_gravity_basic(struct reb_simulation* const r, const int N){
+	r->gravity	= REB_GRAVITY_BASIC;
+	setup_cloud(r, N);
+}
+
+static void setup_gravity_compensated(struct reb_simulation* const r, const int N){
+	r->gravity	= REB_GRAVITY_COMPENSATED;
+	setup_cloud(r, N);
+}
+
+static void setup_gravity_tree(struct reb_simulation* const r, const int N){
+	r->gravity	= REB_GRAVITY_TREE;
+	r->boundary	= REB_BOUNDARY_OPEN;
+	r->opening_angle2 = 0.25;
+	reb_configure_box(r, 4., 1, 1, 1);
+	setup_cloud(r, N);
+}
+
+/**
+ * @brief Gas of N hard spheres in a periodic box without gravity.
+ * @details The box size scales with N so that the filling factor
+ * and thus the number of collisions per particle is constant.
+ */
+static void setup_granular(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_LEAPFROG;
+	r->gravity	= REB_GRAVITY_NONE;
+	r->boundary	= REB_BOUNDARY_PERIODIC;
+	r->dt		= 1e-2;
+	const double radius = 0.1;
+	const double filling_factor = 0.05;
+	const double boxsize = cbrt((double)N*4./3.*M_PI*radius*radius*radius/filling_factor);
+	reb_configure_box(r, boxsize, 1, 1, 1);
+	r->nghostx = 1;
+	r->nghosty = 1;
+	r->nghostz = 1;
+	for (int i=0;i<N;i++){
+		struct reb_particle p = {0};
+		p.x = reb_random_uniform(-boxsize/2.,boxsize/2.);
+		p.y = reb_random_uniform(-boxsize/2.,boxsize/2.);
+		p.z = reb_random_uniform(-boxsize/2.,boxsize/2.);
+		p.vx = reb_random_normal(1.);
+		p.vy = reb_random_normal(1.);
+		p.vz = reb_random_normal(1.);
+		p.m = 1.;
+		p.r = radius;
+		reb_add(r, p);
+	}
+}
+
+static void setup_collision_direct(struct reb_simulation* const r, const int N){
+	r->collision	= REB_COLLISION_DIRECT;
+	setup_granular(r, N);
+}
+
+static void setup_collision_tree(struct reb_simulation* const r, const int N){
+	r->collision	= REB_COLLISION_TREE;
+	setup_granular(r, N);
+}
+
+static void setup_collision_direct_skin(struct reb_simulation* const r, const int N){
+	r->collision	= REB_COLLISION_DIRECT;
+	r->collision_skin = 0.1;
+	setup_granular(r, N);
+}
+
+static void setup_collision_tree_skin(struct reb_simulation* const r, const int N){
+	r->collision	= REB_COLLISION_TREE;
+	r->collision_skin = 0.1;
+	setup_granular(r, N);
+}
+
+static void setup_collision_grid(struct reb_simulation* const r, const int N){
+	r->collision	= REB_COLLISION_GRID;
+	setup_granular(r, N);
+}
+
+static void setup_collision_sweep(struct reb_simulation* const r, const int N){
+	r->collision	= REB_COLLISION_SWEEP;
+	setup_granular(r, N);
+}
+
+/**
+ * @brief Narrow ring of N hard spheres on circular trajectories, without gravity.
+ * @details The circumference scales with N so that the number of collisions per particle is constant.
+ */
+static void setup_collision_sweepphi(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_LEAPFROG;
+	r->gravity	= REB_GRAVITY_NONE;
+	r->collision	= REB_COLLISION_SWEEPPHI;
+	r->dt		= 1e-3;
+	const double radius = 0.1;
+	const double a = (double)N*radius/(2.*M_PI);
+	for (int i=0;i<N;i++){
+		struct reb_particle p = {0};
+		const double phi = reb_random_uniform(-M_PI,M_PI);
+		const double rho = a + reb_random_uniform(-5.*radius,5.*radius);
+		p.x = rho*cos(phi);
+		p.y = rho*sin(phi);
+		p.z = reb_random_normal(radius*radius);
+		p.vx = -sin(phi) + reb_random_normal(0.01);
+		p.vy = cos(phi) + reb_random_normal(0.01);
+		p.vz = reb_random_normal(0.01);
+		p.m = 1.;
+		p.r = radius;
+		reb_add(r, p);
+	}
+}
+
+/**
+ * @brief A star with N-1 low mass planets on nearly circular orbits.
+ */
+static void setup_planets(struct reb_simulation* const r, const int N){
+	r->G		= 1;
+	r->dt		= 1e-3*2.*M_PI;
+	struct reb_particle star = {0};
+	star.m = 1.;
+	reb_add(r, star);
+	for (int i=1;i<N;i++){
+		const double a = reb_random_uniform(1.,5.);
+		const double e = reb_random_uniform(0.,0.05);
+		const double inc = reb_random_uniform(0.,0.05);
+		const double Omega = reb_random_uniform(0.,2.*M_PI);
+		const double omega = reb_random_uniform(0.,2.*M_PI);
+		const double f = reb_random_uniform(0.,2.*M_PI);
+		struct reb_particle p = reb_tools_orbit_to_particle(r->G, star, 1e-8, a, e, inc, Omega, omega, f);
+		reb_add(r, p);
+	}
+	reb_move_to_com(r);
+}
+
+static void setup_integrator_ias15(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_IAS15;
+	setup_planets(r, N);
+}
+
+static void setup_integrator_whfast(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_WHFAST;
+	setup_planets(r, N);
+}
+
+static void setup_integrator_wh(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_WH;
+	setup_planets(r, N);
+}
+
+static void setup_integrator_leapfrog(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_LEAPFROG;
+	setup_planets(r, N);
+}
+
+static void setup_integrator_hybrid(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_HYBRID;
+	setup_planets(r, N);
+}
+
+/**
+ * @brief Non-interacting test particles in a shearing sheet (integrator only).
+ */
+static void setup_integrator_sei(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_SEI;
+	r->gravity	= REB_GRAVITY_NONE;
+	r->boundary	= REB_BOUNDARY_SHEAR;
+	r->ri_sei.OMEGA	= 1.;
+	r->dt		= 1e-3*2.*M_PI;
+	const double boxsize = sqrt((double)N);
+	reb_configure_box(r, boxsize, 1, 1, 1);
+	for (int i=0;i<N;i++){
+		struct reb_particle p = {0};
+		p.x = reb_random_uniform(-boxsize/2.,boxsize/2.);
+		p.y = reb_random_uniform(-boxsize/2.,boxsize/2.);
+		p.z = reb_random_normal(0.1);
+		p.vy = -1.5*p.x*r->ri_sei.OMEGA;
+		p.m = 1.;
+		reb_add(r, p);
+	}
+}
+
+/**
+ * @brief Self-gravitating, colliding particles in a periodic box.
+ */
+static void setup_boundary_periodic(struct reb_simulation* const r, const int N){
+	setup_granular(r, N);
+	r->gravity	= REB_GRAVITY_TREE;
+	r->collision	= REB_COLLISION_TREE;
+	r->G		= 1e-3;
+	r->softening	= 0.05;
+	r->opening_angle2 = 0.5;
+}
+
+/**
+ * @brief Self-gravitating, colliding particles in a periodic box, using a neighbour list.
+ * @details The neighbour list is rebuilt during the gravity tree walk.
+ */
+static void setup_boundary_periodic_skin(struct reb_simulation* const r, const int N){
+	setup_boundary_periodic(r, N);
+	r->collision_skin = 0.2;
+}
+
+/**
+ * @brief Planetary ring in a shearing sheet with self-gravity and collisions.
+ * @details Similar to examples/shearing_sheet but in dimensionless units.
+ * The box size scales with N so that the optical depth is constant.
+ */
+static void setup_boundary_shear(struct reb_simulation* const r, const int N){
+	r->integrator	= REB_INTEGRATOR_SEI;
+	r->boundary	= REB_BOUNDARY_SHEAR;
+	r->gravity	= REB_GRAVITY_TREE;
+	r->collision	= REB_COLLISION_TREE;
+	r->ri_sei.OMEGA	= 1.;
+	r->G		= 1e-3;
+	r->softening	= 0.05;
+	r->opening_angle2 = 0.5;
+	r->dt		= 1e-3*2.*M_PI;
+	r->minimum_collision_velocity = 1e-4;
+	const double radius = 0.5;
+	const double optical_depth = 0.5;
+	const double boxsize = sqrt((double)N*M_PI*radius*radius/optical_depth);
+	reb_configure_box(r, boxsize, 1, 1, 1);
+	r->nghostx = 2;
+	r->nghosty = 2;
+	r->nghostz = 0;
+	for (int i=0;i<N;i++){
+		struct reb_particle p = {0};
+		p.x = reb_random_uniform(-boxsize/2.,boxsize/2.);
+		p.y = reb_random_uniform(-boxsize/2.,boxsize/2.);
+		p.z = reb_random_normal(1.);
+		p.vy = -1.5*p.x*r->ri_sei.OMEGA;
+		p.r = radius;
+		p.m = 1.;
+		reb_add(r, p);
+	}
+}
+
+/** @} */
+
+/**
+ * @brief List of all benchmarks.
+ */
+static const struct benchmark benchmarks[] = {
+	{"gravity_basic",		setup_gravity_basic,		{128, 512, 2048}},
+	{"gravity_compensated",		setup_gravity_compensated,	{128, 512, 2048}},
+	{"gravity_tree",		setup_gravity_tree,		{512, 2048, 8192}},
+	{"collision_direct",		setup_collision_direct,		{128, 512, 2048}},
+	{"collision_tree",		setup_collision_tree,		{512, 2048, 8192}},
+	{"collision_direct_skin",	setup_collision_direct_skin,	{128, 512, 2048}},
+	{"collision_tree_skin",		setup_collision_tree_skin,	{512, 2048, 8192}},
+	{"collision_grid",		setup_collision_grid,		{512, 2048, 8192}},
+	{"collision_sweep",		setup_collision_sweep,		{512, 2048, 8192}},
+	{"collision_sweepphi",		setup_collision_sweepphi,	{512, 2048, 8192}},
+	{"integrator_ias15",		setup_integrator_ias15,		{16, 64, 256}},
+	{"integrator_whfast",		setup_integrator_whfast,	{16, 64, 256}},
+	{"integrator_sei",		setup_integrator_sei,		{512, 2048, 8192}},
+	{"integrator_leapfrog",		setup_integrator_leapfrog,	{16, 64, 256}},
+	{"integrator_hybrid",		setup_integrator_hybrid,	{16, 64, 256}},
+	{"integrator_wh",		setup_integrator_wh,		{16, 64, 256}},
+	{"boundary_periodic",		setup_boundary_periodic,	{512, 2048, 8192}},
+	{"boundary_periodic_skin",	setup_boundary_periodic_skin,	{512, 2048, 8192}},
+	{"boundary_shear",		setup_boundary_shear,		{512, 2048, 8192}},
+};
+
+/**
+ * @brief Parses a comma separated list of positive integers.
+ * @return Number of entries read.
+ */
+static int parse_list(const char* str, int* list){
+	int n = 0;
+	while (*str && n<BENCHMARK_N_MAX-1){
+		char* end;
+		const long v = strtol(str, &end, 10);
+		if (end==str || v<=0){
+			fprintf(stderr, "Cannot parse list '%s'.\n", str);
+			exit(EXIT_FAILURE);
+		}
+		list[n++] = (int)v;
+		str = (*end==',')?end+1:end;
+	}
+	list[n] = 0;
+	return n;
+}
+
+/**
+ * @brief Runs one benchmark for a given N and number of threads.
+ * @details One step is done before the timer is started so that
+ * memory allocations and the initial tree construction are not
+ * included. Steps are then performed until min_time has elapsed.
+ * @return Number of steps done. The elapsed time is stored in time.
+ */
+static long run(const struct benchmark* const b, const int N, const unsigned int seed, const double min_time, double* time){
+	struct reb_simulation* const r = reb_create_simulation();
+	srand(seed);	// reb_create_simulation() seeds the random number generator with the time.
+	b->setup(r, N);
+	reb_step(r);
+	long steps = 0;
+	const double start = benchmark_clock();
+	double now;
+	do{
+		reb_step(r);
+		steps++;
+		now = benchmark_clock();
+	}while(now-start<min_time || steps<2);
+	*time = now-start;
+	reb_free_simulation(r);
+	return steps;
+}
+
+int main(int argc, char* argv[]){
+	const char* filename = "bench.csv";
+	const char* filter = NULL;
+	const char* label = "";
+	unsigned int seed = 1;
+	double min_time = 0.5;
+	int quick = 0;
+	int N_user[BENCHMARK_N_MAX] = {0};
+	int threads[BENCHMARK_N_MAX] = {0};
+	int threads_N = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:b:n:t:s:r:l:qh")) != -1){
+		switch (opt){
+			case 'o': filename = optarg; break;
+			case 'b': filter = optarg; break;
+			case 'n': parse_list(optarg, N_user); break;
+			case 't': threads_N = parse_list(optarg, threads); break;
+			case 's': min_time = atof(optarg); break;
+			case 'r': seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+			case 'l': label = optarg; break;
+			case 'q': quick = 1; break;
+			default:
+				fprintf(stderr, "Usage: %s [-o file] [-b name] [-n N1,N2,...] [-t T1,T2,...] [-s seconds] [-r seed] [-l label] [-q]\n", argv[0]);
+				return opt=='h'?EXIT_SUCCESS:EXIT_FAILURE;
+		}
+	}
+	if (threads_N==0){
+		// Default thread sweep: 1, 2, 4, ... up to the number of available threads.
+#ifdef OPENMP
+		const int max_threads = omp_get_max_threads();
+#else // OPENMP
+		const int max_threads = 1;
+#endif // OPENMP
+		for (int t=1; t<max_threads && threads_N<BENCHMARK_N_MAX-2; t*=2){
+			if (quick && t>1) continue;
+			threads[threads_N++] = t;
+		}
+		threads[threads_N++] = max_threads;
+	}
+#ifndef OPENMP
+	for (int i=0;i<threads_N;i++){
+		if (threads[i]!=1){
+			fprintf(stderr, "Compiled without OpenMP. Only running with one thread.\n");
+			threads[0] = 1;
+			threads_N = 1;
+			break;
+		}
+	}
+#endif // OPENMP
+
+	char host[256] = "unknown";
+	gethostname(host, sizeof(host));
+	host[sizeof(host)-1] = '\0';
+
+	FILE* of = fopen(filename, "w");
+	if (of==NULL){
+		fprintf(stderr, "Cannot open file '%s'.\n", filename);
+		return EXIT_FAILURE;
+	}
+	fprintf(of, "benchmark,N,threads,steps,time,steps_per_second,particle_steps_per_second,efficiency,label,host\n");
+	printf("%-22s %8s %8s %8s %14s %18s %10s\n", "BENCHMARK", "N", "THREADS", "STEPS", "STEPS/S", "PARTICLE-STEPS/S", "EFFICIENCY");
+
+	const int benchmarks_N = sizeof(benchmarks)/sizeof(benchmarks[0]);
+	for (int i=0;i<benchmarks_N;i++){
+		const struct benchmark* const b = &benchmarks[i];
+		if (filter && strstr(b->name, filter)==NULL) continue;
+		const int* const Ns = N_user[0]?N_user:b->N;
+		for (int j=0; Ns[j]>0; j++){
+			if (quick && j>0) break;
+			const int N = Ns[j];
+			double single_thread_rate = 0.;
+			for (int k=0;k<threads_N;k++){
+#ifdef OPENMP
+				omp_set_num_threads(threads[k]);
+#endif // OPENMP
+				double time;
+				const long steps = run(b, N, seed, min_time, &time);
+				const double rate = (double)steps/time;
+				if (threads[k]==1){
+					single_thread_rate = rate;
+				}
+				const double efficiency = single_thread_rate>0.?rate/single_thread_rate/(double)threads[k]:NAN;
+				printf("%-22s %8d %8d %8ld %14.4e %18.4e %10.3f\n", b->name, N, threads[k], steps, rate, rate*(double)N, efficiency);
+				fprintf(of, "%s,%d,%d,%ld,%.6e,%.6e,%.6e,%.4f,%s,%s\n", b->name, N, threads[k], steps, time, rate, rate*(double)N, efficiency, label, host);
+				fflush(of);
+			}
+		}
+	}
+	fclose(of);
+	printf("Results written to %s.\n", filename);
+	return EXIT_SUCCESS;
+}
@@ -4,8 +4,9 @@
  * This example demonstrates how to use the profiling tool that
  * comes with REBOUND to find out which parts of your code are 
  * slow. To turn on this option, simple set `PROFILING=1` in 
- * the Makefile.
- * Note that enabeling this option makes REBOUND not thread-safe.
+ * the Makefile. Alternatively, set `r->profiling_enabled = 1`
+ * at runtime. The results are also written to a JSON file 
+ * once per orbit.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -92,5 +93,6 @@ void heartbeat(struct reb_simulation* const r) {
 	}
 	if (reb_output_check(r, 2. * M_PI / r->ri_sei.OMEGA)) {
 		//reb_output_ascii("position.txt");
+		reb_output_profiling_json(r, "profiling.json");
 	}
 }
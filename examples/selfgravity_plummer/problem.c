@@ -2,10 +2,12 @@
  * A self-gravitating Plummer sphere
  *
  * A self-gravitating Plummer sphere is integrated using
- * the leap frog integrator. Collisions are not resolved. Note that the
- * fixed timestep might not allow you to resolve individual two-body
- * encounters. An alternative integrator is IAS15 which
- * comes with adaptive timestepping.
+ * the leap frog integrator and a tree to calculate gravity. 
+ * Collisions are not resolved. Particles in the core of the cluster
+ * are integrated with shorter timesteps than those in the halo
+ * (hierarchical block timesteps). Note that the timesteps might not
+ * allow you to resolve individual two-body encounters. An alternative
+ * integrator is IAS15 which comes with adaptive timestepping.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,7 +34,9 @@ int main(int argc, char* argv[]){
 	// Setup constants
 	r->G 		= G;		
 	r->integrator	= REB_INTEGRATOR_LEAPFROG;
-	r->dt 		= 2e-5*t0; 	// timestep
+	r->gravity	= REB_GRAVITY_TREE;
+	r->dt 		= 8e-4*t0; 	// Longest timestep
+	r->ri_leapfrog.block_levels = 6;// Shortest timestep is dt/2^6
 	r->softening 	= 0.01*r0;	// Softening parameter
 	r->heartbeat	= heartbeat;
 	
@@ -1,4 +1,4 @@
-from ctypes import Structure, c_double, POINTER, c_int, c_uint, c_long, c_ulong, c_void_p, c_char_p, CFUNCTYPE, byref
+from ctypes import Structure, c_double, POINTER, c_int, c_uint, c_long, c_ulong, c_ulonglong, c_void_p, c_char_p, CFUNCTYPE, byref
 from . import clibrebound, Escape, NoParticles, Encounter, SimulationError
 from .particle import Particle
 from .units import units_convert_particle, check_units, convert_G
@@ -18,7 +18,8 @@ import types
 INTEGRATORS = {"ias15": 0, "whfast": 1, "sei": 2, "wh": 3, "leapfrog": 4, "hybrid": 5, "none": 6}
 BOUNDARIES = {"none": 0, "open": 1, "periodic": 2, "shear": 3}
 GRAVITIES = {"none": 0, "basic": 1, "compensated": 2, "tree": 3}
-COLLISIONS = {"none": 0, "direct": 1, "tree": 2}
+COLLISIONS = {"none": 0, "direct": 1, "tree": 2, "grid": 3, "sweep": 4, "sweepphi": 5}
+CONTACTS = {"none": 0, "softsphere": 1}
 
 class reb_vec3d(Structure):
     _fields_ = [("x", c_double),
@@ -49,6 +50,25 @@ class reb_collision(Structure):
                 ("time", c_double),
                 ("ri", c_int)]
 
+class Event(Structure):
+    """
+    An event found during the integration, i.e. a root of the event function.
+    See :attr:`Simulation.event`.
+
+    Attributes
+    ----------
+    t : float
+        Time of the event.
+    direction : int
+        1 if the event function changed from negative to positive, -1 otherwise.
+    particles : list
+        Copies of all particles at the time of the event.
+    """
+    _fields_ = [("t", c_double),
+                ("direction", c_int),
+                ("N", c_int),
+                ("particles_start", c_int)]
+
 class reb_simulation_integrator_hybrid(Structure):
     _fields_ = [("switch_ratio", c_double),
                 ("mode", c_int)]
@@ -89,8 +109,13 @@ class reb_simulation_integrator_ias15(Structure):
     _fields_ = [("epsilon", c_double),
                 ("min_dt", c_double),
                 ("epsilon_global", c_uint),
+                ("block_levels", c_uint),
+                ("tree_interaction_lists", c_uint),
                 ("iterations_max_exceeded", c_ulong),
                 ("allocatedN", c_int),
+                ("arena_allocatedN", c_int),
+                ("arena", POINTER(c_double)),
+                ("dense_N", c_int),
                 ("at", POINTER(c_double)),
                 ("x0", POINTER(c_double)),
                 ("v0", POINTER(c_double)),
@@ -98,12 +123,48 @@ class reb_simulation_integrator_ias15(Structure):
                 ("csx", POINTER(c_double)),
                 ("csv", POINTER(c_double)),
                 ("csa0", POINTER(c_double)),
+                ("xd", POINTER(c_double)),
+                ("vd", POINTER(c_double)),
                 ("g", reb_dp7),
                 ("b", reb_dp7),
                 ("csb", reb_dp7),
                 ("e", reb_dp7),
                 ("br", reb_dp7),
-                ("er", reb_dp7)]
+                ("er", reb_dp7),
+                ("block_allocatedN", c_int),
+                ("block_N", c_int),
+                ("block_level", POINTER(c_int)),
+                ("block_index", POINTER(c_int)),
+                ("block_dt", POINTER(c_double)),
+                ("block_nodes_allocatedN", c_int),
+                ("block_nodes", POINTER(c_double))]
+
+class reb_simulation_integrator_leapfrog(Structure):
+    """
+    This class is an abstraction of the C-struct reb_simulation_integrator_leapfrog.
+    It controls the behaviour of the leapfrog integrator.
+    
+    This struct should be accessed via the simulation class only. Here is an 
+    example:
+
+    >>> sim = rebound.Simulation()
+    >>> sim.integrator = "leapfrog"
+    >>> sim.ri_leapfrog.block_levels = 6
+    
+    :ivar int block_levels:          
+        Number of block timestep levels. If larger than 0, every particle gets its 
+        own timestep dt/2**l with 0<=l<=block_levels, chosen from its acceleration.
+        By default block_levels is 0 (global timestep).
+    :ivar float block_eta:          
+        Accuracy parameter of the block timestep criterion. The timestep of a particle
+        is shorter than sqrt(2*block_eta*softening/|a|). By default block_eta is 0.025.
+    """
+    _fields_ = [("block_levels", c_uint),
+                ("block_eta", c_double),
+                ("block_allocatedN", c_int),
+                ("block_N", c_int),
+                ("block_level", POINTER(c_int)),
+                ("block_index", POINTER(c_int))]
 
 class reb_simulation_integrator_whfast(Structure):
     """
@@ -346,6 +407,50 @@ class Simulation(Structure):
         self._hb = AFF(func)
         self._heartbeat = self._hb
 
+    @property
+    def event(self):
+        """
+        Get or set a function pointer for an event function.
+
+        The function takes the simulation as an argument and returns a float.
+        After every timestep, REBOUND checks if the function changed its sign 
+        and finds the time of the root using the dense output of IAS15. 
+        While the function is called, the time and the particles of the simulation 
+        are set to the time being tested. Events can then be accessed with 
+        :attr:`events`. Only supported by IAS15.
+
+        Examples
+        --------
+        Find the times at which a planet crosses the x axis.
+
+        >>> def crossing(simp):
+        >>>     sim = simp.contents
+        >>>     return sim.particles[1].y - sim.particles[0].y
+        >>> sim.event = crossing
+        >>> sim.integrate(100.)
+        >>> for e in sim.events:
+        >>>     print(e.t, e.particles[1].x)
+        """
+        raise AttributeError("You can only set C function pointers from python.")
+    @event.setter
+    def event(self, func):
+        self._evfp = EVFF(func)
+        self._event = self._evfp
+
+    @property
+    def events(self):
+        """
+        Returns a list of all events found so far (see :attr:`event`). 
+        Set ``sim.events_N = 0`` to clear the list.
+        """
+        events = []
+        for i in range(self.events_N):
+            e = Event.from_buffer_copy(self._events[i])
+            e.particles = (Particle*e.N)()
+            ctypes.memmove(e.particles, ctypes.addressof(self._events_particles[e.particles_start]), ctypes.sizeof(Particle)*e.N)
+            events.append(e)
+        return events
+
     @property 
     def coefficient_of_restitution(self):
         """
@@ -503,6 +608,9 @@ class Simulation(Structure):
         - ``'none'`` (default)
         - ``'direct'``
         - ``'tree'``
+        - ``'grid'``
+        - ``'sweep'``
+        - ``'sweepphi'``
         
         Check the online documentation for a full description of each of the modules. 
         """
@@ -522,6 +630,34 @@ class Simulation(Structure):
             else:
                 raise ValueError("Warning. Collision module not found.")
 
+    @property
+    def contact(self):
+        """
+        Get or set the contact model.
+
+        Available contact models are:
+
+        - ``'none'`` (default)
+        - ``'softsphere'``
+        
+        Check the online documentation for a full description of each of the models. 
+        """
+        i = self._contact
+        for name, _i in CONTACTS.items():
+            if i==_i:
+                return name
+        return i
+    @contact.setter
+    def contact(self, value):
+        if isinstance(value, int):
+            self._contact = c_int(value)
+        elif isinstance(value, basestring):
+            value = value.lower()
+            if value in CONTACTS: 
+                self.contact = CONTACTS[value]
+            else:
+                raise ValueError("Warning. Contact model not found.")
+
 # Units
 
     @property
@@ -771,6 +907,25 @@ class Simulation(Structure):
             if success == 0:
                 raise ValueError("id %d passed to remove_particle was not found.  Did not remove particle.\n"%(id))
 
+    def get_particle_by_id(self, id):
+        """ 
+        Returns the particle with the given id.
+
+        If particle_lookup_enabled is set to 1, the lookup uses a hash table
+        and takes constant time. Otherwise the particles array is searched linearly.
+        Set particle_lookup_stale to 1 after changing ids manually.
+
+        Parameters
+        ----------
+        id : int
+            The id of the particle.
+        """
+        clibrebound.reb_get_particle_by_id.restype = POINTER(Particle)
+        p = clibrebound.reb_get_particle_by_id(byref(self), c_int(id))
+        if not p:
+            raise ValueError("Particle with id %d not found."%(id))
+        return p.contents
+
     def particles_ascii(self, prec=8):
         """
         Returns an ASCII string with all particles' masses, radii, positions and velocities.
@@ -939,6 +1094,112 @@ class Simulation(Structure):
         Save the entire REBOUND simulation to a binary file.
         """
         clibrebound.reb_output_binary(byref(self), c_char_p(filename.encode("ascii")))
+
+    def save_profiling(self, filename, format="json"):
+        """
+        Save the profiling results to a file. 
+
+        Parameters
+        ----------
+        filename : str
+            Output filename.
+        format : str, optional
+            Either ``"json"`` (default) or ``"csv"``.
+        """
+        if format == "json":
+            clibrebound.reb_output_profiling_json(byref(self), c_char_p(filename.encode("ascii")))
+        elif format == "csv":
+            clibrebound.reb_output_profiling_csv(byref(self), c_char_p(filename.encode("ascii")))
+        else:
+            raise ValueError("Unknown profiling output format: %s."%format)
+
+    def save_trace(self, filename):
+        """
+        Save the timeline trace to a file in the Chrome trace format. 
+
+        Tracing needs to be enabled by setting ``sim.trace_enabled = 1``.
+        The file can be opened with chrome://tracing or https://ui.perfetto.dev.
+
+        Parameters
+        ----------
+        filename : str
+            Output filename.
+        """
+        clibrebound.reb_output_trace(byref(self), c_char_p(filename.encode("ascii")))
+
+# Profiling
+    def profiling_stats(self, thread=-1):
+        """
+        Returns the profiling results as a dictionary.
+
+        Profiling needs to be enabled by setting ``sim.profiling_enabled = 1``.
+        The dictionary contains one entry per category. Each entry is a dictionary 
+        with the keys ``parent`` (name of the parent category or None), ``calls``, 
+        ``time`` (seconds, excluding subcategories) and ``time_inclusive``
+        (seconds, including subcategories). These only include the time of the
+        master thread outside of OpenMP parallel regions. The time spent
+        inside parallel regions is given separately by ``parallel_calls`` and 
+        ``parallel_time`` (seconds, including subcategories). Compare the 
+        threads to see the load imbalance.
+        If ``sim.profiling_hw_counters = 1`` and the hardware counters are 
+        available (Linux only), each entry also contains a dictionary 
+        ``hw_counters`` with the counter values (excluding subcategories).
+
+        Parameters
+        ----------
+        thread : int, optional
+            Only return the results of this OpenMP thread. By default (-1), 
+            the results of all threads are summed.
+
+        Examples
+        --------
+
+        >>> sim.profiling_enabled = 1
+        >>> sim.integrate(100.)
+        >>> print(sim.profiling_stats()["gravity"]["time_inclusive"])
+
+        """
+        clibrebound.reb_profiling_get_name.restype = c_char_p
+        clibrebound.reb_profiling_get_time.restype = c_double
+        clibrebound.reb_profiling_get_time_inclusive.restype = c_double
+        clibrebound.reb_profiling_get_calls.restype = c_long
+        clibrebound.reb_profiling_get_parallel_time.restype = c_double
+        clibrebound.reb_profiling_get_parallel_calls.restype = c_long
+        clibrebound.reb_profiling_get_hw_name.restype = c_char_p
+        clibrebound.reb_profiling_get_hw.restype = c_ulonglong
+        hw = self.profiling_hw_counters and clibrebound.reb_profiling_hw_available(byref(self))
+        stats = {}
+        cat = 0
+        while True:
+            name = clibrebound.reb_profiling_get_name(c_int(cat))
+            if name is None:
+                break
+            parent = clibrebound.reb_profiling_get_parent(c_int(cat))
+            stats[name.decode("ascii")] = {
+                "parent": None if parent==-1 else clibrebound.reb_profiling_get_name(c_int(parent)).decode("ascii"),
+                "calls": clibrebound.reb_profiling_get_calls(byref(self), c_int(cat), c_int(thread)),
+                "time": clibrebound.reb_profiling_get_time(byref(self), c_int(cat), c_int(thread)),
+                "time_inclusive": clibrebound.reb_profiling_get_time_inclusive(byref(self), c_int(cat), c_int(thread)),
+                "parallel_calls": clibrebound.reb_profiling_get_parallel_calls(byref(self), c_int(cat), c_int(thread)),
+                "parallel_time": clibrebound.reb_profiling_get_parallel_time(byref(self), c_int(cat), c_int(thread)),
+                }
+            if hw:
+                stats[name.decode("ascii")]["hw_counters"] = {}
+                counter = 0
+                while True:
+                    hwname = clibrebound.reb_profiling_get_hw_name(c_int(counter))
+                    if hwname is None:
+                        break
+                    stats[name.decode("ascii")]["hw_counters"][hwname.decode("ascii")] = clibrebound.reb_profiling_get_hw(byref(self), c_int(cat), c_int(counter), c_int(thread))
+                    counter += 1
+            cat += 1
+        return stats
+
+    def profiling_reset(self):
+        """
+        Resets all profiling counters.
+        """
+        clibrebound.reb_profiling_reset(byref(self))
         
 # Integration
     def step(self):
@@ -995,6 +1256,36 @@ class Simulation(Structure):
         Call this function if safe-mode is disabled and you need synchronize particle positions and velocities between timesteps.
         """
         clibrebound.reb_integrator_synchronize(byref(self))
+
+    def dense_output(self, t):
+        """
+        Evaluates positions and velocities at time t within the last IAS15 timestep.
+
+        IAS15 approximates the motion during each timestep by a high order polynomial. 
+        This function evaluates the polynomial of the last completed timestep and 
+        returns copies of the particles at time t. The particles in the simulation are 
+        not modified. Together with ``exact_finish_time=0``, this allows outputs at 
+        arbitrary times without shortening any timestep.
+
+        Parameters
+        ----------
+        t : float
+            Time at which to evaluate positions and velocities. Needs to be within the last 
+            timestep, i.e. between ``sim.t-sim.dt_last_done`` and ``sim.t``.
+
+        Examples
+        --------
+        >>> for time in np.linspace(0,100.,1000):
+        >>>     if sim.t < time:
+        >>>         sim.integrate(time, exact_finish_time=0)
+        >>>     ps = sim.dense_output(time)
+        >>>     perform_output(ps)
+        """
+        ps = (Particle*self.N)()
+        success = clibrebound.reb_integrator_ias15_dense_output(byref(self), c_double(t), byref(ps))
+        if not success:
+            raise ValueError("Dense output is only available for times within the last IAS15 timestep.")
+        return ps
     
     def tree_update(self):
         """
@@ -1118,7 +1409,12 @@ Simulation._fields_ = [
                 ("gravity_cs_allocatedN", c_int),
                 ("tree_root", c_void_p),
                 ("tree_needs_update", c_int),
+                ("tree_cell_slabs", c_void_p),
+                ("tree_cell_slabs_N", c_int),
+                ("tree_cell_allocatedN", c_int),
+                ("tree_cell_free", c_void_p),
                 ("opening_angle2", c_double),
+                ("gravity_interactions", c_void_p),
                 ("_status", c_int),
                 ("exact_finish_time", c_int),
                 ("force_is_velocity_dependent", c_uint),
@@ -1127,6 +1423,17 @@ Simulation._fields_ = [
                 ("exit_max_distance", c_double),
                 ("exit_min_distance", c_double),
                 ("usleep", c_double),
+                ("particle_lookup_enabled", c_uint),
+                ("particle_lookup", c_void_p),
+                ("particle_lookup_allocatedN", c_int),
+                ("particle_lookup_N", c_int),
+                ("particle_lookup_stale", c_uint),
+                ("profiling_enabled", c_uint),
+                ("profiling_threads_N", c_int),
+                ("profiling_counters", c_void_p),
+                ("trace_enabled", c_uint),
+                ("trace_capacity", c_int),
+                ("profiling_hw_counters", c_uint),
                 ("boxsize", reb_vec3d),
                 ("boxsize_max", c_double),
                 ("root_size", c_double),
@@ -1143,6 +1450,23 @@ Simulation._fields_ = [
                 ("collisions_plog", c_double),
                 ("max_radius", c_double*2),
                 ("collisions_Nlog", c_long),
+                ("collision_grid", c_void_p),
+                ("collision_sweep", c_void_p),
+                ("collision_buffers", c_void_p),
+                ("collision_buffers_N", c_int),
+                ("collision_remap", c_void_p),
+                ("collision_remap_allocatedN", c_int),
+                ("collision_schedule", c_void_p),
+                ("collision_skin", c_double),
+                ("collision_neighbours", c_void_p),
+                ("collision_seed", c_ulonglong),
+                ("collision_continuous", c_int),
+                ("collision_queue", c_void_p),
+                ("contact_stiffness", c_double),
+                ("contact_damping", c_double),
+                ("contact_tangential_stiffness", c_double),
+                ("contact_tangential_damping", c_double),
+                ("contact_friction", c_double),
                 ("_calculate_megno", c_int),
                 ("megno_Ys", c_double),
                 ("megno_Yss", c_double),
@@ -1151,20 +1475,35 @@ Simulation._fields_ = [
                 ("megno_mean_t", c_double),
                 ("megno_mean_Y", c_double),
                 ("megno_n", c_long),
+                ("events_epsilon", c_double),
+                ("events_N", c_int),
+                ("events_allocatedN", c_int),
+                ("_events", POINTER(Event)),
+                ("events_particles_allocatedN", c_int),
+                ("_events_particles", POINTER(Particle)),
+                ("_events_f_last", c_double),
+                ("_events_f_last_t", c_double),
+                ("_events_f_last_N", c_int),
+                ("_events_f_last_allocatedN", c_int),
+                ("_events_f_last_particles", POINTER(Particle)),
+                ("_events_f_last_event", c_void_p),
                 ("_collision", c_int),
                 ("_integrator", c_int),
                 ("_boundary", c_int),
                 ("_gravity", c_int),
+                ("_contact", c_int),
                 ("ri_sei", reb_simulation_integrator_sei), 
                 ("ri_wh", reb_simulation_integrator_wh), 
                 ("ri_hybrid", reb_simulation_integrator_hybrid),
                 ("ri_whfast", reb_simulation_integrator_whfast),
                 ("ri_ias15", reb_simulation_integrator_ias15),
+                ("ri_leapfrog", reb_simulation_integrator_leapfrog),
                 ("_additional_forces", CFUNCTYPE(None,POINTER(Simulation))),
                 ("_post_timestep_modifications", CFUNCTYPE(None,POINTER(Simulation))),
                 ("_heartbeat", CFUNCTYPE(None,POINTER(Simulation))),
                 ("_coefficient_of_restitution", CFUNCTYPE(c_double,POINTER(Simulation), c_double)),
                 ("_collision_resolve", CFUNCTYPE(c_int,POINTER(Simulation), reb_collision)),
+                ("_event", CFUNCTYPE(c_double,POINTER(Simulation))),
                 ("extras", c_void_p),
                  ]
 
@@ -1189,6 +1528,7 @@ POINTER_REB_SIM = POINTER(Simulation)
 AFF = CFUNCTYPE(None,POINTER_REB_SIM)
 CORFF = CFUNCTYPE(c_double,POINTER_REB_SIM, c_double)
 COLRFF = CFUNCTYPE(c_int, POINTER_REB_SIM, reb_collision)
+EVFF = CFUNCTYPE(c_double, POINTER_REB_SIM)
 
 # Import at the end to avoid circular dependence
 from . import horizons
@@ -53,6 +53,30 @@ class TestIntegrator2(unittest.TestCase):
         x1 = sim.calculate_energy()
         self.assertAlmostEqual(x0, x1, delta=1e-14)
 
+    def test_leapfrog_block_timesteps(self):
+        # A close planet needs much shorter timesteps than the outer particles.
+        energies = []
+        for block_levels in [0, 8]:
+            sim = rebound.Simulation()
+            sim.integrator = "leapfrog"
+            sim.gravity = "tree"
+            sim.configure_box(100.)
+            sim.softening = 1e-3
+            sim.add(m=1.)
+            sim.add(m=1e-3, a=0.1)
+            for i in range(20):
+                sim.add(m=1e-3, a=1.+0.2*i, e=0.05, inc=0.1, Omega=i, f=2.*i)
+            sim.move_to_com()
+            sim.dt = 0.1
+            sim.ri_leapfrog.block_levels = block_levels
+            e0 = sim.calculate_energy()
+            sim.integrate(20.)
+            e1 = sim.calculate_energy()
+            self.assertEqual(sim.N, 22)
+            energies.append(math.fabs((e0-e1)/e1))
+        self.assertGreater(energies[0], 1e-2)
+        self.assertLess(energies[1], 1e-4)
+
 
 class TestIntegrator(unittest.TestCase):
     def setUp(self):
@@ -86,6 +110,88 @@ class TestIntegrator(unittest.TestCase):
         e1 = self.sim.calculate_energy()
         self.assertLess(math.fabs((e0-e1)/e1),1e-14)
     
+    def test_ias15_add_particles(self):
+        self.sim.integrator = "ias15"
+        jupyr = 11.86*2.*math.pi
+        e0 = self.sim.calculate_energy()
+        allocated = []
+        for i in range(20):
+            self.sim.add(primary=self.sim.particles[0], a=1.+0.1*i, e=0.1, f=0.3*i)
+            self.sim.integrate(self.sim.t+jupyr)
+            self.assertGreaterEqual(self.sim.ri_ias15.arena_allocatedN, 3*self.sim.N)
+            allocated.append(self.sim.ri_ias15.arena_allocatedN)
+        # Capacity grows geometrically, not with every new particle.
+        self.assertLess(len(set(allocated)), 5)
+        e1 = self.sim.calculate_energy()
+        self.assertLess(math.fabs((e0-e1)/e1),1e-14)
+    
+    def test_ias15_dense_output(self):
+        self.sim.integrator = "ias15"
+        sim2 = rebound.Simulation()
+        rebound.data.add_outer_solar_system(sim2)
+        sim2.move_to_com()
+        times = [0.25*i for i in range(1,200)]
+        steps = 0
+        for t in times:
+            if self.sim.t < t:
+                self.sim.integrate(t, exact_finish_time=0)
+                steps += 1
+            ps = self.sim.dense_output(t)
+            sim2.integrate(t)
+            for p, p2 in zip(ps, sim2.particles):
+                self.assertAlmostEqual(p.x, p2.x, delta=1e-12)
+                self.assertAlmostEqual(p.vy, p2.vy, delta=1e-12)
+        # Several outputs per timestep, none of the steps was shortened.
+        self.assertLess(steps, len(times))
+        self.assertGreater(self.sim.t, times[-1])
+        with self.assertRaises(ValueError):
+            self.sim.dense_output(0.)
+
+    def test_ias15_block_timesteps(self):
+        # A close moon of Jupiter needs much smaller timesteps than the planets.
+        sims = []
+        for block_levels in [0, 8]:
+            sim = rebound.Simulation()
+            rebound.data.add_outer_solar_system(sim)
+            sim.add(m=1e-9, a=0.003, primary=sim.particles[1])
+            sim.move_to_com()
+            sim.integrator = "ias15"
+            sim.ri_ias15.block_levels = block_levels
+            e0 = sim.calculate_energy()
+            sim.integrate(10.)
+            e1 = sim.calculate_energy()
+            self.assertLess(math.fabs((e0-e1)/e1),1e-14)
+            sims.append(sim)
+        # The planets are integrated with much larger timesteps than the moon.
+        self.assertGreater(sims[1].dt, 20.*sims[0].dt)
+        for p, p2 in zip(sims[0].particles, sims[1].particles):
+            self.assertAlmostEqual(p.x, p2.x, delta=1e-10)
+            self.assertAlmostEqual(p.vy, p2.vy, delta=1e-8)
+
+    def test_ias15_tree_interaction_lists(self):
+        sim = rebound.Simulation()
+        sim.gravity = "tree"
+        sim.configure_box(1000.)
+        # All cells are opened. The forces are the same as with direct summation.
+        sim.opening_angle2 = 0.
+        sim.ri_ias15.tree_interaction_lists = 1
+        rebound.data.add_outer_solar_system(sim)
+        sim.move_to_com()
+        sim.integrator = "ias15"
+        jupyr = 11.86*2.*math.pi
+        e0 = sim.calculate_energy()
+        sim.integrate(1e1*jupyr)
+        e1 = sim.calculate_energy()
+        self.assertLess(math.fabs((e0-e1)/e1),1e-14)
+        self.sim.integrator = "ias15"
+        self.sim.integrate(1e1*jupyr)
+        # The tree reorders particles.
+        ps = sorted(sim.particles, key=lambda p: p.m)
+        ps2 = sorted(self.sim.particles, key=lambda p: p.m)
+        for p, p2 in zip(ps, ps2):
+            self.assertAlmostEqual(p.x, p2.x, delta=1e-10)
+            self.assertAlmostEqual(p.vy, p2.vy, delta=1e-10)
+
     def test_wh(self):
         self.sim.integrator = "wh"
         self.sim.move_to_com()
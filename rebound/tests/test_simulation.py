@@ -59,6 +59,131 @@ class TestSimulation(unittest.TestCase):
         with self.assertRaises(ValueError):
             self.sim.remove(id=-99334)
     
+    def test_get_particle_by_id(self):
+        self.sim.add(m=1e-3, a=1., id=99)
+        self.assertEqual(self.sim.get_particle_by_id(99).m, 1e-3)
+        with self.assertRaises(ValueError):
+            self.sim.get_particle_by_id(98)
+    
+    def test_particle_lookup(self):
+        sim = rebound.Simulation()
+        sim.particle_lookup_enabled = 1
+        for i in range(300):
+            sim.add(m=1e-6*i, x=i, id=1000+7*i)
+        for i in range(300):
+            self.assertEqual(sim.get_particle_by_id(1000+7*i).x, i)
+        sim.remove(id=1000, keepSorted=0)
+        sim.remove(id=1000+7*150, keepSorted=1)
+        sim.remove(id=1000+7*299, keepSorted=0)
+        self.assertEqual(sim.N, 297)
+        for i in range(300):
+            if i in [0, 150, 299]:
+                with self.assertRaises(ValueError):
+                    sim.get_particle_by_id(1000+7*i)
+            else:
+                self.assertEqual(sim.get_particle_by_id(1000+7*i).x, i)
+        sim.particles[0].id = 5
+        # Misses do not rebuild the table unless it is marked as stale.
+        with self.assertRaises(ValueError):
+            sim.get_particle_by_id(5)
+        sim.particle_lookup_stale = 1
+        self.assertEqual(sim.get_particle_by_id(5).x, sim.particles[0].x)
+        self.assertEqual(sim.particle_lookup_stale, 0)
+    
+    def test_particle_lookup_duplicate_ids(self):
+        # The hash table must return the same particle as the linear search.
+        sims = [rebound.Simulation(), rebound.Simulation()]
+        sims[1].particle_lookup_enabled = 1
+        for sim in sims:
+            for i in range(20):
+                sim.add(m=1e-6, x=i, id=5 if i%3==0 else i)
+            sim.remove(index=0, keepSorted=0)
+            sim.remove(index=3, keepSorted=1)
+            sim.remove(id=5, keepSorted=0)
+            sim.remove(id=5, keepSorted=1)
+            sim.add(m=1e-6, x=100, id=5)
+            sim.add(m=1e-6, x=101, id=7)
+            sim.remove(id=7, keepSorted=0)
+        self.assertEqual(sims[0].N, sims[1].N)
+        for id in range(20):
+            try:
+                x = sims[0].get_particle_by_id(id).x
+            except ValueError:
+                with self.assertRaises(ValueError):
+                    sims[1].get_particle_by_id(id)
+            else:
+                self.assertEqual(sims[1].get_particle_by_id(id).x, x)
+        self.assertEqual(sims[1].get_particle_by_id(5).x, sims[0].get_particle_by_id(5).x)
+        sim = rebound.Simulation()
+        sim.particle_lookup_enabled = 1
+        sim.add(m=1e-6, x=1, id=5)
+        sim.add(m=1e-6, x=2, id=5)
+        self.assertEqual(sim.get_particle_by_id(5).x, 1)
+        sim.remove(index=0)
+        self.assertEqual(sim.get_particle_by_id(5).x, 2)
+    
+    def test_profiling(self):
+        self.assertEqual(self.sim.profiling_enabled, 0)
+        self.sim.profiling_enabled = 1
+        self.sim.integrate(10.)
+        stats = self.sim.profiling_stats()
+        self.assertIsNone(stats["gravity"]["parent"])
+        self.assertEqual(stats["gravity_walk"]["parent"], "gravity")
+        self.assertGreater(stats["gravity_walk"]["calls"], 0)
+        self.assertGreater(stats["integrator"]["time_inclusive"], 0.)
+        self.assertAlmostEqual(stats["gravity"]["time_inclusive"], stats["gravity"]["time"]+stats["gravity_walk"]["time"]+stats["gravity_multipoles"]["time"], delta=1e-12)
+        self.sim.save_profiling("profiling.csv", format="csv")
+        with open("profiling.csv") as f:
+            self.assertEqual(f.readline().strip(), "category,parent,thread,calls,time,time_inclusive,parallel_calls,parallel_time")
+        os.remove("profiling.csv")
+        if self.sim.profiling_threads_N>1:
+            # Every thread records its share of the parallel gravity loop
+            for t in range(self.sim.profiling_threads_N):
+                self.assertGreater(self.sim.profiling_stats(thread=t)["gravity_walk"]["parallel_calls"], 0)
+                self.assertGreater(self.sim.profiling_stats(thread=t)["gravity_walk"]["parallel_time"], 0.)
+        self.sim.profiling_reset()
+        self.assertEqual(self.sim.profiling_stats()["gravity_walk"]["calls"], 0)
+    
+    def test_profiling_hw_counters(self):
+        # Hardware counters might not be available (e.g. in containers).
+        self.sim.profiling_enabled = 1
+        self.sim.profiling_hw_counters = 1
+        self.sim.integrate(10.)
+        stats = self.sim.profiling_stats()
+        self.assertGreater(stats["gravity_walk"]["calls"], 0)
+        if "hw_counters" in stats["gravity_walk"]:
+            self.assertGreater(stats["gravity_walk"]["hw_counters"]["instructions"], 0)
+            for t in range(1, self.sim.profiling_threads_N):
+                # Worker threads count their share of the parallel gravity loop
+                self.assertGreater(self.sim.profiling_stats(thread=t)["gravity_walk"]["hw_counters"]["instructions"], 0)
+        self.sim.save_profiling("profiling.csv", format="csv")
+        with open("profiling.csv") as f:
+            self.assertEqual(f.readline().strip(), "category,parent,thread,calls,time,time_inclusive,parallel_calls,parallel_time,cycles,instructions,l1d_misses,llc_misses,branch_misses")
+        os.remove("profiling.csv")
+    
+    def test_trace(self):
+        import json
+        self.sim.trace_enabled = 1
+        self.sim.trace_capacity = 10
+        self.sim.integrate(10.)
+        self.sim.save_trace("trace.json")
+        with open("trace.json") as f:
+            trace = json.load(f)
+        os.remove("trace.json")
+        threads_N = len([e for e in trace["traceEvents"] if e["ph"]=="M" and e["name"]=="thread_name"])
+        events = [e for e in trace["traceEvents"] if e["ph"]=="X"]
+        tids = set(e["tid"] for e in events)
+        self.assertEqual(len([e for e in events if e["tid"]==0]), 1024) # Ring buffer is full, minimum size is 1024
+        for tid in tids:
+            self.assertLessEqual(len([e for e in events if e["tid"]==tid]), 1024) # One ring buffer per thread
+        self.assertTrue("gravity_walk" in [e["name"] for e in events])
+        for e in events:
+            self.assertGreaterEqual(e["dur"], 0.)
+            self.assertLess(e["tid"], threads_N)
+        if threads_N>1:
+            # Scopes inside parallel regions are recorded by every thread
+            self.assertGreater(len(tids), 1)
+    
     def test_configure_ghostboxes(self):
         self.sim.configure_ghostboxes(1,1,1)
    
@@ -179,6 +304,58 @@ class TestSimulation(unittest.TestCase):
         self.assertEqual(self.sim.integrator, sim2.integrator)
         os.remove("bintest.bin")
     
+    def test_event(self):
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(a=1.) # Test particle on a circular orbit, y = sin(t).
+        def crossing(simp):
+            return simp.contents.particles[1].y
+        sim.event = crossing
+        sim.integrate(10.)
+        events = sim.events
+        self.assertEqual(len(events), 3)
+        for i, e in enumerate(events):
+            self.assertAlmostEqual(e.t, math.pi*(i+1), delta=1e-12)
+            self.assertEqual(e.direction, -1 if i%2==0 else 1)
+            self.assertAlmostEqual(e.particles[1].y, 0., delta=1e-12)
+            self.assertAlmostEqual(e.particles[1].x, -1. if i%2==0 else 1., delta=1e-12)
+        sim.events_N = 0
+        self.assertEqual(len(sim.events), 0)
+
+    def test_event_cache(self):
+        # The event function is evaluated only once at the time between two steps.
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(a=1.)
+        times = []
+        def crossing(simp):
+            times.append(simp.contents.t)
+            return simp.contents.particles[1].y
+        sim.event = crossing
+        sim.integrate(3.) # Before the first crossing.
+        times.sort()
+        self.assertGreater(min(t2-t1 for t1, t2 in zip(times[:-1], times[1:])), 1e-10)
+        # Changing the particles between steps invalidates the cached value.
+        # Otherwise the sign change from this modification would be an event.
+        self.assertGreater(sim.particles[1].y, 0.1)
+        sim.particles[1].y *= -1.
+        sim.particles[1].vy *= -1.
+        sim.integrate(3.1)
+        self.assertEqual(len(sim.events), 0)
+
+    def test_event_block_timesteps(self):
+        # Block timesteps have no dense output. IAS15 falls back to global steps.
+        sim = rebound.Simulation()
+        sim.add(m=1.)
+        sim.add(a=1.)
+        sim.ri_ias15.block_levels = 4
+        def crossing(simp):
+            return simp.contents.particles[1].y
+        sim.event = crossing
+        sim.integrate(10.)
+        self.assertEqual(len(sim.events), 3)
+        self.assertEqual(sim.ri_ias15.block_levels, 0)
+    
     
 class TestSimulationCollisions(unittest.TestCase):
     def setUp(self):
@@ -203,6 +380,57 @@ class TestSimulationCollisions(unittest.TestCase):
         energy_final = self.sim.calculate_energy()
         self.assertAlmostEqual(energy_final, 0.25*energy_initial,delta=1e-15)
 
+    def test_hardsphere_parallel(self):
+        # With OpenMP, hard sphere collisions are resolved in parallel. The result 
+        # must be the same as with the serial loop, which is used for any other 
+        # collision_resolve function.
+        import random
+        def serial(sim_pointer, collision):
+            return rebound.clibrebound.reb_collision_resolve_hardsphere(sim_pointer, collision)
+        def coef(sim, vrel):
+            return 1./(1.+vrel)
+        def run(resolve):
+            self.setUp()
+            self.sim.collision_seed = 3
+            self.sim.collision_resolve = resolve
+            self.sim.coefficient_of_restitution = coef
+            rnd = random.Random(1)
+            for i in range(10):
+                for j in range(10):
+                    self.sim.add(m=1.,x=0.8*i,y=0.8*j,vx=rnd.uniform(-1.,1.),vy=rnd.uniform(-1.,1.),r=0.5)
+            for k in range(5):
+                self.sim.step()
+            return [(p.vx, p.vy) for p in self.sim.particles], self.sim.collisions_plog, self.sim.collisions_Nlog
+        parallel = run("hardsphere")
+        self.assertGreater(parallel[2], 100)
+        self.assertEqual(parallel, run(serial))
+
+    def test_merge_many(self):
+        # Several mergers in the same timestep.
+        self.sim.collision_resolve = "merge"
+        self.sim.particle_lookup_enabled = 1
+        for i in range(5):
+            self.sim.add(m=1.,x=0.2*i,vx=-0.1*i,r=0.5,id=i)
+        self.sim.integrate(0.1)
+        self.assertEqual(self.sim.N, 1)
+        self.assertAlmostEqual(self.sim.particles[0].m,5.,delta=1e-15)
+        self.assertAlmostEqual(self.sim.particles[0].vx,-0.2,delta=1e-15)
+        self.assertEqual(self.sim.get_particle_by_id(0).m, 5.)
+
+    def test_collision_seed(self):
+        # Same seed, same order in which collisions are resolved.
+        def run(seed):
+            self.setUp()
+            self.sim.collision_seed = seed
+            for i in range(10):
+                # Each particle overlaps with several others
+                self.sim.add(m=1.,x=0.3*i,vx=0.1*i*(-1.)**i,r=0.5)
+            self.sim.step()
+            return [p.vx for p in self.sim.particles]
+        self.assertEqual(run(7), run(7))
+        # A different seed changes the order and thus the result.
+        self.assertNotEqual(run(7), run(8))
+
     def test_direct(self):
         self.sim.add(m=1.,x=-1,vx=1.,r=0.5)
         self.sim.add(m=1.,x=1,vx=-1.,r=0.5)
@@ -217,6 +445,189 @@ class TestSimulationCollisions(unittest.TestCase):
         self.sim.integrate(1.)
         self.assertAlmostEqual(self.sim.particles[0].x,-1,delta=1e-15)
 
+    def test_tree_size_spread(self):
+        # One large particle among many small ones. The tree prunes cells
+        # with their own maximum radius and must find the same collisions.
+        import random
+        for seed in range(3):
+            pairs = {}
+            for collision in ["direct", "tree"]:
+                self.setUp()
+                self.sim.configure_box(10)
+                self.sim.collision = collision
+                random.seed(seed)
+                self.sim.add(m=1.,r=3.,id=0)
+                for i in range(1,1000):
+                    x, y, z = [random.uniform(-4.9,4.9) for _ in range(3)]
+                    self.sim.add(m=1e-3,x=x,y=y,z=z,vx=-x,vy=-y,vz=-z,r=0.3,id=i)
+                found = set()
+                def record(simp, c):
+                    ps = simp.contents.particles
+                    found.add(frozenset([ps[c.p1].id, ps[c.p2].id]))
+                    return 0
+                self.sim.collision_resolve = record
+                self.sim.step()
+                pairs[collision] = found
+            self.assertGreater(len([p for p in pairs["direct"] if 0 in p]), 10)
+            self.assertEqual(pairs["direct"], pairs["tree"])
+
+    def test_grid(self):
+        self.sim.collision = "grid"
+        self.assertEqual(self.sim.collision, "grid")
+        self.sim.add(m=1.,x=-1,vx=1.,r=0.5)
+        self.sim.add(m=1.,x=1,vx=-1.,r=0.5)
+        self.sim.integrate(1.)
+        self.assertAlmostEqual(self.sim.particles[0].x,-1,delta=1e-15)
+
+    def test_sweep(self):
+        for collision in ["sweep", "sweepphi"]:
+            self.setUp()
+            self.sim.collision = collision
+            self.assertEqual(self.sim.collision, collision)
+            self.sim.add(m=1.,x=-1,vx=1.,r=0.5)
+            self.sim.add(m=1.,x=1,vx=-1.,r=0.5)
+            self.sim.integrate(1.)
+            # Collisions are resolved at the time of contact (up to a small offset).
+            self.assertAlmostEqual(self.sim.particles[0].x,-1,delta=1e-5)
+            self.assertAlmostEqual(self.sim.particles[1].x,1,delta=1e-5)
+
+    def test_sweep_shear(self):
+        # Particles collide across the radial boundary of a shearing sheet.
+        # The ghost box moves while particles are moved to the time of contact.
+        v = []
+        for collision, continuous in [("sweep", 0), ("direct", 1)]:
+            self.setUp()
+            self.sim.configure_box(10)
+            self.sim.nghostx = 1
+            self.sim.nghosty = 1
+            self.sim.nghostz = 0
+            self.sim.boundary = "shear"
+            self.sim.ri_sei.OMEGA = 0.05
+            self.sim.dt = 0.2
+            self.sim.collision = collision
+            self.sim.collision_continuous = continuous
+            self.sim.add(m=1.,x=4.4,vx=1.,r=0.5)
+            self.sim.add(m=1.,x=-4.4,y=0.2,vx=-1.,r=0.5)
+            self.sim.step()
+            self.assertEqual(self.sim.collisions_Nlog,1)
+            v.append([(p.vx, p.vy) for p in self.sim.particles])
+        for p, p2 in zip(v[0], v[1]):
+            self.assertAlmostEqual(p[0],p2[0],delta=1e-12)
+            self.assertAlmostEqual(p[1],p2[1],delta=1e-12)
+
+    def test_periodic(self):
+        for collision, skin in [("direct", 0.), ("tree", 0.), ("grid", 0.), ("sweep", 0.), ("direct", 0.2), ("tree", 0.2)]:
+            self.setUp()
+            self.sim.configure_box(10)
+            self.sim.nghostx = 1
+            self.sim.nghosty = 1
+            self.sim.nghostz = 1
+            self.sim.boundary = "periodic"
+            self.sim.collision = collision
+            self.sim.collision_skin = skin
+            self.sim.add(m=1.,x=3.6,vx=1.,r=0.5,id=1)
+            self.sim.add(m=1.,x=-3.6,vx=-1.,r=0.5,id=2)
+            self.sim.add(m=1.,x=0.,y=2.,r=0.5,id=3)
+            self.sim.integrate(2.)
+            # Particles collide across the boundary of the box after t=0.9.
+            # The tree might reorder particles.
+            self.assertEqual(self.sim.collisions_Nlog,1)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(1).vx,-1.,delta=1e-15)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(2).vx,1.,delta=1e-15)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(3).vx,0.,delta=1e-15)
+
+    def test_skin_tree_gravity(self):
+        # With tree gravity, the neighbour list is built during the gravity walk.
+        results = []
+        for skin in [0., 0.5]:
+            self.setUp()
+            self.sim.configure_box(10)
+            self.sim.nghostx = 1
+            self.sim.nghosty = 1
+            self.sim.nghostz = 1
+            self.sim.boundary = "periodic"
+            self.sim.gravity = "tree"
+            self.sim.collision = "tree"
+            self.sim.collision_skin = skin
+            self.sim.softening = 0.1
+            self.sim.dt = 0.01
+            for i in range(50):
+                self.sim.add(m=0.01,x=10.*((i*0.618034)%1.)-5.,y=10.*((i*0.754878)%1.)-5.,z=10.*((i*0.569840)%1.)-5.,vx=math.sin(1.3*i),vy=math.cos(2.1*i),vz=math.sin(0.7*i),r=0.3,id=i+1)
+            self.sim.integrate(2.)
+            results.append((self.sim.collisions_Nlog, [self.sim.get_particle_by_id(i+1).vx for i in range(50)]))
+        self.assertGreater(results[0][0],0)
+        self.assertEqual(results[0][0],results[1][0])
+        for vx0, vx1 in zip(results[0][1],results[1][1]):
+            self.assertAlmostEqual(vx0,vx1,delta=1e-12)
+
+    def test_continuous(self):
+        for collision in ["direct", "tree"]:
+            self.setUp()
+            self.sim.configure_box(10)
+            self.sim.collision = collision
+            self.sim.collision_continuous = 1
+            self.sim.dt = 0.15
+            # Particles would pass through each other during one timestep.
+            self.sim.add(m=1.,x=-1.,vx=10.,r=0.1,id=1)
+            self.sim.add(m=1.,x=1.,vx=-10.,r=0.1,id=2)
+            self.sim.step()
+            self.assertEqual(self.sim.collisions_Nlog,1)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(1).vx,-10.,delta=1e-12)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(1).x,-0.7,delta=1e-6)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(2).x,0.7,delta=1e-6)
+
+    def test_continuous_time_order(self):
+        for collision in ["direct", "tree"]:
+            self.setUp()
+            self.sim.configure_box(10)
+            self.sim.collision = collision
+            self.sim.collision_continuous = 1
+            self.sim.dt = 0.15
+            # The first particle bounces off the heavy particle before it reaches the third one.
+            self.sim.add(m=1.,x=-1.,vx=10.,r=0.1,id=1)
+            self.sim.add(m=1e6,x=0.,r=0.1,id=2)
+            self.sim.add(m=1.,x=0.35,r=0.1,id=3)
+            self.sim.step()
+            self.assertEqual(self.sim.collisions_Nlog,1)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(1).vx,-10.,delta=1e-4)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(3).vx,0.,delta=1e-15)
+            self.assertAlmostEqual(self.sim.get_particle_by_id(3).x,0.35,delta=1e-15)
+
+    def test_softsphere(self):
+        self.sim.contact = "softsphere"
+        self.sim.contact_stiffness = 1e4
+        self.sim.dt = 1e-4
+        self.sim.add(m=1.,x=-1.,vx=1.,r=0.5)
+        self.sim.add(m=1.,x=1.,vx=-1.,r=0.5)
+        self.sim.integrate(1.)
+        # Contact lasts about pi*sqrt(0.5/1e4) and conserves energy without damping.
+        self.assertAlmostEqual(self.sim.particles[0].vx,-1.,delta=1e-3)
+        self.assertAlmostEqual(self.sim.particles[1].vx,1.,delta=1e-3)
+        self.assertAlmostEqual(self.sim.particles[0].vx+self.sim.particles[1].vx,0.,delta=1e-12)
+        self.assertEqual(self.sim.collisions_Nlog,0)
+
+    def test_softsphere_history(self):
+        # Tangential springs are kept when the neighbour list is rebuilt.
+        vy = []
+        for collision, skin in [("direct", 0.), ("direct", 2.), ("tree", 0.), ("tree", 2.)]:
+            self.setUp()
+            self.sim.configure_box(10)
+            self.sim.collision = collision
+            self.sim.collision_skin = skin
+            self.sim.contact = "softsphere"
+            self.sim.contact_stiffness = 1e4
+            self.sim.contact_damping = 10.
+            self.sim.contact_tangential_stiffness = 3e3
+            self.sim.contact_friction = 0.5
+            self.sim.dt = 1e-4
+            self.sim.add(m=1.,x=-1.,y=0.3,vx=1.,r=0.5,id=1)
+            self.sim.add(m=2.,x=1.,vx=-1.,vy=0.2,r=0.5,id=2)
+            self.sim.integrate(1.)
+            vy.append(self.sim.get_particle_by_id(1).vy)
+        self.assertNotEqual(vy[0],0.)
+        for v in vy[1:]:
+            self.assertAlmostEqual(v,vy[0],delta=1e-12)
+
     
     
 if __name__ == "__main__":
@@ -34,95 +34,547 @@
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
+#include <string.h>
 #include "particle.h"
 #include "collision.h"
 #include "rebound.h"
 #include "boundary.h"
 #include "tree.h"
+#include "profiling.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif // MPI
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
 
-static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, int* collisions_N, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r,  double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c);
+static void reb_collision_grid_update(struct reb_simulation* const r);
+static void reb_collision_grid_search(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, int i, struct reb_ghostbox gbunmod);
+static void reb_collision_sweep_update(struct reb_simulation* const r);
+static void reb_collision_sweep_search(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, int p);
+static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r,  double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c);
+#if defined(OPENMP) && !defined(MPI)
+static void reb_collision_resolve_hardsphere_parallel(struct reb_simulation* const r, const int collisions_N);
+#endif // OPENMP && !MPI
+static int reb_collision_neighbours_search(struct reb_simulation* const r);
+
+#define REB_COLLISION_DIRECT_BLOCK 64	///< Number of particles tested at once in the direct collision search.
+
+/**
+ * @brief Resets the collision buffers of all threads, allocating them if needed.
+ * @details Must not be called from within a parallel region.
+ */
+static void reb_collision_buffers_prepare(struct reb_simulation* const r){
+#ifdef OPENMP
+	const int threads_N = omp_get_max_threads();
+#else // OPENMP
+	const int threads_N = 1;
+#endif // OPENMP
+	if (r->collision_buffers_N<threads_N){
+		r->collision_buffers = realloc(r->collision_buffers, sizeof(struct reb_collision_buffer)*threads_N);
+		for (int t=r->collision_buffers_N;t<threads_N;t++){
+			r->collision_buffers[t].collisions = NULL;
+			r->collision_buffers[t].allocatedN = 0;
+		}
+		r->collision_buffers_N = threads_N;
+	}
+	for (int t=0;t<r->collision_buffers_N;t++){
+		r->collision_buffers[t].N = 0;
+	}
+}
+
+/**
+ * @brief Returns the collision buffer of the calling thread.
+ */
+static inline struct reb_collision_buffer* reb_collision_buffer_get(struct reb_simulation* const r){
+#ifdef OPENMP
+	return &(r->collision_buffers[omp_get_thread_num()]);
+#else // OPENMP
+	return &(r->collision_buffers[0]);
+#endif // OPENMP
+}
+
+/**
+ * @brief Appends a collision to a buffer and returns a pointer to it.
+ */
+static inline struct reb_collision* reb_collision_buffer_add(struct reb_collision_buffer* const buffer){
+	if (buffer->allocatedN<=buffer->N){
+		buffer->allocatedN = buffer->allocatedN?buffer->allocatedN*2:32;
+		buffer->collisions = realloc(buffer->collisions,sizeof(struct reb_collision)*buffer->allocatedN);
+	}
+	return &(buffer->collisions[buffer->N++]);
+}
+
+/**
+ * @brief Copies the collisions of all threads into r->collisions.
+ * @details Buffers are concatenated in the order of the thread number. 
+ * With a static loop schedule the result is therefore the same in every 
+ * run with the same number of threads.
+ * @return Total number of collisions.
+ */
+static int reb_collision_buffers_merge(struct reb_simulation* const r){
+	int collisions_N = 0;
+	for (int t=0;t<r->collision_buffers_N;t++){
+		collisions_N += r->collision_buffers[t].N;
+	}
+	if (r->collisions_allocatedN<collisions_N){
+		r->collisions_allocatedN = collisions_N;
+		r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
+	}
+	int offset = 0;
+	for (int t=0;t<r->collision_buffers_N;t++){
+		const struct reb_collision_buffer* const buffer = &(r->collision_buffers[t]);
+		if (buffer->N){
+			memcpy(&(r->collisions[offset]), buffer->collisions, sizeof(struct reb_collision)*buffer->N);
+			offset += buffer->N;
+		}
+	}
+	return collisions_N;
+}
+
+void reb_collision_buffers_free(struct reb_simulation* const r){
+	for (int t=0;t<r->collision_buffers_N;t++){
+		free(r->collision_buffers[t].collisions);
+	}
+	free(r->collision_buffers);
+	r->collision_buffers = NULL;
+	r->collision_buffers_N = 0;
+}
+
+/**
+ * @brief Returns a random integer in [0,n) using the random number generator of the simulation.
+ * @details Uses the xorshift64* generator. The state is stored in r->collision_seed.
+ */
+static int reb_collision_random_int(struct reb_simulation* const r, const int n){
+	unsigned long long x = r->collision_seed;
+	if (x==0){
+		x = 0x9E3779B97F4A7C15ULL; // Zero is a fixed point of xorshift.
+	}
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	r->collision_seed = x;
+	return (int)(((x*2685821657736338717ULL)>>32)%(unsigned long long)n);
+}
+
+/**
+ * @brief Checks if the second particle of a collision is stored in r->particles.
+ * @details With MPI, the second particle might be on another node.
+ */
+static inline int reb_collision_p2_is_local(struct reb_simulation* const r, const struct reb_collision c){
+#ifdef MPI
+	return reb_communication_mpi_rootbox_is_local(r, c.ri);
+#else // MPI
+	return 1;
+#endif // MPI
+}
+
+/**
+ * @brief Removes all particles flagged in r->collision_remap in a single pass.
+ * @details Without a tree, the remaining particles are kept in order. 
+ * Afterwards, r->collision_remap contains the new index of each particle
+ * that existed before the collisions were resolved, or -1 if it was removed.
+ * With a tree, particles are only flagged and removed in the next tree update.
+ * @param r REBOUND simulation to operate on
+ * @param N_initial Number of particles before the collisions were resolved.
+ */
+static void reb_collision_remove_flagged(struct reb_simulation* const r, const int N_initial){
+	int* const remap = r->collision_remap;
+	if (r->N_var){
+		fprintf(stderr, "\nRemoving particles not supported when calculating MEGNO.  Did not remove particle.\n");
+		return;
+	}
+	if (r->tree_root){
+		for (int i=0;i<N_initial;i++){
+			if (remap[i]<0){
+				reb_particle_lookup_delete(r, r->particles[i].id);
+				// Just flag particle, will be removed in tree_update.
+				r->particles[i].y = nan("");
+			}
+		}
+		return;
+	}
+	int N = 0;
+	for (int i=0;i<r->N;i++){
+		if (i<N_initial){
+			if (remap[i]<0){
+				reb_particle_lookup_delete(r, r->particles[i].id);
+				continue;
+			}
+			remap[i] = N;
+		}
+		if (i!=N){
+			r->particles[N] = r->particles[i];
+			reb_particle_lookup_insert(r, r->particles[N].id, N);
+		}
+		N++;
+	}
+	if (N==0){
+		fprintf(stderr, "Last particle removed.\n");
+	}
+	r->N = N;
+}
+
+/**
+ * @brief Moves a particle along a straight line.
+ */
+static inline void reb_collision_drift(struct reb_simulation* const r, const int i, const double dt){
+	struct reb_particle* const p = &(r->particles[i]);
+	p->x += dt*p->vx;
+	p->y += dt*p->vy;
+	p->z += dt*p->vz;
+}
+
+/**
+ * @brief Calculates when two particles first touch while approaching each other, assuming they move on straight lines.
+ * @details The relative position and velocity are those at the end of the timestep
+ * (time 0). Only times in [tmin, 0] are considered. If the particles are already
+ * overlapping at tmin, they collide at tmin if they are approaching each other.
+ * Otherwise, they collide slightly after first contact so that they overlap
+ * when the collision is resolved.
+ * @param dx Relative position in x.
+ * @param dy Relative position in y.
+ * @param dz Relative position in z.
+ * @param dvx Relative velocity in x.
+ * @param dvy Relative velocity in y.
+ * @param dvz Relative velocity in z.
+ * @param rr Sum of the radii.
+ * @param tmin Earliest time considered (negative or zero).
+ * @param time Time of impact (output).
+ * @return 1 if the particles collide, 0 otherwise.
+ */
+static int reb_collision_time_of_impact(const double dx, const double dy, const double dz, const double dvx, const double dvy, const double dvz, const double rr, const double tmin, double* const time){
+	const double x0 = dx + tmin*dvx;
+	const double y0 = dy + tmin*dvy;
+	const double z0 = dz + tmin*dvz;
+	if (x0*x0 + y0*y0 + z0*z0<=rr*rr){
+		// The distance only grows if particles are not approaching each other.
+		if (dvx*x0 + dvy*y0 + dvz*z0>0.) return 0;
+		*time = tmin;
+		return 1;
+	}
+	const double a = dvx*dvx + dvy*dvy + dvz*dvz;
+	if (a==0.) return 0; // No relative motion.
+	const double b = 2.*(dvx*dx + dvy*dy + dvz*dz);
+	const double c = dx*dx + dy*dy + dz*dz - rr*rr;
+	const double root = b*b-4.*a*c;
+	if (root<0.) return 0;
+	// Floating point optimized solution of a quadratic equation. Avoids cancelations.
+	const double q = -0.5*(b+(b>=0.?1.:-1.)*sqrt(root));
+	if (q==0.) return 0; // Particles only touch at time 0.
+	double time1 = c/q;
+	double time2 = q/a;
+	if (time1>time2){
+		const double tmp = time2;
+		time2 = time1;
+		time1 = tmp;
+	}
+	// Particles are not overlapping at tmin, so time1>tmin if they touch after tmin.
+	if (time1<=tmin || time1>0.) return 0;
+	*time = time1 + 1e-6*(time2-time1);
+	return 1;
+}
+
+/**
+ * @brief Resets the remap table before collisions are resolved.
+ * @return Remap table, containing the index of each particle.
+ */
+static int* reb_collision_remap_prepare(struct reb_simulation* const r){
+	const int N = r->N;
+	if (r->collision_remap_allocatedN<N){
+		r->collision_remap_allocatedN = N;
+		r->collision_remap = realloc(r->collision_remap,sizeof(int)*r->collision_remap_allocatedN);
+	}
+	int* const remap = r->collision_remap;
+	for (int i=0;i<N;i++){
+		remap[i] = i;
+	}
+	return remap;
+}
+
+void reb_collision_queue_free(struct reb_simulation* const r){
+	struct reb_collision_queue* const q = r->collision_queue;
+	if (q==NULL) return;
+	free(q->heap);
+	free(q->version);
+	free(q->count);
+	free(q);
+	r->collision_queue = NULL;
+}
+
+/**
+ * @brief Returns 1 if collision a comes before collision b in the event queue.
+ * @details Collisions at the same time are ordered by their index, which makes
+ * the order reproducible.
+ */
+static inline int reb_collision_queue_before(const struct reb_collision* const collisions, const int a, const int b){
+	return collisions[a].time<collisions[b].time || (collisions[a].time==collisions[b].time && a<b);
+}
+
+/**
+ * @brief Moves the collision at position k of the heap down until the heap is ordered.
+ */
+static void reb_collision_queue_sift_down(const struct reb_collision* const collisions, int* const heap, const int heap_N, int k){
+	const int e = heap[k];
+	while (2*k+1<heap_N){
+		int child = 2*k+1;
+		if (child+1<heap_N && reb_collision_queue_before(collisions, heap[child+1], heap[child])){
+			child++;
+		}
+		if (!reb_collision_queue_before(collisions, heap[child], e)) break;
+		heap[k] = heap[child];
+		k = child;
+	}
+	heap[k] = e;
+}
+
+/**
+ * @brief Resolves collisions in the order of their time of impact.
+ * @details Used if collision_continuous is set. Particles are moved to the time
+ * of impact, the collision is resolved, and the particles are moved back to the
+ * end of the timestep along their new trajectories. Later collisions of the
+ * same particles are recalculated with these trajectories. If the particles no
+ * longer touch, the collision is dropped.
+ * @param r REBOUND simulation to operate on
+ * @param collisions_N Number of collisions in r->collisions
+ * @param resolve Collision resolve function
+ */
+static void reb_collision_resolve_continuous(struct reb_simulation* const r, const int collisions_N, int (*resolve) (struct reb_simulation* const r, struct reb_collision c)){
+	if (r->collision_queue==NULL){
+		r->collision_queue = calloc(1,sizeof(struct reb_collision_queue));
+	}
+	struct reb_collision_queue* const q = r->collision_queue;
+	const int N_initial = r->N;
+	if (q->collisions_allocatedN<collisions_N){
+		q->collisions_allocatedN = collisions_N;
+		q->heap = realloc(q->heap,sizeof(int)*collisions_N);
+		q->version = realloc(q->version,sizeof(int)*2*collisions_N);
+	}
+	if (q->particles_allocatedN<N_initial){
+		q->particles_allocatedN = N_initial;
+		q->count = realloc(q->count,sizeof(int)*N_initial);
+	}
+	for (int i=0;i<N_initial;i++){
+		q->count[i] = 0;
+	}
+	struct reb_collision* const collisions = r->collisions;
+	int* const heap = q->heap;
+	for (int k=0;k<collisions_N;k++){
+		heap[k] = k;
+		q->version[2*k+0] = 0;
+		q->version[2*k+1] = 0;
+	}
+	for (int k=collisions_N/2-1;k>=0;k--){
+		reb_collision_queue_sift_down(collisions, heap, collisions_N, k);
+	}
+	int heap_N = collisions_N;
+
+	int* const remap = reb_collision_remap_prepare(r);
+	int removed_N = 0;
+	double now = -r->dt_last_done;	// Time of the last collision resolved.
+	while (heap_N>0){
+		const int k = heap[0];
+		struct reb_collision* const c = &(collisions[k]);
+		// Skip collisions involving particles that have already been removed.
+		if (remap[c->p1]<0 || remap[c->p2]<0){
+			heap[0] = heap[--heap_N];
+			reb_collision_queue_sift_down(collisions, heap, heap_N, 0);
+			continue;
+		}
+		struct reb_particle* const p1 = &(r->particles[c->p1]);
+		struct reb_particle* const p2 = &(r->particles[c->p2]);
+		if (q->version[2*k+0]!=q->count[c->p1] || q->version[2*k+1]!=q->count[c->p2]){
+			// One of the particles has collided since the time of impact was calculated.
+			const double dx = p1->x + c->gb.shiftx - p2->x;
+			const double dy = p1->y + c->gb.shifty - p2->y;
+			const double dz = p1->z + c->gb.shiftz - p2->z;
+			const double dvx = p1->vx + c->gb.shiftvx - p2->vx;
+			const double dvy = p1->vy + c->gb.shiftvy - p2->vy;
+			const double dvz = p1->vz + c->gb.shiftvz - p2->vz;
+			if (reb_collision_time_of_impact(dx, dy, dz, dvx, dvy, dvz, p1->r+p2->r, now, &(c->time))){
+				q->version[2*k+0] = q->count[c->p1];
+				q->version[2*k+1] = q->count[c->p2];
+			}else{
+				heap[0] = heap[--heap_N];
+			}
+			reb_collision_queue_sift_down(collisions, heap, heap_N, 0);
+			continue;
+		}
+		heap[0] = heap[--heap_N];
+		reb_collision_queue_sift_down(collisions, heap, heap_N, 0);
+
+		// Move particles and the ghost box to the time of the collision.
+		struct reb_collision ct = *c;
+		ct.gb.shiftx += ct.time*ct.gb.shiftvx;
+		ct.gb.shifty += ct.time*ct.gb.shiftvy;
+		ct.gb.shiftz += ct.time*ct.gb.shiftvz;
+		reb_collision_drift(r, ct.p1, ct.time);
+		reb_collision_drift(r, ct.p2, ct.time);
+
+		const int outcome = resolve(r, ct);
+
+		// Move remaining particles back to the end of the timestep.
+		if (!(outcome & 1)) reb_collision_drift(r, ct.p1, -ct.time);
+		if (!(outcome & 2)) reb_collision_drift(r, ct.p2, -ct.time);
+		now = ct.time;
+		q->count[ct.p1]++;
+		q->count[ct.p2]++;
+
+		// Flag particles for removal
+		if (outcome & 1){
+			remap[ct.p1] = -1;
+			removed_N++;
+		}
+		if (outcome & 2){
+			remap[ct.p2] = -1;
+			removed_N++;
+		}
+	}
+	if (removed_N){
+		reb_collision_remove_flagged(r, N_initial);
+	}
+}
 
 void reb_collision_search(struct reb_simulation* const r){
 	const int N = r->N;
 	int collisions_N = 0;
 	const struct reb_particle* const particles = r->particles;
+	if (r->contact==REB_CONTACT_SOFTSPHERE){
+		// Overlapping particles are pushed apart by contact forces instead.
+		return;
+	}
+	if (r->collision_continuous && (r->collision==REB_COLLISION_GRID || r->collision==REB_COLLISION_SWEEP || r->collision==REB_COLLISION_SWEEPPHI)){
+		reb_exit("collision_continuous is only supported with REB_COLLISION_DIRECT and REB_COLLISION_TREE.");
+	}
+#ifdef MPI
+	if (r->collision_continuous){
+		reb_exit("collision_continuous is not supported with MPI.");
+	}
+#endif // MPI
+	PROFILING_START(r, REB_PROFILING_CAT_COLLISION_SEARCH)
 	switch (r->collision){
 		case REB_COLLISION_NONE:
 		break;
 		case REB_COLLISION_DIRECT:
 		{
-			// Loop over ghost boxes, but only the inner most ring.
+			if (r->collision_skin>0.){
+				collisions_N = reb_collision_neighbours_search(r);
+				break;
+			}
+			// Precalculate ghost boxes, but only the inner most ring.
 			int nghostxcol = (r->nghostx>1?1:r->nghostx);
 			int nghostycol = (r->nghosty>1?1:r->nghosty);
 			int nghostzcol = (r->nghostz>1?1:r->nghostz);
+			struct reb_ghostbox gbs[27];
+			int gbs_N = 0;
 			for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
 			for (int gby=-nghostycol; gby<=nghostycol; gby++){
 			for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
-				// Loop over all particles
-				for (int i=0;i<N;i++){
-					struct reb_particle p1 = particles[i];
-					struct reb_ghostbox gborig = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
-					struct reb_ghostbox gb = gborig;
+				gbs[gbs_N++] = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			}
+			}
+			}
+			const int continuous = r->collision_continuous;
+			const double dt = r->dt_last_done;
+			reb_collision_buffers_prepare(r);
+#pragma omp parallel
+			{
+			PROFILING_START(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+			struct reb_collision_buffer* const buffer = reb_collision_buffer_get(r);
+			// The work per particle decreases with i. Small chunks balance the load.
+#pragma omp for schedule(static,16) nowait
+			for (int i=0;i<N;i++){
+				const struct reb_particle* const p1 = &(particles[i]);
+				for (int g=0;g<gbs_N;g++){
 					// Precalculate shifted position
-					gb.shiftx += p1.x;
-					gb.shifty += p1.y;
-					gb.shiftz += p1.z;
-					gb.shiftvx += p1.vx;
-					gb.shiftvy += p1.vy;
-					gb.shiftvz += p1.vz;
-					// Loop over all particles again
-					for (int j=0;j<N;j++){
-						// Do not collide particle with itself.
-						if (i==j) continue;
-						struct reb_particle p2 = particles[j];
-						double dx = gb.shiftx - p2.x;
-						double dy = gb.shifty - p2.y;
-						double dz = gb.shiftz - p2.z;
-						double sr = p1.r + p2.r;
-						double r2 = dx*dx+dy*dy+dz*dz;
-						// Check if particles are overlapping
-						if (r2>sr*sr) continue;
-						double dvx = gb.shiftvx - p2.vx;
-						double dvy = gb.shiftvy - p2.vy;
-						double dvz = gb.shiftvz - p2.vz;
-						// Check if particles are approaching each other
-						if (dvx*dx + dvy*dy + dvz*dz >0) continue;
-						// Add particles to collision array.
-						if (r->collisions_allocatedN<=collisions_N){
-							// Allocate memory if there is no space in array.
-							// Doing it in chunks of 32 to avoid having to do it too often.
-							r->collisions_allocatedN += 32;
-							r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
+					const double x  = p1->x  + gbs[g].shiftx;
+					const double y  = p1->y  + gbs[g].shifty;
+					const double z  = p1->z  + gbs[g].shiftz;
+					const double vx = p1->vx + gbs[g].shiftvx;
+					const double vy = p1->vy + gbs[g].shiftvy;
+					const double vz = p1->vz + gbs[g].shiftvz;
+					const double p1_r = p1->r;
+					// Only test pairs with i<j. The pair (j,i) is the 
+					// same as (i,j) in the opposite ghost box.
+					for (int j0=i+1;j0<N;j0+=REB_COLLISION_DIRECT_BLOCK){
+						const int j1 = (j0+REB_COLLISION_DIRECT_BLOCK<N)?j0+REB_COLLISION_DIRECT_BLOCK:N;
+						int hit[REB_COLLISION_DIRECT_BLOCK];
+						if (continuous){
+							// Spheres containing the particles during the entire timestep.
+							const double p1_s = p1_r + dt*sqrt(vx*vx+vy*vy+vz*vz);
+#pragma omp simd
+							for (int j=j0;j<j1;j++){
+								const double dx = x - particles[j].x;
+								const double dy = y - particles[j].y;
+								const double dz = z - particles[j].z;
+								const double sr = p1_s + particles[j].r + dt*sqrt(particles[j].vx*particles[j].vx + particles[j].vy*particles[j].vy + particles[j].vz*particles[j].vz);
+								hit[j-j0] = (dx*dx+dy*dy+dz*dz<=sr*sr);
+							}
+						}else{
+							// Branch free loop, can be vectorized.
+#pragma omp simd
+							for (int j=j0;j<j1;j++){
+								const double dx = x - particles[j].x;
+								const double dy = y - particles[j].y;
+								const double dz = z - particles[j].z;
+								const double dvx = vx - particles[j].vx;
+								const double dvy = vy - particles[j].vy;
+								const double dvz = vz - particles[j].vz;
+								const double sr = p1_r + particles[j].r;
+								// Overlapping and approaching each other
+								hit[j-j0] = (dx*dx+dy*dy+dz*dz<=sr*sr) & (dvx*dx+dvy*dy+dvz*dz<=0.);
+							}
+						}
+						for (int j=j0;j<j1;j++){
+							if (hit[j-j0]){
+								double time = 0.;
+								if (continuous && !reb_collision_time_of_impact(x-particles[j].x, y-particles[j].y, z-particles[j].z, vx-particles[j].vx, vy-particles[j].vy, vz-particles[j].vz, p1_r+particles[j].r, -dt, &time)) continue;
+								struct reb_collision* const c = reb_collision_buffer_add(buffer);
+								c->p1 = i;
+								c->p2 = j;
+								c->gb = gbs[g];
+								c->ri = 0;
+								c->time = time;
+							}
 						}
-						r->collisions[collisions_N].p1 = i;
-						r->collisions[collisions_N].p2 = j;
-						r->collisions[collisions_N].gb = gborig;
-						collisions_N++;
 					}
 				}
 			}
+			PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_SEARCH)
 			}
-			}
+			collisions_N = reb_collision_buffers_merge(r);
 		}
 		break;
 		case REB_COLLISION_TREE:
 		{
+			if (r->collision_skin>0.){
+				collisions_N = reb_collision_neighbours_search(r);
+				break;
+			}
 			// Update and simplify tree.
 			// Prepare particles for distribution to other nodes.
+			PROFILING_START(r, REB_PROFILING_CAT_TREE_UPDATE)
 			reb_tree_update(r);
+			PROFILING_STOP(r, REB_PROFILING_CAT_TREE_UPDATE)
 
 #ifdef MPI
 			// Distribute particles and add newly received particles to tree.
 			reb_communication_mpi_distribute_particles(r);
+#endif // MPI
+
+			// Largest particle radius in each cell, used to prune the search.
+			PROFILING_START(r, REB_PROFILING_CAT_TREE_UPDATE)
+			reb_tree_update_collision_data(r);
+			PROFILING_STOP(r, REB_PROFILING_CAT_TREE_UPDATE)
 
+#ifdef MPI
 			// Prepare essential tree (and particles close to the boundary needed for collisions) for distribution to other nodes.
 			reb_tree_prepare_essential_tree_for_collisions(r);
 
 			// Transfer essential tree and particles needed for collisions.
+			PROFILING_START(r, REB_PROFILING_CAT_COMMUNICATION)
 			reb_communication_mpi_distribute_essential_tree_for_collisions(r);
+			PROFILING_STOP(r, REB_PROFILING_CAT_COMMUNICATION)
 #endif // MPI
 
 			// Loop over ghost boxes, but only the inner most ring.
@@ -131,14 +583,20 @@ void reb_collision_search(struct reb_simulation* const r){
 			int nghostzcol = (r->nghostz>1?1:r->nghostz);
 			const struct reb_particle* const particles = r->particles;
 			const int N = r->N;
+			reb_collision_buffers_prepare(r);
 			// Loop over all particles
-#pragma omp parallel for schedule(guided)
+#pragma omp parallel
+			{
+			PROFILING_START(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+			struct reb_collision_buffer* const buffer = reb_collision_buffer_get(r);
+			// A static schedule makes the order of collisions reproducible.
+#pragma omp for schedule(static,16) nowait
 			for (int i=0;i<N;i++){
 				struct reb_particle p1 = particles[i];
 				struct reb_collision collision_nearest;
 				collision_nearest.p1 = i;
 				collision_nearest.p2 = -1;
-				double p1_r = p1.r;
+				collision_nearest.time = 0.;
 				double nearest_r2 = r->boxsize_max*r->boxsize_max/4.;
 				// Loop over ghost boxes.
 				for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
@@ -153,11 +611,16 @@ void reb_collision_search(struct reb_simulation* const r){
 					gb.shiftvx += p1.vx;
 					gb.shiftvy += p1.vy;
 					gb.shiftvz += p1.vz;
+					double p1_r = p1.r;
+					if (r->collision_continuous){
+						// Sphere containing the particle during the entire timestep.
+						p1_r += r->dt_last_done*sqrt(gb.shiftvx*gb.shiftvx + gb.shiftvy*gb.shiftvy + gb.shiftvz*gb.shiftvz);
+					}
 					// Loop over all root boxes.
 					for (int ri=0;ri<r->root_n;ri++){
 						struct reb_treecell* rootcell = r->tree_root[ri];
 						if (rootcell!=NULL){
-							reb_tree_get_nearest_neighbour_in_cell(r, &collisions_N, gb, gbunmod,ri,p1_r,&nearest_r2,&collision_nearest,rootcell);
+							reb_tree_get_nearest_neighbour_in_cell(r, buffer, gb, gbunmod,ri,p1_r,&nearest_r2,&collision_nearest,rootcell);
 						}
 					}
 				}
@@ -166,77 +629,141 @@ void reb_collision_search(struct reb_simulation* const r){
 				// Continue if no collision was found
 				if (collision_nearest.p2==-1) continue;
 			}
+			PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+			}
+			collisions_N = reb_collision_buffers_merge(r);
+		}
+		break;
+		case REB_COLLISION_GRID:
+		{
+#ifdef MPI
+			reb_exit("REB_COLLISION_GRID is not supported with MPI. Use REB_COLLISION_TREE instead.");
+#endif // MPI
+			reb_collision_grid_update(r);
+			if (r->collision_grid->max_radius<=0.) break; // Point particles never overlap.
+			// Loop over ghost boxes, but only the inner most ring.
+			int nghostxcol = (r->nghostx>1?1:r->nghostx);
+			int nghostycol = (r->nghosty>1?1:r->nghosty);
+			int nghostzcol = (r->nghostz>1?1:r->nghostz);
+			reb_collision_buffers_prepare(r);
+#pragma omp parallel
+			{
+			PROFILING_START(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+			struct reb_collision_buffer* const buffer = reb_collision_buffer_get(r);
+#pragma omp for schedule(static,16) nowait
+			for (int i=0;i<N;i++){
+				for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+				for (int gby=-nghostycol; gby<=nghostycol; gby++){
+				for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+					struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+					reb_collision_grid_search(r, buffer, i, gb);
+				}
+				}
+				}
+			}
+			PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+			}
+			collisions_N = reb_collision_buffers_merge(r);
+		}
+		break;
+		case REB_COLLISION_SWEEP:
+		case REB_COLLISION_SWEEPPHI:
+		{
+#ifdef MPI
+			reb_exit("REB_COLLISION_SWEEP and REB_COLLISION_SWEEPPHI are not supported with MPI. Use REB_COLLISION_TREE instead.");
+#endif // MPI
+			reb_collision_sweep_update(r);
+			reb_collision_buffers_prepare(r);
+#pragma omp parallel
+			{
+			PROFILING_START(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+			struct reb_collision_buffer* const buffer = reb_collision_buffer_get(r);
+#pragma omp for schedule(static,16) nowait
+			for (int p=0;p<N;p++){
+				reb_collision_sweep_search(r, buffer, p);
+			}
+			PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+			}
+			collisions_N = reb_collision_buffers_merge(r);
 		}
 		break;
 		default:
 			reb_exit("Collision routine not implemented.");
 	}
+	PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_SEARCH)
 
-	// randomize
-	for (int i=0;i<collisions_N;i++){
-		int new = rand()%collisions_N;
-		struct reb_collision c1 = r->collisions[i];
-		r->collisions[i] = r->collisions[new];
-		r->collisions[new] = c1;
-	}
-	// Loop over all collisions previously found in reb_collision_search().
-
+	PROFILING_START(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
 	int (*resolve) (struct reb_simulation* const r, struct reb_collision c) = r->collision_resolve;
 	if (resolve==NULL){
 		// Default is hard sphere
 		resolve = reb_collision_resolve_hardsphere;
 	}
+	if (r->collision_continuous){
+		reb_collision_resolve_continuous(r, collisions_N, resolve);
+		PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
+		return;
+	}
+	// Randomize the order of collisions (Fisher-Yates shuffle).
+	for (int i=collisions_N-1;i>0;i--){
+		const int new = reb_collision_random_int(r, i+1);
+		struct reb_collision c1 = r->collisions[i];
+		r->collisions[i] = r->collisions[new];
+		r->collisions[new] = c1;
+	}
+#if defined(OPENMP) && !defined(MPI)
+	if (resolve==reb_collision_resolve_hardsphere && omp_get_max_threads()>1){
+		// Hard sphere collisions never remove particles.
+		reb_collision_resolve_hardsphere_parallel(r, collisions_N);
+		PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
+		return;
+	}
+#endif // OPENMP && !MPI
+	// Particles are not removed while collisions are being resolved.
+	// Instead, they are flagged in the remap table and removed at the end.
+	// This keeps the indices in all remaining collisions valid.
+	const int N_initial = r->N;
+	int* const remap = reb_collision_remap_prepare(r);
+	int removed_N = 0;
+
+	// Loop over all collisions previously found in reb_collision_search().
 	for (int i=0;i<collisions_N;i++){
+		struct reb_collision c = r->collisions[i];
+		const int p2_is_local = reb_collision_p2_is_local(r, c);
+		// Skip collisions involving particles that have already been removed.
+		if (remap[c.p1]<0 || (p2_is_local && remap[c.p2]<0)) continue;
 
-        struct reb_collision c = r->collisions[i];
-        if (c.p1 != -1 && c.p2 != -1){
-
-            // Resolve collision
-            int outcome = resolve(r, c);
-
-            // Remove particles
-            int shift_pos = 0;
-            int keepsorted = 1;
-            if (r->tree_root){
-                keepsorted = 0;
-            }
-            if (outcome & 1){
-                // Remove p1
-                if (keepsorted==0){
-                    if (c.p2==r->N-1){
-                        shift_pos = -c.p2+c.p1;
-                    }
-                }else{
-                    if (c.p1<c.p2){
-                        shift_pos = -1;
-                    }
-                }
-                reb_remove(r,c.p1,keepsorted);
-                // Check for pair
-                for (int j=i+1;j<collisions_N;j++){
-                    struct reb_collision cp = r->collisions[j];
-                    if (cp.p1==c.p1 || cp.p2==c.p1){
-                        r->collisions[j].p1 = -1;
-                        r->collisions[j].p2 = -1;
-                        // Will be skipped.
-                    }
-                }
-            }
-            if (outcome & 2){
-                // Remove p2
-                reb_remove(r,c.p2+shift_pos,keepsorted);
-                // Check for pair
-                for (int j=i+1;j<collisions_N;j++){
-                    struct reb_collision cp = r->collisions[j];
-                    if (cp.p1==c.p2 || cp.p2==c.p2){
-                        r->collisions[j].p1 = -1;
-                        r->collisions[j].p2 = -1;
-                        // Will be skipped.
-                    }
-                }
-            }
-        }
+		// Move particles and the ghost box to the time of the collision (sweep algorithms only).
+		if (c.time!=0.){
+			c.gb.shiftx += c.time*c.gb.shiftvx;
+			c.gb.shifty += c.time*c.gb.shiftvy;
+			c.gb.shiftz += c.time*c.gb.shiftvz;
+			reb_collision_drift(r, c.p1, c.time);
+			reb_collision_drift(r, c.p2, c.time);
+		}
+
+		// Resolve collision
+		const int outcome = resolve(r, c);
+
+		// Move remaining particles back to the current time.
+		if (c.time!=0.){
+			if (!(outcome & 1)) reb_collision_drift(r, c.p1, -c.time);
+			if (!(outcome & 2)) reb_collision_drift(r, c.p2, -c.time);
+		}
+
+		// Flag particles for removal
+		if (outcome & 1){
+			remap[c.p1] = -1;
+			removed_N++;
+		}
+		if ((outcome & 2) && p2_is_local){
+			remap[c.p2] = -1;
+			removed_N++;
+		}
+	}
+	if (removed_N){
+		reb_collision_remove_flagged(r, N_initial);
 	}
+	PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
 }
 
 /**
@@ -246,6 +773,1186 @@ EXPORTIT void reb_set_collision_resolve(struct reb_simulation* r, int (*resolve)
     r->collision_resolve = resolve;
 }
 
+void reb_collision_grid_free(struct reb_simulation* const r){
+	struct reb_collision_grid* const g = r->collision_grid;
+	if (g==NULL) return;
+	free(g->cell_start);
+	free(g->particles);
+	free(g->particle_cell);
+	free(g->counts);
+	free(g);
+	r->collision_grid = NULL;
+}
+
+/**
+ * @brief Returns the cell index of a coordinate in one direction, clamped to the grid.
+ */
+static inline int reb_collision_grid_index(const struct reb_collision_grid* const g, const int d, const double x){
+	const double c = floor((x - g->min[d])/g->cellsize[d]);
+	if (c<0.) return 0;
+	if (c>=(double)g->n[d]) return g->n[d]-1;
+	return (int)c;
+}
+
+/**
+ * @brief Sorts all particles into a uniform grid.
+ * @details The grid covers the simulation box for periodic and shear periodic
+ * boundary conditions and the bounding box of all particles otherwise. The cell
+ * size is at least twice the largest particle radius, so that overlapping
+ * particles are always in the same or in neighbouring cells. The number of
+ * cells is limited to a few times the number of particles. Particles are
+ * sorted with a counting sort. Each thread counts and inserts a contiguous
+ * chunk of particles, so the result does not depend on the number of threads.
+ */
+static void reb_collision_grid_update(struct reb_simulation* const r){
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	if (r->collision_grid==NULL){
+		r->collision_grid = calloc(1,sizeof(struct reb_collision_grid));
+	}
+	struct reb_collision_grid* const g = r->collision_grid;
+
+	// Find extent of the grid and the largest radius.
+	double min[3] = {0.,0.,0.};
+	double max[3] = {0.,0.,0.};
+	double max_radius = 0.;
+	const int periodic = (r->boundary==REB_BOUNDARY_PERIODIC || r->boundary==REB_BOUNDARY_SHEAR);
+	if (periodic){
+		min[0] = -r->boxsize.x/2.; max[0] = r->boxsize.x/2.;
+		min[1] = -r->boxsize.y/2.; max[1] = r->boxsize.y/2.;
+		min[2] = -r->boxsize.z/2.; max[2] = r->boxsize.z/2.;
+#pragma omp parallel for reduction(max:max_radius)
+		for (int i=0;i<N;i++){
+			if (particles[i].r>max_radius) max_radius = particles[i].r;
+		}
+	}else if (N>0){
+		double minx = particles[0].x, miny = particles[0].y, minz = particles[0].z;
+		double maxx = minx, maxy = miny, maxz = minz;
+#pragma omp parallel for reduction(min:minx,miny,minz) reduction(max:maxx,maxy,maxz,max_radius)
+		for (int i=0;i<N;i++){
+			const struct reb_particle p = particles[i];
+			if (p.x<minx) minx = p.x;
+			if (p.y<miny) miny = p.y;
+			if (p.z<minz) minz = p.z;
+			if (p.x>maxx) maxx = p.x;
+			if (p.y>maxy) maxy = p.y;
+			if (p.z>maxz) maxz = p.z;
+			if (p.r>max_radius) max_radius = p.r;
+		}
+		min[0] = minx; max[0] = maxx;
+		min[1] = miny; max[1] = maxy;
+		min[2] = minz; max[2] = maxz;
+	}
+	g->max_radius = max_radius;
+
+	// Choose number of cells.
+	const double cellsize_min = 2.*max_radius;
+	long cells_N = 1;
+	for (int d=0;d<3;d++){
+		const double L = max[d]-min[d];
+		g->n[d] = 1;
+		if (cellsize_min>0. && L>cellsize_min){
+			const double n = floor(L/cellsize_min);
+			g->n[d] = n>(double)(N+1)?N+1:(int)n;
+		}
+		cells_N *= g->n[d];
+	}
+	const long cells_max = 4*(long)N+8;
+	while (cells_N>cells_max){
+		// Too many (mostly empty) cells. Coarsen the direction with the most cells.
+		int dmax = 0;
+		for (int d=1;d<3;d++){
+			if (g->n[d]>g->n[dmax]) dmax = d;
+		}
+		cells_N /= g->n[dmax];
+		g->n[dmax] = (g->n[dmax]+1)/2;
+		cells_N *= g->n[dmax];
+	}
+	for (int d=0;d<3;d++){
+		const double L = max[d]-min[d];
+		g->min[d] = min[d];
+		g->cellsize[d] = L>0.?L/(double)g->n[d]:1.;
+	}
+
+	// Allocate memory.
+#ifdef OPENMP
+	const int threads_max = omp_get_max_threads();
+#else // OPENMP
+	const int threads_max = 1;
+#endif // OPENMP
+	if (g->cells_allocatedN<cells_N+1){
+		g->cells_allocatedN = cells_N+1;
+		g->cell_start = realloc(g->cell_start, sizeof(int)*g->cells_allocatedN);
+	}
+	if (g->counts_allocatedN<cells_N*threads_max){
+		g->counts_allocatedN = cells_N*threads_max;
+		g->counts = realloc(g->counts, sizeof(int)*g->counts_allocatedN);
+	}
+	if (g->particles_allocatedN<N){
+		g->particles_allocatedN = N;
+		g->particles = realloc(g->particles, sizeof(int)*N);
+		g->particle_cell = realloc(g->particle_cell, sizeof(int)*N);
+	}
+
+	// Counting sort.
+	int* const counts = g->counts;
+#pragma omp parallel
+	{
+#ifdef OPENMP
+		const int thread = omp_get_thread_num();
+		const int threads_N = omp_get_num_threads();
+#else // OPENMP
+		const int thread = 0;
+		const int threads_N = 1;
+#endif // OPENMP
+		const int start = (int)((long)N*thread/threads_N);
+		const int end = (int)((long)N*(thread+1)/threads_N);
+		int* const mycounts = &counts[cells_N*thread];
+		memset(mycounts, 0, sizeof(int)*cells_N);
+		for (int i=start;i<end;i++){
+			const struct reb_particle p = particles[i];
+			const int ix = reb_collision_grid_index(g, 0, p.x);
+			const int iy = reb_collision_grid_index(g, 1, p.y);
+			const int iz = reb_collision_grid_index(g, 2, p.z);
+			const int c = (iz*g->n[1] + iy)*g->n[0] + ix;
+			g->particle_cell[i] = c;
+			mycounts[c]++;
+		}
+#pragma omp barrier
+#pragma omp single
+		{
+			// Prefix sum. Within a cell, particles are ordered by thread.
+			int offset = 0;
+			for (long c=0;c<cells_N;c++){
+				g->cell_start[c] = offset;
+				for (int t=0;t<threads_N;t++){
+					const int count = counts[cells_N*t+c];
+					counts[cells_N*t+c] = offset;
+					offset += count;
+				}
+			}
+			g->cell_start[cells_N] = offset;
+		}
+		for (int i=start;i<end;i++){
+			g->particles[mycounts[g->particle_cell[i]]++] = i;
+		}
+	}
+}
+
+/**
+ * @brief Searches the grid for particles overlapping with particle i in ghost box gbunmod.
+ * @param r REBOUND simulation to work on.
+ * @param buffer Collision buffer of the calling thread.
+ * @param i Index of the particle.
+ * @param gbunmod Ghostbox (unmodified) of particle i.
+ */
+static void reb_collision_grid_search(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, int i, struct reb_ghostbox gbunmod){
+	const struct reb_particle* const particles = r->particles;
+	const struct reb_collision_grid* const g = r->collision_grid;
+	const struct reb_particle p1 = particles[i];
+	struct reb_ghostbox gb = gbunmod;
+	gb.shiftx += p1.x;
+	gb.shifty += p1.y;
+	gb.shiftz += p1.z;
+	gb.shiftvx += p1.vx;
+	gb.shiftvy += p1.vy;
+	gb.shiftvz += p1.vz;
+	// Range of cells that can contain overlapping particles.
+	const double s = p1.r + g->max_radius;
+	const double pos[3] = {gb.shiftx, gb.shifty, gb.shiftz};
+	int lo[3], hi[3];
+	for (int d=0;d<3;d++){
+		const double top = g->min[d] + g->cellsize[d]*(double)g->n[d];
+		if (pos[d]+s<g->min[d] || pos[d]-s>top) return; // Outside of grid.
+		lo[d] = reb_collision_grid_index(g, d, pos[d]-s);
+		hi[d] = reb_collision_grid_index(g, d, pos[d]+s);
+	}
+	for (int iz=lo[2];iz<=hi[2];iz++){
+	for (int iy=lo[1];iy<=hi[1];iy++){
+	for (int ix=lo[0];ix<=hi[0];ix++){
+		const int c = (iz*g->n[1] + iy)*g->n[0] + ix;
+		for (int k=g->cell_start[c];k<g->cell_start[c+1];k++){
+			const int j = g->particles[k];
+			// Do not collide particle with itself.
+			if (i==j) continue;
+			const struct reb_particle p2 = particles[j];
+			const double dx = gb.shiftx - p2.x;
+			const double dy = gb.shifty - p2.y;
+			const double dz = gb.shiftz - p2.z;
+			const double sr = p1.r + p2.r;
+			const double r2 = dx*dx+dy*dy+dz*dz;
+			// Check if particles are overlapping
+			if (r2>sr*sr) continue;
+			const double dvx = gb.shiftvx - p2.vx;
+			const double dvy = gb.shiftvy - p2.vy;
+			const double dvz = gb.shiftvz - p2.vz;
+			// Check if particles are approaching each other
+			if (dvx*dx + dvy*dy + dvz*dz >0) continue;
+			struct reb_collision* const collision = reb_collision_buffer_add(buffer);
+			collision->p1 = i;
+			collision->p2 = j;
+			collision->gb = gbunmod;
+			collision->ri = 0;
+			collision->time = 0.;
+		}
+	}
+	}
+	}
+}
+
+void reb_collision_sweep_free(struct reb_simulation* const r){
+	struct reb_collision_sweep* const s = r->collision_sweep;
+	if (s==NULL) return;
+	free(s->order);
+	free(s->key);
+	free(s->width);
+	free(s);
+	r->collision_sweep = NULL;
+}
+
+/**
+ * @brief Particle index and key, used for sorting the sweep list from scratch.
+ */
+struct reb_collision_sweep_value {
+	double key;
+	int i;
+};
+
+static int reb_collision_sweep_compare(const void* a, const void* b){
+	const double diff = ((const struct reb_collision_sweep_value*)a)->key - ((const struct reb_collision_sweep_value*)b)->key;
+	if (diff > 0) return 1;
+	if (diff < 0) return -1;
+	return 0;
+}
+
+/**
+ * @brief Calculates the sweep intervals of all particles and sorts them.
+ * @details Each particle covers an interval of half width width[i] around key[i] 
+ * during the timestep [-dt/2, dt/2]. For REB_COLLISION_SWEEP the key is the x
+ * coordinate. For REB_COLLISION_SWEEPPHI the key is the azimuthal angle and the
+ * width is a conservative estimate of the angle within which any collision 
+ * partner can be found. This is only efficient if particles are far from the 
+ * z axis, e.g. in a narrow ring.
+ *
+ * The order from the previous timestep is reused and updated with an insertion 
+ * sort. If the number of particles has changed, the list is sorted from scratch.
+ */
+static void reb_collision_sweep_update(struct reb_simulation* const r){
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const double dt = r->dt_last_done;
+	if (r->collision_sweep==NULL){
+		r->collision_sweep = calloc(1,sizeof(struct reb_collision_sweep));
+	}
+	struct reb_collision_sweep* const s = r->collision_sweep;
+	if (s->allocatedN<N){
+		s->allocatedN = N;
+		s->order = realloc(s->order, sizeof(int)*N);
+		s->key = realloc(s->key, sizeof(double)*N);
+		s->width = realloc(s->width, sizeof(double)*N);
+	}
+	double* const key = s->key;
+	double* const width = s->width;
+	double width_max = 0.;
+	if (r->collision==REB_COLLISION_SWEEP){
+#pragma omp parallel for reduction(max:width_max)
+		for (int i=0;i<N;i++){
+			const struct reb_particle p = particles[i];
+			key[i] = p.x;
+			width[i] = p.r*1.0001 + 0.5*dt*fabs(p.vx); // Safety factor to avoid floating point issues.
+			if (width[i]>width_max) width_max = width[i];
+		}
+	}else{
+		// Largest distance a particle can have from the centre of its trajectory and still collide.
+		double R_max = 0.;
+#pragma omp parallel for reduction(max:R_max)
+		for (int i=0;i<N;i++){
+			const struct reb_particle p = particles[i];
+			const double R = p.r*1.0001 + 0.5*dt*sqrt(p.vx*p.vx + p.vy*p.vy + p.vz*p.vz);
+			if (R>R_max) R_max = R;
+		}
+#pragma omp parallel for reduction(max:width_max)
+		for (int i=0;i<N;i++){
+			const struct reb_particle p = particles[i];
+			const double R = p.r*1.0001 + 0.5*dt*sqrt(p.vx*p.vx + p.vy*p.vy + p.vz*p.vz);
+			key[i] = atan2(p.y,p.x);
+			// Collision partners are closer to the axis than rho_min. The chord
+			// between them is at least rho_min*2/pi*dphi if dphi<pi/2.
+			const double rho_min = sqrt(p.x*p.x + p.y*p.y) - R - R_max;
+			if (rho_min>R+R_max){
+				width[i] = M_PI/2.*(R+R_max)/rho_min;
+			}else{
+				width[i] = M_PI;
+			}
+			if (width[i]>width_max) width_max = width[i];
+		}
+	}
+	s->width_max = width_max;
+
+	int* const order = s->order;
+	if (s->order_N!=N){
+		// Particles have been added or removed. Sort from scratch.
+		struct reb_collision_sweep_value* values = malloc(sizeof(struct reb_collision_sweep_value)*N);
+		for (int i=0;i<N;i++){
+			values[i].key = key[i];
+			values[i].i = i;
+		}
+		qsort(values, N, sizeof(struct reb_collision_sweep_value), reb_collision_sweep_compare);
+		for (int i=0;i<N;i++){
+			order[i] = values[i].i;
+		}
+		free(values);
+		s->order_N = N;
+	}else{
+		// Nearly sorted from the last timestep.
+		for (int j=1;j<N;j++){
+			const int o = order[j];
+			const double k = key[o];
+			int i = j - 1;
+			while(i >= 0 && key[order[i]] > k){
+				order[i+1] = order[i];
+				i--;
+			}
+			order[i+1] = o;
+		}
+	}
+}
+
+/**
+ * @brief Checks if two particles collide during the timestep [-dt/2, dt/2], assuming they move on straight lines.
+ * @param r REBOUND simulation to work on.
+ * @param buffer Collision buffer of the calling thread.
+ * @param i Index of the first particle.
+ * @param j Index of the second particle.
+ * @param gb Ghostbox of particle i.
+ */
+static void reb_collision_sweep_detect_pair(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, const int i, const int j, struct reb_ghostbox gb){
+	const struct reb_particle* const particles = r->particles;
+	const struct reb_particle p1 = particles[i];
+	const struct reb_particle p2 = particles[j];
+	const double dt = r->dt_last_done;
+	const double x  = p1.x  + gb.shiftx  - p2.x;
+	const double y  = p1.y  + gb.shifty  - p2.y;
+	const double z  = p1.z  + gb.shiftz  - p2.z;
+	const double vx = p1.vx + gb.shiftvx - p2.vx;
+	const double vy = p1.vy + gb.shiftvy - p2.vy;
+	const double vz = p1.vz + gb.shiftvz - p2.vz;
+
+	const double a = vx*vx + vy*vy + vz*vz;
+	if (a==0.) return; // No relative motion.
+	const double b = 2.*(vx*x + vy*y + vz*z);
+	const double rr = p1.r + p2.r;
+	const double c = -rr*rr + x*x + y*y + z*z;
+
+	const double root = b*b-4.*a*c;
+	if (root<0.) return;
+	// Floating point optimized solution of a quadratic equation. Avoids cancelations.
+	const double q = -0.5*(b+(b>=0.?1.:-1.)*sqrt(root));
+	double time1 = c/q;
+	double time2 = q/a;
+	if (q==0.){
+		time1 = 0.;
+		time2 = 0.;
+	}
+	if (time1>time2){
+		const double tmp = time2;
+		time2 = time1;
+		time1 = tmp;
+	}
+	double time;
+	if (time1>-dt/2. && time1<dt/2.){
+		// Particles touch during this timestep. Resolve the collision 
+		// slightly after first contact so that they overlap.
+		time = time1 + 1e-6*(time2-time1);
+	}else if (time1<-dt/2. && time2>dt/2.){
+		// Particles overlap during the entire timestep.
+		time = 0.;
+	}else{
+		return;
+	}
+	struct reb_collision* const collision = reb_collision_buffer_add(buffer);
+	collision->p1 = i;
+	collision->p2 = j;
+	collision->gb = gb;
+	collision->ri = 0;
+	collision->time = time;
+}
+
+/**
+ * @brief Checks particle order[p] against all following particles in the sorted list whose intervals overlap.
+ * @details For REB_COLLISION_SWEEP with periodic or shear periodic boundaries, the
+ * search wraps around to the beginning of the list, using the ghost box on the 
+ * left. The azimuthal sweep always wraps around at phi=pi.
+ * @param r REBOUND simulation to work on.
+ * @param buffer Collision buffer of the calling thread.
+ * @param p Position in the sorted list.
+ */
+static void reb_collision_sweep_search(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, int p){
+	const struct reb_collision_sweep* const s = r->collision_sweep;
+	const int N = r->N;
+	const int sweepphi = (r->collision==REB_COLLISION_SWEEPPHI);
+	int wrap = sweepphi;
+	double period = 2.*M_PI;
+	if (!sweepphi && r->nghostx>0 && (r->boundary==REB_BOUNDARY_PERIODIC || r->boundary==REB_BOUNDARY_SHEAR)){
+		wrap = 1;
+		period = r->boxsize.x;
+	}
+	// Ghost boxes perpendicular to the sweep direction, but only the inner most ring.
+	int nghostycol = sweepphi?0:(r->nghosty>1?1:r->nghosty);
+	int nghostzcol = sweepphi?0:(r->nghostz>1?1:r->nghostz);
+	const int i = s->order[p];
+	const double key_i = s->key[i];
+	const double width_i = s->width[i];
+	const int kmax = wrap?p+N:N;
+	for (int k=p+1;k<kmax;k++){
+		const int wrapped = (k>=N);
+		const int j = s->order[wrapped?k-N:k];
+		const double dkey = s->key[j] + (wrapped?period:0.) - key_i;
+		if (dkey>width_i+s->width_max) break;	// No more overlapping intervals.
+		if (dkey>width_i+s->width[j]) continue;
+		if (sweepphi && (wrapped?dkey>=M_PI:dkey>M_PI)) continue; // Pair is found in the other direction.
+		const int gbx = wrapped&&!sweepphi?-1:0;
+		for (int gby=-nghostycol; gby<=nghostycol; gby++){
+		for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+			struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			reb_collision_sweep_detect_pair(r, buffer, i, j, gb);
+		}
+		}
+	}
+}
+
+void reb_collision_neighbours_free(struct reb_simulation* const r){
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	if (n==NULL) return;
+	for (int t=0;t<n->buffers_N;t++){
+		free(n->buffers[t].pairs);
+	}
+	free(n->buffers);
+	free(n->pairs);
+	free(n->x0);
+	free(n->wrap);
+	free(n->index);
+	free(n->index0);
+	free(n->xi);
+	free(n->force);
+	free(n->adj_start);
+	free(n->adj);
+	free(n);
+	r->collision_neighbours = NULL;
+}
+
+void reb_collision_neighbours_swap(struct reb_simulation* const r, const int i, const int j){
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	if (n==NULL || i==j || i>=n->N || j>=n->N) return;
+	const int i0 = n->index0[i];
+	const int j0 = n->index0[j];
+	n->index0[i] = j0;
+	n->index0[j] = i0;
+	n->index[i0] = j;
+	n->index[j0] = i;
+}
+
+/**
+ * @brief Appends a pair to a pair buffer.
+ */
+static inline void reb_collision_pair_buffer_add(struct reb_collision_pair_buffer* const buffer, const int p1, const int p2, const int g){
+	if (buffer->allocatedN<=buffer->N){
+		buffer->allocatedN = buffer->allocatedN?buffer->allocatedN*2:128;
+		buffer->pairs = realloc(buffer->pairs,sizeof(struct reb_collision_pair)*buffer->allocatedN);
+	}
+	struct reb_collision_pair* const pair = &(buffer->pairs[buffer->N++]);
+	pair->p1 = p1;
+	pair->p2 = p2;
+	pair->g = g;
+}
+
+/**
+ * @brief Returns the largest distance two particles can travel relative to each other during one timestep.
+ * @details Includes the relative velocity of the shear periodic ghost boxes.
+ * @param r REBOUND simulation to operate on
+ * @param max_speed Largest speed of all particles.
+ */
+static double reb_collision_neighbours_sweep(struct reb_simulation* const r, const double max_speed){
+	double shiftv = 0.;
+	if (r->boundary==REB_BOUNDARY_SHEAR && r->nghostx>0){
+		shiftv = fabs(reb_boundary_get_ghostbox(r,1,0,0).shiftvy);
+	}
+	return r->dt_last_done*(2.*max_speed+shiftv);
+}
+
+/**
+ * @brief Checks if the neighbour list can still be used.
+ * @details Two particles can have approached each other by at most the sum of 
+ * their displacements, the growth of their radii and the change of the ghost box
+ * shift since the list was built. The list is valid as long as this is less
+ * than the skin. Displacements across periodic boundaries are saved in the
+ * wrap array and not counted. Particles crossing a shear periodic boundary in
+ * the x direction and wrapping shear offsets invalidate the list.
+ * If collision_continuous is set, particles can also have touched at any
+ * time during the last timestep. The distance they can have travelled 
+ * relative to each other is counted as well, and compared to the distance
+ * that was added to the skin when the list was built.
+ * @param r REBOUND simulation to operate on
+ * @param nghostxcol Number of ghost boxes searched in the x direction.
+ * @param nghostycol Number of ghost boxes searched in the y direction.
+ * @param nghostzcol Number of ghost boxes searched in the z direction.
+ * @param lookahead If positive, the list also has to remain valid if all particles move with the largest speed for this time.
+ * @return 1 if the list is valid, 0 otherwise.
+ */
+static int reb_collision_neighbours_valid(struct reb_simulation* const r, const int nghostxcol, const int nghostycol, const int nghostzcol, const double lookahead){
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	if (n==NULL || n->N!=r->N || n->skin!=r->collision_skin) return 0;
+	if (n->nghostcol[0]!=nghostxcol || n->nghostcol[1]!=nghostycol || n->nghostcol[2]!=nghostzcol) return 0;
+	double shift = 0.;
+	double shiftv = 0.;
+	if (r->boundary==REB_BOUNDARY_SHEAR && r->nghostx>0){
+		const struct reb_ghostbox gb = reb_boundary_get_ghostbox(r,1,0,0);
+		shift = fabs(gb.shifty - n->shift0);
+		shiftv = fabs(gb.shiftvy);
+	}
+	const int periodicx = (r->boundary==REB_BOUNDARY_PERIODIC);
+	const int periodicyz = (r->boundary==REB_BOUNDARY_PERIODIC || r->boundary==REB_BOUNDARY_SHEAR);
+	const struct reb_vec3d boxsize = r->boxsize;
+	const struct reb_particle* const particles = r->particles;
+	const double* const x0 = n->x0;
+	const int* const index0 = n->index0;
+	double* const wrap = n->wrap;
+	const int N = r->N;
+	double max_displacement = 0.;
+	double max_speed = 0.;
+#pragma omp parallel for reduction(max:max_displacement,max_speed)
+	for (int i=0;i<N;i++){
+		const int i0 = index0[i];
+		double dx = particles[i].x - x0[4*i0+0];
+		double dy = particles[i].y - x0[4*i0+1];
+		double dz = particles[i].z - x0[4*i0+2];
+		// Remove shifts by multiples of the box size.
+		const double wx = periodicx?boxsize.x*round(dx/boxsize.x):0.;
+		const double wy = periodicyz?boxsize.y*round(dy/boxsize.y):0.;
+		const double wz = periodicyz?boxsize.z*round(dz/boxsize.z):0.;
+		dx -= wx;
+		dy -= wy;
+		dz -= wz;
+		wrap[3*i0+0] = wx;
+		wrap[3*i0+1] = wy;
+		wrap[3*i0+2] = wz;
+		const double dr = particles[i].r - x0[4*i0+3];
+		double d = sqrt(dx*dx+dy*dy+dz*dz);
+		if (dr>0.){
+			d += dr;
+		}
+		if (!(d<=max_displacement)){
+			max_displacement = d; // Also catches NaNs.
+		}
+		const double v2 = particles[i].vx*particles[i].vx + particles[i].vy*particles[i].vy + particles[i].vz*particles[i].vz;
+		if (v2>max_speed){
+			max_speed = v2;
+		}
+	}
+	double sweep = 0.;
+	if (r->collision_continuous){
+		sweep = reb_collision_neighbours_sweep(r, sqrt(max_speed));
+	}
+	if (lookahead>0.){
+		max_displacement += lookahead*sqrt(max_speed);
+		shift += lookahead*shiftv;
+	}
+	return (2.*max_displacement+shift+sweep<=r->collision_skin+n->sweep);
+}
+
+void reb_collision_neighbours_tree_walk(struct reb_simulation* const r, struct reb_collision_pair_buffer* const buffer, const int i, const int g, const double x, const double y, const double z, const double rr, const struct reb_treecell* const c){
+	if (c->pt>=0){
+		// c is a leaf node
+		const int j = c->pt;
+		if (j<=i) return; // Pair is found from the other particle.
+		const struct reb_particle* const p2 = &(r->particles[j]);
+		const double dx = x - p2->x;
+		const double dy = y - p2->y;
+		const double dz = z - p2->z;
+		const double sr = rr + p2->r;
+		if (dx*dx+dy*dy+dz*dz>sr*sr) return;
+		reb_collision_pair_buffer_add(buffer, i, j, g);
+	}else{
+		// c is not a leaf node
+		const double dx = x - c->x;
+		const double dy = y - c->y;
+		const double dz = z - c->z;
+		const double rp = rr + c->rmax + 0.86602540378443*c->w;
+		if (dx*dx+dy*dy+dz*dz<rp*rp){
+			for (int o=0;o<8;o++){
+				const struct reb_treecell* const d = c->oct[o];
+				if (d!=NULL){
+					reb_collision_neighbours_tree_walk(r, buffer, i, g, x, y, z, rr, d);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief Tangential spring of a contact, saved while the neighbour list is rebuilt.
+ */
+struct reb_collision_contact_history {
+	long long key;	///< i*N+j, where i<j are the current indices of the two particles.
+	double xi[3];	///< Tangential spring, seen from particle i.
+};
+
+static int reb_collision_contact_history_compare(const void* a, const void* b){
+	const long long ka = ((const struct reb_collision_contact_history*)a)->key;
+	const long long kb = ((const struct reb_collision_contact_history*)b)->key;
+	return (ka>kb) - (ka<kb);
+}
+
+/**
+ * @brief Saves the tangential springs of all pairs in contact, sorted by the current indices of the particles.
+ * @param r REBOUND simulation to operate on
+ * @param history_N Number of saved contacts (output).
+ * @return Saved contacts, or NULL if there are none. Must be freed by the caller.
+ */
+static struct reb_collision_contact_history* reb_collision_contacts_save(struct reb_simulation* const r, int* const history_N){
+	const struct reb_collision_neighbours* const n = r->collision_neighbours;
+	*history_N = 0;
+	if (n==NULL || n->contacts_builds_N!=n->builds_N || n->N!=r->N) return NULL;
+	const long long N = n->N;
+	struct reb_collision_contact_history* history = NULL;
+	int allocatedN = 0;
+	for (int k=0;k<n->pairs_N;k++){
+		const double* const xi = &(n->xi[3*k]);
+		if (xi[0]==0. && xi[1]==0. && xi[2]==0.) continue;
+		if (allocatedN<=*history_N){
+			allocatedN = allocatedN?allocatedN*2:128;
+			history = realloc(history,sizeof(struct reb_collision_contact_history)*allocatedN);
+		}
+		struct reb_collision_contact_history* const h = &(history[(*history_N)++]);
+		const int i = n->index[n->pairs[k].p1];
+		const int j = n->index[n->pairs[k].p2];
+		const double sign = i<j?1.:-1.;
+		h->key = i<j?i*N+j:j*N+i;
+		h->xi[0] = sign*xi[0];
+		h->xi[1] = sign*xi[1];
+		h->xi[2] = sign*xi[2];
+	}
+	if (*history_N){
+		qsort(history, *history_N, sizeof(struct reb_collision_contact_history), reb_collision_contact_history_compare);
+	}
+	return history;
+}
+
+/**
+ * @brief Allocates the contact data of the neighbour list and builds the list of pairs of each particle.
+ * @details Tangential springs are restored from the saved contacts, all other springs are set to zero.
+ * @param r REBOUND simulation to operate on
+ * @param history Saved contacts, sorted by key (can be NULL).
+ * @param history_N Number of saved contacts.
+ */
+static void reb_collision_contacts_setup(struct reb_simulation* const r, const struct reb_collision_contact_history* const history, const int history_N){
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	const int pairs_N = n->pairs_N;
+	const int N = n->N;
+	if (n->xi_allocatedN<pairs_N){
+		n->xi_allocatedN = pairs_N;
+		n->xi = realloc(n->xi,sizeof(double)*3*pairs_N);
+		n->force = realloc(n->force,sizeof(double)*3*pairs_N);
+	}
+	for (int k=0;k<pairs_N;k++){
+		double* const xi = &(n->xi[3*k]);
+		xi[0] = 0.;
+		xi[1] = 0.;
+		xi[2] = 0.;
+		if (history_N){
+			// Particle indices have not changed since the history was saved.
+			struct reb_collision_contact_history key;
+			key.key = (long long)n->index[n->pairs[k].p1]*N + n->index[n->pairs[k].p2];
+			const struct reb_collision_contact_history* const h = bsearch(&key, history, history_N, sizeof(struct reb_collision_contact_history), reb_collision_contact_history_compare);
+			if (h){
+				xi[0] = h->xi[0];
+				xi[1] = h->xi[1];
+				xi[2] = h->xi[2];
+			}
+		}
+	}
+	// Pairs of each particle (counting sort).
+	if (n->adj_start_allocatedN<N+1){
+		n->adj_start_allocatedN = N+1;
+		n->adj_start = realloc(n->adj_start,sizeof(int)*(N+1));
+	}
+	if (n->adj_allocatedN<pairs_N){
+		n->adj_allocatedN = pairs_N;
+		n->adj = realloc(n->adj,sizeof(int)*2*pairs_N);
+	}
+	int* const adj_start = n->adj_start;
+	for (int i=0;i<=N;i++){
+		adj_start[i] = 0;
+	}
+	for (int k=0;k<pairs_N;k++){
+		adj_start[n->pairs[k].p1+1]++;
+		adj_start[n->pairs[k].p2+1]++;
+	}
+	for (int i=0;i<N;i++){
+		adj_start[i+1] += adj_start[i];
+	}
+	for (int k=0;k<pairs_N;k++){
+		n->adj[adj_start[n->pairs[k].p1]++] = 2*k;
+		n->adj[adj_start[n->pairs[k].p2]++] = 2*k+1;
+	}
+	// adj_start has been shifted by one particle while sorting.
+	for (int i=N;i>0;i--){
+		adj_start[i] = adj_start[i-1];
+	}
+	adj_start[0] = 0;
+	n->contacts_builds_N = n->builds_N;
+}
+
+/**
+ * @brief Returns the largest speed of all particles.
+ */
+static double reb_collision_max_speed(const struct reb_simulation* const r){
+	const struct reb_particle* const particles = r->particles;
+	double max_speed = 0.;
+	for (int i=0;i<r->N;i++){
+		const double v2 = particles[i].vx*particles[i].vx + particles[i].vy*particles[i].vy + particles[i].vz*particles[i].vz;
+		if (v2>max_speed){
+			max_speed = v2;
+		}
+	}
+	return sqrt(max_speed);
+}
+
+/**
+ * @brief Prepares the neighbour list and the per-thread pair buffers for a rebuild.
+ * @param r REBOUND simulation to operate on
+ * @return Distance added to the particle radii when searching for pairs.
+ */
+static double reb_collision_neighbours_build_prepare(struct reb_simulation* const r){
+	if (r->collision_neighbours==NULL){
+		r->collision_neighbours = calloc(1,sizeof(struct reb_collision_neighbours));
+		r->collision_neighbours->contacts_builds_N = -1;
+	}
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	double sweep = 0.;
+	if (r->collision_continuous){
+		sweep = reb_collision_neighbours_sweep(r, reb_collision_max_speed(r));
+	}
+	n->sweep = sweep;
+#ifdef OPENMP
+	const int threads_N = omp_get_max_threads();
+#else // OPENMP
+	const int threads_N = 1;
+#endif // OPENMP
+	if (n->buffers_N<threads_N){
+		n->buffers = realloc(n->buffers,sizeof(struct reb_collision_pair_buffer)*threads_N);
+		for (int t=n->buffers_N;t<threads_N;t++){
+			n->buffers[t].pairs = NULL;
+			n->buffers[t].allocatedN = 0;
+		}
+		n->buffers_N = threads_N;
+	}
+	for (int t=0;t<n->buffers_N;t++){
+		n->buffers[t].N = 0;
+	}
+	return r->collision_skin + sweep;
+}
+
+/**
+ * @brief Replaces the neighbour list with the pairs found by all threads and saves the current positions and radii.
+ * @details The buffers are merged in the order of the thread number. The tangential springs
+ * of the current contacts are carried over.
+ * @param r REBOUND simulation to operate on
+ */
+static void reb_collision_neighbours_build_finish(struct reb_simulation* const r){
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	// Tangential springs of the current contacts, carried over to the new list.
+	int history_N = 0;
+	struct reb_collision_contact_history* const history = reb_collision_contacts_save(r, &history_N);
+	int pairs_N = 0;
+	for (int t=0;t<n->buffers_N;t++){
+		pairs_N += n->buffers[t].N;
+	}
+	if (n->pairs_allocatedN<pairs_N){
+		n->pairs_allocatedN = pairs_N;
+		n->pairs = realloc(n->pairs,sizeof(struct reb_collision_pair)*n->pairs_allocatedN);
+	}
+	n->pairs_N = 0;
+	for (int t=0;t<n->buffers_N;t++){
+		if (n->buffers[t].N){
+			memcpy(&(n->pairs[n->pairs_N]), n->buffers[t].pairs, sizeof(struct reb_collision_pair)*n->buffers[t].N);
+			n->pairs_N += n->buffers[t].N;
+		}
+	}
+	// Save positions and radii
+	if (n->allocatedN<N){
+		n->allocatedN = N;
+		n->x0 = realloc(n->x0,sizeof(double)*4*N);
+		n->wrap = realloc(n->wrap,sizeof(double)*3*N);
+		n->index = realloc(n->index,sizeof(int)*N);
+		n->index0 = realloc(n->index0,sizeof(int)*N);
+	}
+	for (int i=0;i<N;i++){
+		n->x0[4*i+0] = particles[i].x;
+		n->x0[4*i+1] = particles[i].y;
+		n->x0[4*i+2] = particles[i].z;
+		n->x0[4*i+3] = particles[i].r;
+		n->wrap[3*i+0] = 0.;
+		n->wrap[3*i+1] = 0.;
+		n->wrap[3*i+2] = 0.;
+		n->index[i] = i;
+		n->index0[i] = i;
+	}
+	n->N = N;
+	n->skin = r->collision_skin;
+	n->nghostcol[0] = (r->nghostx>1?1:r->nghostx);
+	n->nghostcol[1] = (r->nghosty>1?1:r->nghosty);
+	n->nghostcol[2] = (r->nghostz>1?1:r->nghostz);
+	n->shift0 = 0.;
+	if (r->boundary==REB_BOUNDARY_SHEAR && r->nghostx>0){
+		n->shift0 = reb_boundary_get_ghostbox(r,1,0,0).shifty;
+	}
+	n->builds_N++;
+	if (r->contact==REB_CONTACT_SOFTSPHERE){
+		reb_collision_contacts_setup(r, history, history_N);
+	}
+	free(history);
+}
+
+/**
+ * @brief Builds the neighbour list with the direct or the tree search.
+ * @param r REBOUND simulation to operate on
+ * @param gbs Ghost boxes, indexed with reb_collision_neighbours_ghostbox_index().
+ * @param gbs_index Indices of the ghost boxes to search.
+ * @param gbs_N Number of ghost boxes to search.
+ */
+static void reb_collision_neighbours_build(struct reb_simulation* const r, const struct reb_ghostbox* const gbs, const int* const gbs_index, const int gbs_N){
+	const double skin = reb_collision_neighbours_build_prepare(r);
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	const struct reb_particle* const particles = r->particles;
+	if (r->collision==REB_COLLISION_TREE){
+		PROFILING_START(r, REB_PROFILING_CAT_TREE_UPDATE)
+		reb_tree_update(r);
+		reb_tree_update_collision_data(r);
+		PROFILING_STOP(r, REB_PROFILING_CAT_TREE_UPDATE)
+	}
+	const int N = r->N;
+#pragma omp parallel
+	{
+#ifdef OPENMP
+	struct reb_collision_pair_buffer* const buffer = &(n->buffers[omp_get_thread_num()]);
+#else // OPENMP
+	struct reb_collision_pair_buffer* const buffer = &(n->buffers[0]);
+#endif // OPENMP
+#pragma omp for schedule(static,16) nowait
+	for (int i=0;i<N;i++){
+		const struct reb_particle* const p1 = &(particles[i]);
+		const double rr = p1->r + skin;
+		for (int k=0;k<gbs_N;k++){
+			const int g = gbs_index[k];
+			const double x = p1->x + gbs[g].shiftx;
+			const double y = p1->y + gbs[g].shifty;
+			const double z = p1->z + gbs[g].shiftz;
+			if (r->collision==REB_COLLISION_TREE){
+				for (int ri=0;ri<r->root_n;ri++){
+					const struct reb_treecell* const rootcell = r->tree_root[ri];
+					if (rootcell!=NULL){
+						reb_collision_neighbours_tree_walk(r, buffer, i, g, x, y, z, rr, rootcell);
+					}
+				}
+			}else{
+				for (int j=i+1;j<N;j++){
+					const double dx = x - particles[j].x;
+					const double dy = y - particles[j].y;
+					const double dz = z - particles[j].z;
+					const double sr = rr + particles[j].r;
+					if (dx*dx+dy*dy+dz*dz<=sr*sr){
+						reb_collision_pair_buffer_add(buffer, i, j, g);
+					}
+				}
+			}
+		}
+	}
+	}
+	reb_collision_neighbours_build_finish(r);
+}
+
+double reb_collision_neighbours_gravity_walk_begin(struct reb_simulation* const r){
+	int nghostxcol = (r->nghostx>1?1:r->nghostx);
+	int nghostycol = (r->nghosty>1?1:r->nghosty);
+	int nghostzcol = (r->nghostz>1?1:r->nghostz);
+	// Rebuild early enough for the list to remain valid until the collision search.
+	// Drift-kick-drift integrators calculate forces in the middle of the timestep.
+	const double lookahead = 0.5*fabs(r->dt);
+	if (reb_collision_neighbours_valid(r, nghostxcol, nghostycol, nghostzcol, lookahead)){
+		return -1.;
+	}
+	// If a new list would not remain valid either, it is rebuilt in the collision search.
+	double shiftv = 0.;
+	if (r->boundary==REB_BOUNDARY_SHEAR && r->nghostx>0){
+		shiftv = fabs(reb_boundary_get_ghostbox(r,1,0,0).shiftvy);
+	}
+	if (lookahead*(2.*reb_collision_max_speed(r)+shiftv)>r->collision_skin){
+		return -1.;
+	}
+	const double skin = reb_collision_neighbours_build_prepare(r);
+	PROFILING_START(r, REB_PROFILING_CAT_TREE_UPDATE)
+	reb_tree_update_collision_data(r);
+	PROFILING_STOP(r, REB_PROFILING_CAT_TREE_UPDATE)
+	return skin;
+}
+
+void reb_collision_neighbours_gravity_walk_finish(struct reb_simulation* const r){
+	reb_collision_neighbours_build_finish(r);
+}
+
+/**
+ * @brief Rebuilds the neighbour list if it is no longer valid.
+ * @param r REBOUND simulation to operate on
+ * @param gbs Current ghost boxes (output), indexed with reb_collision_neighbours_ghostbox_index().
+ */
+static void reb_collision_neighbours_update(struct reb_simulation* const r, struct reb_ghostbox* const gbs){
+	// Current ghost boxes, but only the inner most ring.
+	int nghostxcol = (r->nghostx>1?1:r->nghostx);
+	int nghostycol = (r->nghosty>1?1:r->nghosty);
+	int nghostzcol = (r->nghostz>1?1:r->nghostz);
+	int gbs_index[27];
+	int gbs_N = 0;
+	for (int gbx=-nghostxcol; gbx<=nghostxcol; gbx++){
+	for (int gby=-nghostycol; gby<=nghostycol; gby++){
+	for (int gbz=-nghostzcol; gbz<=nghostzcol; gbz++){
+		const int g = reb_collision_neighbours_ghostbox_index(gbx,gby,gbz);
+		gbs[g] = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+		gbs_index[gbs_N++] = g;
+	}
+	}
+	}
+	if (!reb_collision_neighbours_valid(r, nghostxcol, nghostycol, nghostzcol, 0.)){
+		reb_collision_neighbours_build(r, gbs, gbs_index, gbs_N);
+	}
+}
+
+/**
+ * @brief Returns the ghost box of a pair in the neighbour list, corrected for particles moved across periodic boundaries.
+ */
+static inline struct reb_ghostbox reb_collision_neighbours_pair_ghostbox(const struct reb_collision_neighbours* const n, const struct reb_ghostbox* const gbs, const struct reb_collision_pair pair){
+	const double* const wrap = n->wrap;
+	struct reb_ghostbox gb = gbs[pair.g];
+	gb.shiftx += wrap[3*pair.p2+0] - wrap[3*pair.p1+0];
+	gb.shifty += wrap[3*pair.p2+1] - wrap[3*pair.p1+1];
+	gb.shiftz += wrap[3*pair.p2+2] - wrap[3*pair.p1+2];
+	return gb;
+}
+
+/**
+ * @brief Collision search using the neighbour list.
+ * @details Rebuilds the list if needed, then only tests the pairs in the list.
+ * @param r REBOUND simulation to operate on
+ * @return Number of collisions found.
+ */
+static int reb_collision_neighbours_search(struct reb_simulation* const r){
+#ifdef MPI
+	reb_exit("Neighbour lists (collision_skin>0) are not supported with MPI.");
+#endif // MPI
+	struct reb_ghostbox gbs[27];
+	reb_collision_neighbours_update(r, gbs);
+	const struct reb_collision_neighbours* const n = r->collision_neighbours;
+	const struct reb_particle* const particles = r->particles;
+	const int* const index = n->index;
+	const int pairs_N = n->pairs_N;
+	const int continuous = r->collision_continuous;
+	const double dt = r->dt_last_done;
+	reb_collision_buffers_prepare(r);
+#pragma omp parallel
+	{
+	PROFILING_START(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+	struct reb_collision_buffer* const buffer = reb_collision_buffer_get(r);
+#pragma omp for schedule(static) nowait
+	for (int k=0;k<pairs_N;k++){
+		const struct reb_collision_pair pair = n->pairs[k];
+		const int i = index[pair.p1];
+		const int j = index[pair.p2];
+		const struct reb_particle* const p1 = &(particles[i]);
+		const struct reb_particle* const p2 = &(particles[j]);
+		const struct reb_ghostbox gb = reb_collision_neighbours_pair_ghostbox(n, gbs, pair);
+		const double dx = p1->x + gb.shiftx - p2->x;
+		const double dy = p1->y + gb.shifty - p2->y;
+		const double dz = p1->z + gb.shiftz - p2->z;
+		const double sr = p1->r + p2->r;
+		const double dvx = p1->vx + gb.shiftvx - p2->vx;
+		const double dvy = p1->vy + gb.shiftvy - p2->vy;
+		const double dvz = p1->vz + gb.shiftvz - p2->vz;
+		double time = 0.;
+		if (continuous){
+			// Check if particles touch during the timestep
+			if (!reb_collision_time_of_impact(dx, dy, dz, dvx, dvy, dvz, sr, -dt, &time)) continue;
+		}else{
+			// Check if particles are overlapping
+			if (dx*dx+dy*dy+dz*dz>sr*sr) continue;
+			// Check if particles are approaching each other
+			if (dvx*dx + dvy*dy + dvz*dz >0) continue;
+		}
+		struct reb_collision* const c = reb_collision_buffer_add(buffer);
+		c->p1 = i;
+		c->p2 = j;
+		c->gb = gb;
+		c->ri = 0;
+		c->time = time;
+	}
+	PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+	}
+	return reb_collision_buffers_merge(r);
+}
+
+void reb_collision_softsphere_forces(struct reb_simulation* const r){
+#ifdef MPI
+	reb_exit("Soft sphere contacts are not supported with MPI.");
+#endif // MPI
+	if (r->integrator!=REB_INTEGRATOR_LEAPFROG && r->integrator!=REB_INTEGRATOR_SEI){
+		reb_exit("Soft sphere contacts are only supported with the LEAPFROG and SEI integrators.");
+	}
+	if (r->collision!=REB_COLLISION_DIRECT && r->collision!=REB_COLLISION_TREE){
+		reb_exit("Soft sphere contacts need REB_COLLISION_DIRECT or REB_COLLISION_TREE.");
+	}
+	if (r->collision_continuous){
+		reb_exit("Soft sphere contacts cannot be used together with collision_continuous.");
+	}
+	PROFILING_START(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+	struct reb_ghostbox gbs[27];
+	reb_collision_neighbours_update(r, gbs);
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	if (n->contacts_builds_N!=n->builds_N){
+		// Contacts have been switched on after the list was built.
+		reb_collision_contacts_setup(r, NULL, 0);
+	}
+	PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_SEARCH)
+
+	PROFILING_START(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
+	struct reb_particle* const particles = r->particles;
+	const int* const index = n->index;
+	const int* const index0 = n->index0;
+	const int* const adj_start = n->adj_start;
+	const int* const adj = n->adj;
+	double* const force = n->force;
+	const int pairs_N = n->pairs_N;
+	const int N = r->N;
+	const double dt = r->dt;
+	const double kn = r->contact_stiffness;
+	const double gn = r->contact_damping;
+	const double kt = r->contact_tangential_stiffness;
+	const double gt = r->contact_tangential_damping;
+	const double mu = r->contact_friction;
+	const int reset = (r->gravity==REB_GRAVITY_NONE);
+#pragma omp parallel
+	{
+	// Force on the first particle of each pair.
+#pragma omp for schedule(static)
+	for (int k=0;k<pairs_N;k++){
+		const struct reb_collision_pair pair = n->pairs[k];
+		const struct reb_particle* const p1 = &(particles[index[pair.p1]]);
+		const struct reb_particle* const p2 = &(particles[index[pair.p2]]);
+		const struct reb_ghostbox gb = reb_collision_neighbours_pair_ghostbox(n, gbs, pair);
+		double* const xi = &(n->xi[3*k]);
+		double* const f = &(force[3*k]);
+		const double dx = p1->x + gb.shiftx - p2->x;
+		const double dy = p1->y + gb.shifty - p2->y;
+		const double dz = p1->z + gb.shiftz - p2->z;
+		const double d2 = dx*dx + dy*dy + dz*dz;
+		const double sr = p1->r + p2->r;
+		if (d2>=sr*sr || d2==0.){
+			// Not in contact. The tangential spring is released.
+			xi[0] = 0.;
+			xi[1] = 0.;
+			xi[2] = 0.;
+			f[0] = 0.;
+			f[1] = 0.;
+			f[2] = 0.;
+			continue;
+		}
+		const double d = sqrt(d2);
+		const double nx = dx/d;
+		const double ny = dy/d;
+		const double nz = dz/d;
+		const double dvx = p1->vx + gb.shiftvx - p2->vx;
+		const double dvy = p1->vy + gb.shiftvy - p2->vy;
+		const double dvz = p1->vz + gb.shiftvz - p2->vz;
+		const double vn = dvx*nx + dvy*ny + dvz*nz;
+		const double vtx = dvx - vn*nx;
+		const double vty = dvy - vn*ny;
+		const double vtz = dvz - vn*nz;
+		// Normal force (spring and dashpot), never attractive.
+		double fn = kn*(sr-d) - gn*vn;
+		if (fn<0.){
+			fn = 0.;
+		}
+		// Rotate the tangential spring into the current tangential plane, keeping its length.
+		const double xin = xi[0]*nx + xi[1]*ny + xi[2]*nz;
+		const double xi2 = xi[0]*xi[0] + xi[1]*xi[1] + xi[2]*xi[2];
+		double xix = xi[0] - xin*nx;
+		double xiy = xi[1] - xin*ny;
+		double xiz = xi[2] - xin*nz;
+		const double xit2 = xix*xix + xiy*xiy + xiz*xiz;
+		if (xit2>0.){
+			const double scale = sqrt(xi2/xit2);
+			xix *= scale;
+			xiy *= scale;
+			xiz *= scale;
+		}
+		xix += vtx*dt;
+		xiy += vty*dt;
+		xiz += vtz*dt;
+		// Tangential force (spring and dashpot), limited by Coulomb friction.
+		double ftx = -kt*xix - gt*vtx;
+		double fty = -kt*xiy - gt*vty;
+		double ftz = -kt*xiz - gt*vtz;
+		const double ft2 = ftx*ftx + fty*fty + ftz*ftz;
+		const double ftmax = mu*fn;
+		if (ft2>ftmax*ftmax){
+			const double scale = ftmax/sqrt(ft2);
+			ftx *= scale;
+			fty *= scale;
+			ftz *= scale;
+			// Particles slide. The spring is as long as the friction force allows.
+			if (kt>0.){
+				xix = -(ftx + gt*vtx)/kt;
+				xiy = -(fty + gt*vty)/kt;
+				xiz = -(ftz + gt*vtz)/kt;
+			}
+		}
+		xi[0] = xix;
+		xi[1] = xiy;
+		xi[2] = xiz;
+		f[0] = fn*nx + ftx;
+		f[1] = fn*ny + fty;
+		f[2] = fn*nz + ftz;
+	}
+	// Sum up the forces on each particle, always in the same order.
+#pragma omp for schedule(static)
+	for (int i=0;i<N;i++){
+		const int i0 = index0[i];
+		double fx = 0.;
+		double fy = 0.;
+		double fz = 0.;
+		for (int a=adj_start[i0];a<adj_start[i0+1];a++){
+			const int k = adj[a]>>1;
+			const double sign = (adj[a]&1)?-1.:1.;
+			fx += sign*force[3*k+0];
+			fy += sign*force[3*k+1];
+			fz += sign*force[3*k+2];
+		}
+		struct reb_particle* const p = &(particles[i]);
+		if (reset){
+			p->ax = 0.;
+			p->ay = 0.;
+			p->az = 0.;
+		}
+		if (p->m>0.){
+			p->ax += fx/p->m;
+			p->ay += fy/p->m;
+			p->az += fz/p->m;
+		}
+	}
+	}
+	PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION_RESOLVE)
+}
+
 /**
  * @brief Find the nearest neighbour in a cell or its daughters.
  * @details The function only returns a positive result if the particles
@@ -254,14 +1961,14 @@ EXPORTIT void reb_set_collision_resolve(struct reb_simulation* r, int (*resolve)
  * @param r REBOUND simulation to work on.
  * @param gb (Shifted) position and velocity of the particle.
  * @param ri Index of the root box currently being searched in.
- * @param p1_r Radius of the particle (this is not in gb).
+ * @param p1_r Radius of the particle (this is not in gb). If collision_continuous is set, this includes the distance the particle moved during the timestep.
  * @param nearest_r2 Pointer to the nearest neighbour found so far.
  * @param collision_nearest Pointer to the nearest collision found so far.
  * @param c Pointer to the cell currently being searched in.
- * @param collisions_N Pointer to current number of collisions
+ * @param buffer Collision buffer of the calling thread.
  * @param gbunmod Ghostbox unmodified
  */
-static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, int* collisions_N, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c){
+static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const r, struct reb_collision_buffer* const buffer, struct reb_ghostbox gb, struct reb_ghostbox gbunmod, int ri, double p1_r, double* nearest_r2, struct reb_collision* collision_nearest, struct reb_treecell* c){
 	const struct reb_particle* const particles = r->particles;
 	if (c->pt>=0){
 		// c is a leaf node
@@ -302,28 +2009,28 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
 			// A closer neighbour has already been found
 			//if (r2 > *nearest_r2) return;
 			double rp = p1_r+p2.r;
-			// reb_particles are not overlapping
-			if (r2 > rp*rp) return;
 			double dvx = gb.shiftvx - p2.vx;
 			double dvy = gb.shiftvy - p2.vy;
 			double dvz = gb.shiftvz - p2.vz;
-			// reb_particles are not approaching each other
-			if (dvx*dx + dvy*dy + dvz*dz >0) return;
+			if (r->collision_continuous){
+				// Spheres containing the particles during the entire timestep are not overlapping
+				rp += r->dt_last_done*sqrt(p2.vx*p2.vx + p2.vy*p2.vy + p2.vz*p2.vz);
+				if (r2 > rp*rp) return;
+				// reb_particles do not touch during the timestep
+				if (!reb_collision_time_of_impact(dx, dy, dz, dvx, dvy, dvz, particles[collision_nearest->p1].r+p2.r, -r->dt_last_done, &(collision_nearest->time))) return;
+			}else{
+				// reb_particles are not overlapping
+				if (r2 > rp*rp) return;
+				// reb_particles are not approaching each other
+				if (dvx*dx + dvy*dy + dvz*dz >0) return;
+			}
 			// Found a new nearest neighbour. Save it for later.
 			*nearest_r2 = r2;
 			collision_nearest->ri = ri;
 			collision_nearest->p2 = c->pt;
 			collision_nearest->gb = gbunmod;
-			// Save collision in collisions array.
-#pragma omp critical
-			{
-				if (r->collisions_allocatedN<=(*collisions_N)){
-					r->collisions_allocatedN += 32;
-					r->collisions = realloc(r->collisions,sizeof(struct reb_collision)*r->collisions_allocatedN);
-				}
-				r->collisions[(*collisions_N)] = *collision_nearest;
-				(*collisions_N)++;
-			}
+			// Save collision in the buffer of this thread.
+			*reb_collision_buffer_add(buffer) = *collision_nearest;
 		}
 	}else{
 		// c is not a leaf node
@@ -331,13 +2038,13 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
 		double dy = gb.shifty - c->y;
 		double dz = gb.shiftz - c->z;
 		double r2 = dx*dx + dy*dy + dz*dz;
-		double rp  = p1_r + r->max_radius[1] + 0.86602540378443*c->w;
+		double rp  = p1_r + c->rmax + 0.86602540378443*c->w;
 		// Check if we need to decent into daughter cells
 		if (r2 < rp*rp ){
 			for (int o=0;o<8;o++){
 				struct reb_treecell* d = c->oct[o];
 				if (d!=NULL){
-					reb_tree_get_nearest_neighbour_in_cell(r, collisions_N, gb,gbunmod,ri,p1_r,nearest_r2,collision_nearest,d);
+					reb_tree_get_nearest_neighbour_in_cell(r, buffer, gb,gbunmod,ri,p1_r,nearest_r2,collision_nearest,d);
 				}
 			}
 		}
@@ -345,7 +2052,15 @@ static void reb_tree_get_nearest_neighbour_in_cell(struct reb_simulation* const
 }
 
 
-EXPORTIT int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_collision c){
+/**
+ * @brief Resolves a hard sphere collision.
+ * @details Only the two particles of the collision are modified. 
+ * @param r REBOUND simulation to operate on
+ * @param c Collision to resolve
+ * @param plog Momentum exchange of this collision (output)
+ * @return 1 if the collision has been resolved, 0 if the particles are not overlapping or not approaching each other.
+ */
+static int reb_collision_hardsphere(struct reb_simulation* const r, const struct reb_collision c, double* const plog){
 	struct reb_particle* const particles = r->particles;
 	struct reb_particle p1 = particles[c.p1];
 	struct reb_particle p2;
@@ -373,7 +2088,7 @@ EXPORTIT int reb_collision_resolve_hardsphere(struct reb_simulation* const r, st
 	}else{
 		oldvyouter = p2.vy;
 	}
-	if (rp*rp < x21*x21 + y21*y21 + z21*z21) return 0;
+	if (rp*rp < x21*x21 + y21*y21 + z21*z21) return 0; // not overlapping
 	double vx21 = p1.vx + gb.shiftvx - p2.vx;
 	double vy21 = p1.vy + gb.shiftvy - p2.vy;
 	double vz21 = p1.vz + gb.shiftvz - p2.vz;
@@ -432,15 +2147,145 @@ EXPORTIT int reb_collision_resolve_hardsphere(struct reb_simulation* const r, st
 
 	// Return y-momentum change
 	if (x21>0){
-		r->collisions_plog += -fabs(x21)*(oldvyouter-particles[c.p1].vy) * p1.m;
-		r->collisions_Nlog ++;
+		*plog = -fabs(x21)*(oldvyouter-particles[c.p1].vy) * p1.m;
 	}else{
-		r->collisions_plog += -fabs(x21)*(oldvyouter-particles[c.p2].vy) * p2.m;
+		*plog = -fabs(x21)*(oldvyouter-particles[c.p2].vy) * p2.m;
+	}
+	return 1;
+}
+
+EXPORTIT int reb_collision_resolve_hardsphere(struct reb_simulation* const r, struct reb_collision c){
+	double plog;
+	if (reb_collision_hardsphere(r, c, &plog)){
+		r->collisions_plog += plog;
 		r->collisions_Nlog ++;
 	}
-    return 0;
+	return 0;
+}
+
+void reb_collision_schedule_free(struct reb_simulation* const r){
+	struct reb_collision_schedule* const s = r->collision_schedule;
+	if (s==NULL) return;
+	free(s->batch);
+	free(s->order);
+	free(s->plog);
+	free(s->applied);
+	free(s->last);
+	free(s->batch_start);
+	free(s);
+	r->collision_schedule = NULL;
 }
 
+#if defined(OPENMP) && !defined(MPI)
+/**
+ * @brief Groups the collisions into batches in which every particle appears at most once.
+ * @details Each collision is put into the first batch after the batches of all 
+ * earlier collisions of the same two particles (greedy list scheduling).
+ * @param r REBOUND simulation to operate on
+ * @param collisions_N Number of collisions in r->collisions
+ */
+static void reb_collision_schedule_update(struct reb_simulation* const r, const int collisions_N){
+	if (r->collision_schedule==NULL){
+		r->collision_schedule = calloc(1,sizeof(struct reb_collision_schedule));
+	}
+	struct reb_collision_schedule* const s = r->collision_schedule;
+	const int N = r->N;
+	if (s->collisions_allocatedN<collisions_N){
+		s->collisions_allocatedN = collisions_N;
+		s->batch = realloc(s->batch,sizeof(int)*collisions_N);
+		s->order = realloc(s->order,sizeof(int)*collisions_N);
+		s->plog = realloc(s->plog,sizeof(double)*collisions_N);
+		s->applied = realloc(s->applied,sizeof(int)*collisions_N);
+	}
+	if (s->particles_allocatedN<N){
+		s->particles_allocatedN = N;
+		s->last = realloc(s->last,sizeof(int)*N);
+	}
+	for (int i=0;i<N;i++){
+		s->last[i] = 0;
+	}
+	s->batch_N = 0;
+	for (int i=0;i<collisions_N;i++){
+		const int p1 = r->collisions[i].p1;
+		const int p2 = r->collisions[i].p2;
+		const int b = s->last[p1]>s->last[p2]?s->last[p1]:s->last[p2];
+		s->batch[i] = b;
+		s->last[p1] = b+1;
+		s->last[p2] = b+1;
+		if (b+1>s->batch_N){
+			s->batch_N = b+1;
+		}
+	}
+	// Counting sort by batch. Keeps the order of collisions within a batch.
+	if (s->batches_allocatedN<s->batch_N+1){
+		s->batches_allocatedN = s->batch_N+1;
+		s->batch_start = realloc(s->batch_start,sizeof(int)*s->batches_allocatedN);
+	}
+	for (int b=0;b<=s->batch_N;b++){
+		s->batch_start[b] = 0;
+	}
+	for (int i=0;i<collisions_N;i++){
+		s->batch_start[s->batch[i]+1]++;
+	}
+	for (int b=0;b<s->batch_N;b++){
+		s->batch_start[b+1] += s->batch_start[b];
+	}
+	for (int i=0;i<collisions_N;i++){
+		s->order[s->batch_start[s->batch[i]]++] = i;
+	}
+	// batch_start has been shifted by one batch while sorting.
+	for (int b=s->batch_N;b>0;b--){
+		s->batch_start[b] = s->batch_start[b-1];
+	}
+	s->batch_start[0] = 0;
+}
+
+/**
+ * @brief Resolves all collisions with the hard sphere model, one batch of independent collisions at a time.
+ * @details The collisions within one batch are resolved in parallel. The 
+ * result is identical to calling reb_collision_resolve_hardsphere() for
+ * all collisions in the order of r->collisions, including collisions_plog.
+ * @param r REBOUND simulation to operate on
+ * @param collisions_N Number of collisions in r->collisions
+ */
+static void reb_collision_resolve_hardsphere_parallel(struct reb_simulation* const r, const int collisions_N){
+	reb_collision_schedule_update(r, collisions_N);
+	struct reb_collision_schedule* const s = r->collision_schedule;
+#pragma omp parallel
+	{
+	for (int b=0;b<s->batch_N;b++){
+		// Implicit barrier at the end of each batch.
+#pragma omp for schedule(static)
+		for (int k=s->batch_start[b];k<s->batch_start[b+1];k++){
+			const int i = s->order[k];
+			struct reb_collision c = r->collisions[i];
+			// Move particles and the ghost box to the time of the collision (sweep algorithms only).
+			if (c.time!=0.){
+				c.gb.shiftx += c.time*c.gb.shiftvx;
+				c.gb.shifty += c.time*c.gb.shiftvy;
+				c.gb.shiftz += c.time*c.gb.shiftvz;
+				reb_collision_drift(r, c.p1, c.time);
+				reb_collision_drift(r, c.p2, c.time);
+			}
+			s->applied[i] = reb_collision_hardsphere(r, c, &(s->plog[i]));
+			if (c.time!=0.){
+				reb_collision_drift(r, c.p1, -c.time);
+				reb_collision_drift(r, c.p2, -c.time);
+			}
+		}
+	}
+	}
+	// Sum up the momentum exchange in the same order as in the serial case.
+	for (int i=0;i<collisions_N;i++){
+		if (s->applied[i]){
+			r->collisions_plog += s->plog[i];
+			r->collisions_Nlog ++;
+		}
+	}
+}
+#endif // OPENMP && !MPI
+
+
 
 EXPORTIT int reb_collision_resolve_merge(struct reb_simulation* const r, struct reb_collision c){
 	if (r->particles[c.p1].lastcollision==r->t || r->particles[c.p2].lastcollision==r->t) return 0;
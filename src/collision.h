@@ -24,9 +24,254 @@
  */
 #ifndef _COLLISIONS_H
 #define _COLLISIONS_H
+struct reb_simulation;
+struct reb_treecell;
 /**
  * @brief Search for collisions and resolve them.
  */
 void reb_collision_search(struct reb_simulation* const r);
 
+/**
+ * @brief Collisions found by one thread during the collision search.
+ * @details Each thread appends to its own buffer, without locking. The 
+ * buffers are merged into r->collisions after the search.
+ */
+struct reb_collision_buffer {
+	struct reb_collision* collisions;	///< Collisions found by this thread.
+	int N;					///< Number of collisions in the buffer.
+	int allocatedN;				///< Size allocated for collisions.
+};
+
+/**
+ * @brief Frees the per-thread collision buffers.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_collision_buffers_free(struct reb_simulation* const r);
+
+/**
+ * @brief Uniform grid (cell list) used by REB_COLLISION_GRID.
+ * @details Particles are sorted by cell with a counting sort. The particles
+ * of cell c are particles[cell_start[c]] ... particles[cell_start[c+1]-1].
+ * Cells are at least as large as the largest particle diameter.
+ */
+struct reb_collision_grid {
+	int n[3];			///< Number of cells in x, y and z direction.
+	double min[3];			///< Lower corner of the grid.
+	double cellsize[3];		///< Size of one cell in x, y and z direction.
+	double max_radius;		///< Largest particle radius at the time the grid was built.
+	int* cell_start;		///< Index of the first particle of each cell in particles (size: number of cells + 1).
+	int cells_allocatedN;		///< Size allocated for cell_start.
+	int* particles;			///< Particle indices, sorted by cell.
+	int* particle_cell;		///< Cell of each particle.
+	int particles_allocatedN;	///< Size allocated for particles and particle_cell.
+	int* counts;			///< Number of particles per cell and thread, used while building the grid.
+	int counts_allocatedN;		///< Size allocated for counts.
+};
+
+/**
+ * @brief Particle list sorted along the sweep direction, used by REB_COLLISION_SWEEP and REB_COLLISION_SWEEPPHI.
+ * @details The order is kept from one timestep to the next. Because particles
+ * move only a little during one timestep, the list is nearly sorted and can be
+ * updated with an insertion sort in almost linear time.
+ */
+struct reb_collision_sweep {
+	int* order;			///< Particle indices sorted by key.
+	int order_N;			///< Number of particles in order. The list is rebuilt if this differs from N.
+	double* key;			///< Position of each particle along the sweep direction (x or phi).
+	double* width;			///< Half width of the interval each particle covers along the sweep direction during one timestep.
+	double width_max;		///< Largest half width.
+	int allocatedN;			///< Size allocated for order, key and width.
+};
+
+/**
+ * @brief Frees the sweep list.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_collision_sweep_free(struct reb_simulation* const r);
+
+/**
+ * @brief Pair of particles in the neighbour list.
+ */
+struct reb_collision_pair {
+	int p1;		///< Index of the first particle when the list was built.
+	int p2;		///< Index of the second particle when the list was built, always larger than p1.
+	int g;		///< Ghost box of the first particle, ((gbx+1)*3+(gby+1))*3+(gbz+1).
+};
+
+/**
+ * @brief Pairs found by one thread while building the neighbour list.
+ */
+struct reb_collision_pair_buffer {
+	struct reb_collision_pair* pairs;	///< Pairs found by this thread.
+	int N;					///< Number of pairs in the buffer.
+	int allocatedN;				///< Size allocated for pairs.
+};
+
+/**
+ * @brief Verlet neighbour list, used by REB_COLLISION_DIRECT and REB_COLLISION_TREE if collision_skin is positive.
+ * @details The list contains all pairs of particles which were closer than the sum 
+ * of their radii plus the skin when the list was built. The list remains valid as 
+ * long as no two particles can have approached each other by more than the skin, 
+ * taking into account the displacement of particles, the growth of radii and the 
+ * shift of the shear periodic ghost boxes. Particles which have been moved across a 
+ * periodic boundary keep their pairs, the ghost box of the pair is corrected instead.
+ * Pairs, positions and shifts are stored by the particle index at the time the
+ * list was built, so that the tree can reorder particles.
+ * The list is rebuilt when the number of particles changes.
+ * If collision_continuous is set, pairs also need to be in the list if they
+ * could have touched at any time during the last timestep.
+ *
+ * Soft sphere contacts store the tangential spring of each pair in the list. 
+ * When the list is rebuilt, the springs of all pairs in contact are carried over.
+ * They are lost if the number of particles has changed.
+ */
+struct reb_collision_neighbours {
+	struct reb_collision_pair* pairs;	///< Pairs of particles that might collide.
+	int pairs_N;				///< Number of pairs.
+	int pairs_allocatedN;			///< Size allocated for pairs.
+	struct reb_collision_pair_buffer* buffers;	///< One buffer per thread, used while building the list.
+	int buffers_N;				///< Number of buffers.
+	double* x0;				///< Position (x, y, z) and radius of each particle when the list was built.
+	double* wrap;				///< Shift (x, y, z) of each particle by periodic boundaries since the list was built.
+	int* index;				///< Current index of each particle, by its index when the list was built.
+	int* index0;				///< Index of each particle when the list was built, by its current index.
+	int N;					///< Number of particles when the list was built.
+	int allocatedN;				///< Size allocated for x0 (in particles).
+	double skin;				///< Skin distance used to build the list.
+	double sweep;				///< Largest distance two particles could travel relative to each other during one timestep when the list was built. Added to the skin if collision_continuous is set.
+	int nghostcol[3];			///< Number of ghost boxes searched in each direction when the list was built.
+	double shift0;				///< Shift in y of the ghost box (1,0,0) when the list was built (shear periodic boundaries only).
+	long builds_N;				///< Number of times the list has been built.
+	double* xi;				///< Tangential spring (x, y, z) of each pair, used by soft sphere contacts. Zero if the particles are not in contact.
+	double* force;				///< Contact force (x, y, z) on the first particle of each pair.
+	int xi_allocatedN;			///< Size allocated for xi and force (in pairs).
+	int* adj_start;				///< Index of the first entry of each particle in adj (size: N + 1), by index when the list was built.
+	int* adj;				///< Pairs of each particle, 2*pair if it is the first and 2*pair+1 if it is the second particle of the pair.
+	int adj_allocatedN;			///< Size allocated for adj (in pairs).
+	int adj_start_allocatedN;		///< Size allocated for adj_start.
+	long contacts_builds_N;			///< Value of builds_N when xi, force and adj were set up, -1 if they have not been set up.
+};
+
+/**
+ * @brief Frees the neighbour list.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_collision_neighbours_free(struct reb_simulation* const r);
+
+/**
+ * @brief Returns the index of ghost box (gbx,gby,gbz) in the ghost box table of the neighbour list.
+ */
+static inline int reb_collision_neighbours_ghostbox_index(const int gbx, const int gby, const int gbz){
+	return ((gbx+1)*3+(gby+1))*3+(gbz+1);
+}
+
+/**
+ * @brief Adds all particles in a cell or its daughters that are closer to the 
+ * shifted position (x,y,z) than rr plus their radius to the pair buffer.
+ * @details Only pairs with i<j are added. Requires the collision data of the tree (rmax).
+ * @param r REBOUND simulation to operate on
+ * @param buffer Pair buffer of the calling thread.
+ * @param i Index of the particle.
+ * @param g Ghost box index of the particle.
+ * @param x Shifted x position of the particle.
+ * @param y Shifted y position of the particle.
+ * @param z Shifted z position of the particle.
+ * @param rr Radius of the particle plus the skin.
+ * @param c Cell currently being searched in.
+ */
+void reb_collision_neighbours_tree_walk(struct reb_simulation* const r, struct reb_collision_pair_buffer* const buffer, const int i, const int g, const double x, const double y, const double z, const double rr, const struct reb_treecell* const c);
+
+/**
+ * @brief Prepares rebuilding the neighbour list during the gravity tree walk.
+ * @details Used if both gravity and the collision search use the tree and collision_skin 
+ * is positive. Nothing is done if the list is expected to remain valid until the
+ * collision search at the end of the timestep. Otherwise, the pair buffers are 
+ * cleared and the collision data of the tree is updated. The gravity walk then calls
+ * reb_collision_neighbours_tree_walk() with the pair buffer of its thread for each 
+ * particle and ghost box of the inner most ring, in the same order as the collision 
+ * search, followed by reb_collision_neighbours_gravity_walk_finish().
+ * @param r REBOUND simulation to operate on
+ * @return Distance to add to the particle radii when searching for pairs, negative if the list does not need to be rebuilt.
+ */
+double reb_collision_neighbours_gravity_walk_begin(struct reb_simulation* const r);
+
+/**
+ * @brief Replaces the neighbour list with the pairs found during the gravity tree walk.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_collision_neighbours_gravity_walk_finish(struct reb_simulation* const r);
+
+/**
+ * @brief Adds the soft sphere contact forces of all overlapping particles to their accelerations.
+ * @details Contacts are found with the neighbour list (see collision_skin). 
+ * With REB_GRAVITY_NONE, accelerations are reset first.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_collision_softsphere_forces(struct reb_simulation* const r);
+
+/**
+ * @brief Informs the neighbour list that two particles have swapped places in the particle array.
+ * @param r REBOUND simulation to operate on
+ * @param i Index of the first particle.
+ * @param j Index of the second particle.
+ */
+void reb_collision_neighbours_swap(struct reb_simulation* const r, const int i, const int j);
+
+/**
+ * @brief Schedule used to resolve hard sphere collisions in parallel.
+ * @details Collisions are grouped into batches in which no particle appears
+ * twice. The collisions of one batch are independent and can be resolved
+ * in parallel. Each particle's collisions are assigned to increasing batches 
+ * in the order in which they appear in r->collisions. Resolving the batches
+ * one after another therefore gives the same result as resolving the 
+ * collisions serially.
+ */
+struct reb_collision_schedule {
+	int* batch;			///< Batch of each collision.
+	int* order;			///< Collision indices, sorted by batch.
+	double* plog;			///< Momentum exchange of each collision (see collisions_plog).
+	int* applied;			///< 1 if the collision has been resolved, 0 if the particles were not approaching anymore.
+	int collisions_allocatedN;	///< Size allocated for batch, order, plog and applied.
+	int* last;			///< Batch following the last collision of each particle.
+	int particles_allocatedN;	///< Size allocated for last.
+	int* batch_start;		///< Index of the first collision of each batch in order (size: batch_N + 1).
+	int batch_N;			///< Number of batches.
+	int batches_allocatedN;		///< Size allocated for batch_start.
+};
+
+/**
+ * @brief Frees the collision schedule.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_collision_schedule_free(struct reb_simulation* const r);
+
+/**
+ * @brief Event queue used to resolve collisions in time order if collision_continuous is set.
+ * @details The collisions are kept in a binary heap, ordered by their time of
+ * impact. Each collision remembers how many collisions its two particles had
+ * undergone when its time of impact was calculated. If a particle has collided
+ * since, the time of impact is recalculated from the new trajectories when the
+ * collision reaches the top of the heap. Recalculated times are never earlier
+ * than the last collision that has been resolved.
+ */
+struct reb_collision_queue {
+	int* heap;			///< Collision indices, ordered as a binary heap by time of impact.
+	int* version;			///< Number of collisions of the first and second particle when the time of impact was calculated (2 per collision).
+	int collisions_allocatedN;	///< Size allocated for heap (version has twice this size).
+	int* count;			///< Number of collisions of each particle.
+	int particles_allocatedN;	///< Size allocated for count.
+};
+
+/**
+ * @brief Frees the collision event queue.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_collision_queue_free(struct reb_simulation* const r);
+
+/**
+ * @brief Frees the collision grid.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_collision_grid_free(struct reb_simulation* const r);
+
 #endif // _COLLISIONS_H
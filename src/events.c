@@ -0,0 +1,180 @@
+/**
+ * @file 	events.c
+ * @brief 	Detection of events, i.e. roots of a user defined function, during the integration.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ * @details	The event function is evaluated at the beginning and at the end 
+ * of every timestep. The value at the end of a timestep is reused at the 
+ * beginning of the next one unless the particles have changed in between.
+ * If its sign changes, the root is bracketed and refined 
+ * with the Illinois variant of the regula falsi method. The particles at 
+ * intermediate times are evaluated with the dense output of IAS15, so no 
+ * additional timesteps are needed. This is much faster than finding events
+ * by repeatedly integrating to trial times.
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2016 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rebound.h"
+#include "events.h"
+
+#define REB_EVENTS_ITERATIONS_MAX 100	///< Maximum number of iterations used to find the root of the event function.
+
+/**
+ * @brief Evaluates the event function at time t within the last timestep.
+ * @details The particles at time t are stored in buffer. While the event 
+ * function is called, r->particles and r->t are temporarily replaced.
+ */
+static double reb_events_evaluate(struct reb_simulation* const r, struct reb_particle* const buffer, const double t){
+	reb_integrator_ias15_dense_output(r, t, buffer);
+	struct reb_particle* const particles = r->particles;
+	const double t_end = r->t;
+	r->particles = buffer;
+	r->t = t;
+	const double f = r->event(r);
+	r->particles = particles;
+	r->t = t_end;
+	return f;
+}
+
+/**
+ * @brief Returns 1 if the value of the event function cached at the end of the
+ * previous timestep is also its value at the beginning of the last timestep.
+ * @details This is the case if neither the time, the event function, the number
+ * of particles nor the particles themselves have changed in between, e.g. in a 
+ * collision, at a periodic boundary or in post_timestep_modifications. The 
+ * particles at the beginning of the last timestep are taken from IAS15.
+ */
+static int reb_events_cache_valid(const struct reb_simulation* const r, const double ta){
+	const int N = r->N;
+	// ta is calculated from the end of the timestep and might differ by rounding errors.
+	if (r->events_f_last_N!=N || fabs(r->events_f_last_t-ta)>r->events_epsilon*fabs(r->dt_last_done) || r->events_f_last_event!=r->event){
+		return 0;
+	}
+	const struct reb_particle* const particles = r->particles;
+	const struct reb_particle* const last = r->events_f_last_particles;
+	const double* const xd = r->ri_ias15.xd;
+	const double* const vd = r->ri_ias15.vd;
+	for (int i=0;i<N;i++){
+		if (last[i].x !=xd[3*i+0] || last[i].y !=xd[3*i+1] || last[i].z !=xd[3*i+2]
+		 || last[i].vx!=vd[3*i+0] || last[i].vy!=vd[3*i+1] || last[i].vz!=vd[3*i+2]
+		 || last[i].m !=particles[i].m || last[i].r!=particles[i].r){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * @brief Caches the value of the event function at the end of the last timestep.
+ */
+static void reb_events_cache_store(struct reb_simulation* const r, const double f){
+	const int N = r->N;
+	if (r->events_f_last_allocatedN<N){
+		r->events_f_last_allocatedN = N;
+		r->events_f_last_particles = realloc(r->events_f_last_particles,sizeof(struct reb_particle)*N);
+	}
+	memcpy(r->events_f_last_particles, r->particles, sizeof(struct reb_particle)*N);
+	r->events_f_last = f;
+	r->events_f_last_t = r->t;
+	r->events_f_last_N = N;
+	r->events_f_last_event = r->event;
+}
+
+void reb_events_check(struct reb_simulation* const r){
+	if (r->integrator!=REB_INTEGRATOR_IAS15){
+		reb_warning("Event detection is only supported by the IAS15 integrator. The event function will be ignored.");
+		r->event = NULL;
+		return;
+	}
+	const int N = r->N;
+	const double dt = r->dt_last_done;
+	if (r->ri_ias15.dense_N!=N || dt==0.){
+		return; // No step done.
+	}
+	
+	// Make sure there is space for one more event. 
+	// The particles of the new event are used as a buffer while searching for the root.
+	if (r->events_allocatedN<=r->events_N){
+		r->events_allocatedN = r->events_allocatedN?r->events_allocatedN*2:32;
+		r->events = realloc(r->events,sizeof(struct reb_event)*r->events_allocatedN);
+	}
+	int particles_start = 0;
+	if (r->events_N){
+		const struct reb_event last = r->events[r->events_N-1];
+		particles_start = last.particles_start + last.N;
+	}
+	if (r->events_particles_allocatedN<particles_start+N){
+		int n = r->events_particles_allocatedN?r->events_particles_allocatedN*2:32*N;
+		while (n<particles_start+N) n *= 2;
+		r->events_particles_allocatedN = n;
+		r->events_particles = realloc(r->events_particles,sizeof(struct reb_particle)*r->events_particles_allocatedN);
+	}
+	struct reb_particle* const buffer = r->events_particles + particles_start;
+
+	// Bracket
+	double ta = r->t - dt;
+	double tb = r->t;
+	// fb is evaluated last, the buffer then contains the particles at tb.
+	double fa = reb_events_cache_valid(r, ta)?r->events_f_last:reb_events_evaluate(r, buffer, ta);
+	double fb = reb_events_evaluate(r, buffer, tb);
+	reb_events_cache_store(r, fb);
+	if (!((fa<0. && fb>=0.) || (fa>0. && fb<=0.))){
+		return; // No sign change.
+	}
+	const int direction = fa<0.?1:-1;
+	
+	// Illinois algorithm. The function value at the endpoint that was kept
+	// twice in a row is halved to avoid the slow convergence of regula falsi.
+	// If fb is 0, the root is at the end of the timestep and the buffer 
+	// already contains the particles at that time.
+	double t = tb;
+	int side = 0;
+	if (fb!=0.){
+		for (int i=0;i<REB_EVENTS_ITERATIONS_MAX;i++){
+			const double t_last = t;
+			t = (ta*fb - tb*fa)/(fb - fa);
+			const double ft = reb_events_evaluate(r, buffer, t);
+			if (ft==0. || fabs(t-t_last)<=r->events_epsilon*fabs(dt)){
+				break;
+			}
+			if ((ft>0.) == (fb>0.)){
+				tb = t;
+				fb = ft;
+				if (side==-1) fa /= 2.;
+				side = -1;
+			}else{
+				ta = t;
+				fa = ft;
+				if (side==1) fb /= 2.;
+				side = 1;
+			}
+		}
+	}
+
+	struct reb_event* const event = &(r->events[r->events_N]);
+	event->t = t;
+	event->direction = direction;
+	event->N = N;
+	event->particles_start = particles_start;
+	r->events_N++;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file 	events.h
+ * @brief 	Detection of events, i.e. roots of a user defined function, during the integration.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2016 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _EVENTS_H
+#define _EVENTS_H
+struct reb_simulation;
+
+/**
+ * @brief Searches for a root of the event function during the last timestep.
+ * @details Called after every timestep if an event function is set. 
+ * A root is stored in r->events if the event function has a different
+ * sign at the beginning and at the end of the timestep.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_events_check(struct reb_simulation* const r);
+#endif // _EVENTS_H
@@ -37,11 +37,17 @@
 #include "particle.h"
 #include "rebound.h"
 #include "tree.h"
+#include "gravity.h"
 #include "boundary.h"
+#include "profiling.h"
+#include "collision.h"
 
 #ifdef MPI
 #include "communication_mpi.h"
 #endif
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
 
 /**
   * @brief The function loops over all trees to call calculate_forces_for_particle_from_cell() tree to calculate forces for each particle.
@@ -51,6 +57,22 @@
   */
 static void reb_calculate_acceleration_for_particle(const struct reb_simulation* const r, const int pt, const struct reb_ghostbox gb);
 
+/**
+  * @brief Calculates the acceleration for a particle from a given cell and all its daughter cells, and adds all particles 
+  * in these cells which are closer than the particle's radius plus the skin to the collision neighbour list.
+  * @details Cells are opened if needed for either the force or the pair search. Forces are identical to the ones 
+  * calculated by reb_calculate_acceleration_for_particle_from_cell() and pairs are found in the same order as by 
+  * reb_collision_neighbours_tree_walk().
+  * @param r REBOUND simulation to consider
+  * @param buffer Pair buffer of the calling thread.
+  * @param pt Index of the particle the force is calculated for.
+  * @param g Ghost box index of the particle in the neighbour list.
+  * @param rr Radius of the particle plus the skin.
+  * @param node Pointer to the cell the force is calculated from.
+  * @param gb Ghostbox plus position of the particle (precalculated). 
+  */
+static void reb_calculate_acceleration_and_neighbours_for_particle_from_cell(struct reb_simulation* const r, struct reb_collision_pair_buffer* const buffer, const int pt, const int g, const double rr, const struct reb_treecell* const node, const struct reb_ghostbox gb);
+
 /**
  * Main Gravity Routine
  */
@@ -85,7 +107,10 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 			for (int gbz=-nghostz; gbz<=nghostz; gbz++){
 				struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
 				// Summing over all particle pairs
-#pragma omp parallel for schedule(guided)
+#pragma omp parallel
+				{
+				PROFILING_START(r, REB_PROFILING_CAT_GRAVITY_WALK)
+#pragma omp for schedule(guided) nowait
 				for (int i=_N_start; i<_N_real; i++){
 				for (int j=_N_start; j<_N_active; j++){
 					if (_gravity_ignore_10 && ((j==1 && i==0) || (i==1 && j==0))) continue;
@@ -101,6 +126,8 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 					particles[i].az    += prefact*dz;
 				}
 				}
+				PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
+				}
                 if (_testparticle_type){
 				for (int i=_N_start; i<_N_active; i++){
 				for (int j=_N_active; j<_N_real; j++){
@@ -370,7 +397,10 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 			for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
 			for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
 				// Summing over all particle pairs
-#pragma omp parallel for schedule(guided)
+#pragma omp parallel
+				{
+				PROFILING_START(r, REB_PROFILING_CAT_GRAVITY_WALK)
+#pragma omp for schedule(guided) nowait
 				for (int i=0; i<N; i++){
 					struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
 					// Precalculated shifted position
@@ -379,6 +409,8 @@ void reb_calculate_acceleration(struct reb_simulation* r){
 					gb.shiftz += particles[i].z;
 					reb_calculate_acceleration_for_particle(r, i, gb);
 				}
+				PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
+				}
 			}
 			}
 			}
@@ -677,6 +709,164 @@ void reb_calculate_acceleration_var(struct reb_simulation* r){
 
 }
 
+/**
+ * @brief Minimum number of particle pairs for which the summation in reb_calculate_acceleration_for_particles() uses OpenMP threads.
+ */
+#define REB_GRAVITY_OPENMP_PAIRS 4096
+
+/**
+ * @brief Minimum number of particles for which the tree walks in reb_calculate_acceleration_for_particles() use OpenMP threads.
+ */
+#define REB_GRAVITY_OPENMP_PARTICLES 64
+
+void reb_calculate_acceleration_for_particles(struct reb_simulation* r, const int* const index, const int index_N){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const int N_active = r->N_active;
+	const double G = r->G;
+	const double softening2 = r->softening*r->softening;
+	const unsigned int _gravity_ignore_10 = r->gravity_ignore_10;
+	const int _N_active = ((N_active==-1)?N:N_active) - r->N_var;
+	const int _N_real   = N  - r->N_var;
+	const int _testparticle_type   = r->testparticle_type;
+	switch (r->gravity){
+		case REB_GRAVITY_NONE:
+			for (int k=0; k<index_N; k++){
+				const int i = index[k];
+				particles[i].ax = 0;
+				particles[i].ay = 0;
+				particles[i].az = 0;
+			}
+		break;
+		case REB_GRAVITY_BASIC:
+		{
+			const int nghostx = r->nghostx;
+			const int nghosty = r->nghosty;
+			const int nghostz = r->nghostz;
+			// Only a few particles are updated at a time with individual timesteps. 
+			// Starting the threads would then take longer than the summation.
+#pragma omp parallel for schedule(guided) if(index_N*_N_active>=REB_GRAVITY_OPENMP_PAIRS)
+			for (int k=0; k<index_N; k++){
+				const int i = index[k];
+				// Active particles feel test particles of type 1.
+				const int j_max = (_testparticle_type && i<_N_active)?_N_real:_N_active;
+				double ax = 0;
+				double ay = 0;
+				double az = 0;
+				// Summing over all Ghost Boxes
+				for (int gbx=-nghostx; gbx<=nghostx; gbx++){
+				for (int gby=-nghosty; gby<=nghosty; gby++){
+				for (int gbz=-nghostz; gbz<=nghostz; gbz++){
+					const struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+					for (int j=0; j<j_max; j++){
+						if (_gravity_ignore_10 && ((j==1 && i==0) || (i==1 && j==0))) continue;
+						if (i==j) continue;
+						const double dx = (gb.shiftx+particles[i].x) - particles[j].x;
+						const double dy = (gb.shifty+particles[i].y) - particles[j].y;
+						const double dz = (gb.shiftz+particles[i].z) - particles[j].z;
+						const double _r = sqrt(dx*dx + dy*dy + dz*dz + softening2);
+						const double prefact = -G/(_r*_r*_r)*particles[j].m;
+
+						ax    += prefact*dx;
+						ay    += prefact*dy;
+						az    += prefact*dz;
+					}
+				}
+				}
+				}
+				particles[i].ax = ax;
+				particles[i].ay = ay;
+				particles[i].az = az;
+			}
+		}
+		break;
+		case REB_GRAVITY_TREE:
+		{
+#pragma omp parallel for schedule(guided) if(index_N>=REB_GRAVITY_OPENMP_PARTICLES)
+			for (int k=0; k<index_N; k++){
+				const int i = index[k];
+				particles[i].ax = 0; 
+				particles[i].ay = 0; 
+				particles[i].az = 0; 
+				// Summing over all Ghost Boxes
+				for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+				for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+				for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+					struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+					// Precalculated shifted position
+					gb.shiftx += particles[i].x;
+					gb.shifty += particles[i].y;
+					gb.shiftz += particles[i].z;
+					reb_calculate_acceleration_for_particle(r, i, gb);
+				}
+				}
+				}
+			}
+		}
+		break;
+		default:
+			reb_exit("Gravity calculation for a subset of particles not yet implemented.");
+	}
+}
+
+
+void reb_calculate_acceleration_and_collision_neighbours(struct reb_simulation* r){
+	const double skin = reb_collision_neighbours_gravity_walk_begin(r);
+	if (skin<0.){
+		// The neighbour list remains valid.
+		reb_calculate_acceleration(r);
+		return;
+	}
+	struct reb_particle* const particles = r->particles;
+	struct reb_collision_neighbours* const n = r->collision_neighbours;
+	const int N = r->N;
+	// Pairs are only searched for in the inner most ring of ghost boxes.
+	const int nghostxcol = (r->nghostx>1?1:r->nghostx);
+	const int nghostycol = (r->nghosty>1?1:r->nghosty);
+	const int nghostzcol = (r->nghostz>1?1:r->nghostz);
+#pragma omp parallel
+	{
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY_WALK)
+#ifdef OPENMP
+	struct reb_collision_pair_buffer* const buffer = &(n->buffers[omp_get_thread_num()]);
+#else // OPENMP
+	struct reb_collision_pair_buffer* const buffer = &(n->buffers[0]);
+#endif // OPENMP
+	// Same schedule as the collision search, so that pairs are found in the same order.
+#pragma omp for schedule(static,16) nowait
+	for (int i=0; i<N; i++){
+		particles[i].ax = 0; 
+		particles[i].ay = 0; 
+		particles[i].az = 0; 
+		const double rr = particles[i].r + skin;
+		// Summing over all Ghost Boxes
+		for (int gbx=-r->nghostx; gbx<=r->nghostx; gbx++){
+		for (int gby=-r->nghosty; gby<=r->nghosty; gby++){
+		for (int gbz=-r->nghostz; gbz<=r->nghostz; gbz++){
+			struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			// Precalculated shifted position
+			gb.shiftx += particles[i].x;
+			gb.shifty += particles[i].y;
+			gb.shiftz += particles[i].z;
+			if (abs(gbx)<=nghostxcol && abs(gby)<=nghostycol && abs(gbz)<=nghostzcol){
+				const int g = reb_collision_neighbours_ghostbox_index(gbx,gby,gbz);
+				for (int ri=0;ri<r->root_n;ri++){
+					const struct reb_treecell* const node = r->tree_root[ri];
+					if (node!=NULL){
+						reb_calculate_acceleration_and_neighbours_for_particle_from_cell(r, buffer, i, g, rr, node, gb);
+					}
+				}
+			}else{
+				reb_calculate_acceleration_for_particle(r, i, gb);
+			}
+		}
+		}
+		}
+	}
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
+	}
+	reb_collision_neighbours_gravity_walk_finish(r);
+}
 
 // Helper routines for REB_GRAVITY_TREE
 
@@ -701,10 +891,47 @@ static void reb_calculate_acceleration_for_particle(const struct reb_simulation*
 	}
 }
 
-static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb) {
+/**
+  * @brief Adds the acceleration from a cell that is not opened, or from a leaf, to a particle.
+  * @param r REBOUND simulation to consider
+  * @param pt Index of the particle the force is calculated for.
+  * @param node Pointer to the cell or leaf the force is calculated from.
+  * @param dx Distance to the center of mass of the cell (x component, dy and dz accordingly).
+  * @param r2 Squared distance to the center of mass of the cell.
+  */
+static inline void reb_calculate_acceleration_for_particle_from_node(const struct reb_simulation* const r, const int pt, const struct reb_treecell* const node, const double dx, const double dy, const double dz, const double r2){
 	const double G = r->G;
 	const double softening2 = r->softening*r->softening;
 	struct reb_particle* const particles = r->particles;
+	if ( node->pt < 0 ) { // Not a leaf
+		double _r = sqrt(r2 + softening2);
+		double prefact = -G/(_r*_r*_r)*node->m;
+#ifdef QUADRUPOLE
+		double qprefact = G/(_r*_r*_r*_r*_r);
+		particles[pt].ax += qprefact*(dx*node->mxx + dy*node->mxy + dz*node->mxz); 
+		particles[pt].ay += qprefact*(dx*node->mxy + dy*node->myy + dz*node->myz); 
+		particles[pt].az += qprefact*(dx*node->mxz + dy*node->myz + dz*node->mzz); 
+		double mrr 	= dx*dx*node->mxx 	+ dy*dy*node->myy 	+ dz*dz*node->mzz
+				+ 2.*dx*dy*node->mxy 	+ 2.*dx*dz*node->mxz 	+ 2.*dy*dz*node->myz; 
+		qprefact *= -5.0/(2.0*_r*_r)*mrr;
+		particles[pt].ax += (qprefact + prefact) * dx; 
+		particles[pt].ay += (qprefact + prefact) * dy; 
+		particles[pt].az += (qprefact + prefact) * dz; 
+#else
+		particles[pt].ax += prefact*dx; 
+		particles[pt].ay += prefact*dy; 
+		particles[pt].az += prefact*dz; 
+#endif
+	} else { // It's a leaf node
+		double _r = sqrt(r2 + softening2);
+		double prefact = -G/(_r*_r*_r)*node->m;
+		particles[pt].ax += prefact*dx; 
+		particles[pt].ay += prefact*dy; 
+		particles[pt].az += prefact*dz; 
+	}
+}
+
+static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_simulation* r, const int pt, const struct reb_treecell *node, const struct reb_ghostbox gb) {
 	const double dx = gb.shiftx - node->mx;
 	const double dy = gb.shifty - node->my;
 	const double dz = gb.shiftz - node->mz;
@@ -717,32 +944,204 @@ static void reb_calculate_acceleration_for_particle_from_cell(const struct reb_s
 				}
 			}
 		} else {
-			double _r = sqrt(r2 + softening2);
-			double prefact = -G/(_r*_r*_r)*node->m;
-#ifdef QUADRUPOLE
-			double qprefact = G/(_r*_r*_r*_r*_r);
-			particles[pt].ax += qprefact*(dx*node->mxx + dy*node->mxy + dz*node->mxz); 
-			particles[pt].ay += qprefact*(dx*node->mxy + dy*node->myy + dz*node->myz); 
-			particles[pt].az += qprefact*(dx*node->mxz + dy*node->myz + dz*node->mzz); 
-			double mrr 	= dx*dx*node->mxx 	+ dy*dy*node->myy 	+ dz*dz*node->mzz
-					+ 2.*dx*dy*node->mxy 	+ 2.*dx*dz*node->mxz 	+ 2.*dy*dz*node->myz; 
-			qprefact *= -5.0/(2.0*_r*_r)*mrr;
-			particles[pt].ax += (qprefact + prefact) * dx; 
-			particles[pt].ay += (qprefact + prefact) * dy; 
-			particles[pt].az += (qprefact + prefact) * dz; 
-#else
-			particles[pt].ax += prefact*dx; 
-			particles[pt].ay += prefact*dy; 
-			particles[pt].az += prefact*dz; 
-#endif
+			reb_calculate_acceleration_for_particle_from_node(r, pt, node, dx, dy, dz, r2);
 		}
 	} else { // It's a leaf node
 		if (node->pt == pt) return;
-		double _r = sqrt(r2 + softening2);
-		double prefact = -G/(_r*_r*_r)*node->m;
-		particles[pt].ax += prefact*dx; 
-		particles[pt].ay += prefact*dy; 
-		particles[pt].az += prefact*dz; 
+		reb_calculate_acceleration_for_particle_from_node(r, pt, node, dx, dy, dz, r2);
+	}
+}
+
+/**
+ * @brief Appends an interaction to a buffer.
+ */
+static inline void reb_gravity_interaction_buffer_add(struct reb_gravity_interaction_buffer* const buffer, const struct reb_treecell* const node, const int g){
+	if (buffer->allocatedN<=buffer->N){
+		buffer->allocatedN = buffer->allocatedN?buffer->allocatedN*2:1024;
+		buffer->interactions = realloc(buffer->interactions,sizeof(struct reb_gravity_interaction)*buffer->allocatedN);
+	}
+	struct reb_gravity_interaction* const interaction = &(buffer->interactions[buffer->N++]);
+	interaction->node = node;
+	interaction->g = g;
+}
+
+/**
+ * @brief Same tree walk as reb_calculate_acceleration_for_particle_from_cell(), but saves the cells and leaves instead of summing up the forces.
+ */
+static void reb_gravity_interactions_for_particle_from_cell(const struct reb_simulation* const r, struct reb_gravity_interaction_buffer* const buffer, const int pt, const int g, const struct reb_treecell* const node, const struct reb_ghostbox gb){
+	const double dx = gb.shiftx - node->mx;
+	const double dy = gb.shifty - node->my;
+	const double dz = gb.shiftz - node->mz;
+	const double r2 = dx*dx + dy*dy + dz*dz;
+	if ( node->pt < 0 ) { // Not a leaf
+		if ( node->w*node->w > r->opening_angle2*r2 ){
+			for (int o=0; o<8; o++) {
+				if (node->oct[o] != NULL) {
+					reb_gravity_interactions_for_particle_from_cell(r, buffer, pt, g, node->oct[o], gb);
+				}
+			}
+		} else {
+			reb_gravity_interaction_buffer_add(buffer, node, g);
+		}
+	} else { // It's a leaf node
+		if (node->pt == pt) return;
+		reb_gravity_interaction_buffer_add(buffer, node, g);
 	}
 }
 
+void reb_gravity_interactions_build(struct reb_simulation* const r){
+	if (r->gravity_interactions==NULL){
+		r->gravity_interactions = calloc(1,sizeof(struct reb_gravity_interactions));
+	}
+	struct reb_gravity_interactions* const n = r->gravity_interactions;
+	const int N = r->N;
+#ifdef OPENMP
+	const int threads_N = omp_get_max_threads();
+#else // OPENMP
+	const int threads_N = 1;
+#endif // OPENMP
+	if (n->buffers_N<threads_N){
+		n->buffers = realloc(n->buffers,sizeof(struct reb_gravity_interaction_buffer)*threads_N);
+		for (int t=n->buffers_N;t<threads_N;t++){
+			n->buffers[t].interactions = NULL;
+			n->buffers[t].allocatedN = 0;
+		}
+		n->buffers_N = threads_N;
+	}
+	for (int t=0;t<n->buffers_N;t++){
+		n->buffers[t].N = 0;
+	}
+	if (n->allocatedN<N){
+		n->allocatedN = N;
+		n->buffer = realloc(n->buffer,sizeof(int)*N);
+		n->start = realloc(n->start,sizeof(int)*N);
+		n->end = realloc(n->end,sizeof(int)*N);
+	}
+	n->N = N;
+	n->nghost[0] = r->nghostx;
+	n->nghost[1] = r->nghosty;
+	n->nghost[2] = r->nghostz;
+	const int nghostx = r->nghostx;
+	const int nghosty = r->nghosty;
+	const int nghostz = r->nghostz;
+	struct reb_particle* const particles = r->particles;
+#pragma omp parallel
+	{
+#ifdef OPENMP
+	const int thread = omp_get_thread_num();
+#else // OPENMP
+	const int thread = 0;
+#endif // OPENMP
+	struct reb_gravity_interaction_buffer* const buffer = &(n->buffers[thread]);
+#pragma omp for schedule(guided)
+	for (int i=0; i<N; i++){
+		n->buffer[i] = thread;
+		n->start[i] = buffer->N;
+		// Same order as in reb_calculate_acceleration()
+		int g = 0;
+		for (int gbx=-nghostx; gbx<=nghostx; gbx++){
+		for (int gby=-nghosty; gby<=nghosty; gby++){
+		for (int gbz=-nghostz; gbz<=nghostz; gbz++){
+			struct reb_ghostbox gb = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+			gb.shiftx += particles[i].x;
+			gb.shifty += particles[i].y;
+			gb.shiftz += particles[i].z;
+			for(int k=0;k<r->root_n;k++){
+				struct reb_treecell* node = r->tree_root[k];
+				if (node!=NULL){
+					reb_gravity_interactions_for_particle_from_cell(r, buffer, i, g, node, gb);
+				}
+			}
+			g++;
+		}
+		}
+		}
+		n->end[i] = buffer->N;
+	}
+	}
+}
+
+void reb_calculate_acceleration_from_interactions(struct reb_simulation* const r){
+	struct reb_gravity_interactions* const n = r->gravity_interactions;
+	if (n==NULL || n->N!=r->N){
+		reb_exit("Interaction lists are not up to date.");
+	}
+	reb_tree_update_gravity_data(r);
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	// The ghost boxes need to be recalculated if they move with time (shear periodic boundaries).
+	const int ghostboxes_N = (2*n->nghost[0]+1)*(2*n->nghost[1]+1)*(2*n->nghost[2]+1);
+	struct reb_ghostbox* const gbs = malloc(sizeof(struct reb_ghostbox)*ghostboxes_N);
+	int g = 0;
+	for (int gbx=-n->nghost[0]; gbx<=n->nghost[0]; gbx++){
+	for (int gby=-n->nghost[1]; gby<=n->nghost[1]; gby++){
+	for (int gbz=-n->nghost[2]; gbz<=n->nghost[2]; gbz++){
+		gbs[g++] = reb_boundary_get_ghostbox(r, gbx,gby,gbz);
+	}
+	}
+	}
+#pragma omp parallel for schedule(guided)
+	for (int i=0; i<N; i++){
+		particles[i].ax = 0; 
+		particles[i].ay = 0; 
+		particles[i].az = 0; 
+		const struct reb_gravity_interaction* const interactions = n->buffers[n->buffer[i]].interactions;
+		for (int k=n->start[i]; k<n->end[i]; k++){
+			const struct reb_treecell* const node = interactions[k].node;
+			const struct reb_ghostbox gb = gbs[interactions[k].g];
+			const double dx = gb.shiftx + particles[i].x - node->mx;
+			const double dy = gb.shifty + particles[i].y - node->my;
+			const double dz = gb.shiftz + particles[i].z - node->mz;
+			const double r2 = dx*dx + dy*dy + dz*dz;
+			reb_calculate_acceleration_for_particle_from_node(r, i, node, dx, dy, dz, r2);
+		}
+	}
+	free(gbs);
+}
+
+void reb_gravity_interactions_free(struct reb_simulation* const r){
+	struct reb_gravity_interactions* const n = r->gravity_interactions;
+	if (n==NULL) return;
+	for (int t=0;t<n->buffers_N;t++){
+		free(n->buffers[t].interactions);
+	}
+	free(n->buffers);
+	free(n->buffer);
+	free(n->start);
+	free(n->end);
+	free(n);
+	r->gravity_interactions = NULL;
+}
+
+static void reb_calculate_acceleration_and_neighbours_for_particle_from_cell(struct reb_simulation* const r, struct reb_collision_pair_buffer* const buffer, const int pt, const int g, const double rr, const struct reb_treecell* const node, const struct reb_ghostbox gb){
+	if (node->pt >= 0){ // It's a leaf node
+		reb_calculate_acceleration_for_particle_from_cell(r, pt, node, gb);
+		reb_collision_neighbours_tree_walk(r, buffer, pt, g, gb.shiftx, gb.shifty, gb.shiftz, rr, node);
+		return;
+	}
+	// Same criterion as in reb_collision_neighbours_tree_walk()
+	const double cx = gb.shiftx - node->x;
+	const double cy = gb.shifty - node->y;
+	const double cz = gb.shiftz - node->z;
+	const double rp = rr + node->rmax + 0.86602540378443*node->w;
+	if (!(cx*cx+cy*cy+cz*cz<rp*rp)){
+		// No particles close enough in this cell.
+		reb_calculate_acceleration_for_particle_from_cell(r, pt, node, gb);
+		return;
+	}
+	const double dx = gb.shiftx - node->mx;
+	const double dy = gb.shifty - node->my;
+	const double dz = gb.shiftz - node->mz;
+	const double r2 = dx*dx + dy*dy + dz*dz;
+	if ( node->w*node->w > r->opening_angle2*r2 ){
+		for (int o=0; o<8; o++) {
+			if (node->oct[o] != NULL) {
+				reb_calculate_acceleration_and_neighbours_for_particle_from_cell(r, buffer, pt, g, rr, node->oct[o], gb);
+			}
+		}
+	}else{
+		// The cell is far enough away for its multipole, but its particles still need to be searched for pairs.
+		reb_calculate_acceleration_for_particle_from_cell(r, pt, node, gb);
+		reb_collision_neighbours_tree_walk(r, buffer, pt, g, gb.shiftx, gb.shifty, gb.shiftz, rr, node);
+	}
+}
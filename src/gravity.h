@@ -38,4 +38,75 @@ void reb_calculate_acceleration(struct reb_simulation* r);
   */
 void reb_calculate_acceleration_var(struct reb_simulation* r);
 
+/**
+  * Calculates the gravitational acceleration of the particles index[0] ... index[index_N-1] only.
+  * The accelerations of all other particles are not changed. Used by integrators
+  * with individual timesteps. Only REB_GRAVITY_NONE, REB_GRAVITY_BASIC and REB_GRAVITY_TREE 
+  * are supported. For REB_GRAVITY_TREE, the tree needs to be up to date, including its gravity data.
+  */
+void reb_calculate_acceleration_for_particles(struct reb_simulation* r, const int* const index, const int index_N);
+
+/**
+  * Calculates the gravitational acceleration with REB_GRAVITY_TREE and, if needed, rebuilds 
+  * the neighbour list of REB_COLLISION_TREE in the same tree walk. The tree needs to be
+  * up to date, including its gravity data. Not supported with MPI.
+  */
+void reb_calculate_acceleration_and_collision_neighbours(struct reb_simulation* r);
+
+/**
+  * @brief A cell or a leaf in the interaction list of a particle.
+  */
+struct reb_gravity_interaction {
+	const struct reb_treecell* node;	///< Cell which is not opened, or leaf.
+	int g;					///< Index of the ghost box.
+};
+
+/**
+  * @brief Interactions found by one thread while building the interaction lists.
+  */
+struct reb_gravity_interaction_buffer {
+	struct reb_gravity_interaction* interactions;	///< Interactions of all particles handled by the thread.
+	int N;						///< Number of interactions.
+	int allocatedN;					///< Size allocated for interactions.
+};
+
+/**
+  * @brief Interaction lists of REB_GRAVITY_TREE.
+  * @details For every particle, the list contains the cells and leaves the tree walk
+  * has summed over. The forces can then be recalculated for slightly different 
+  * positions without walking the tree again, as long as the structure of the tree
+  * does not change. Cells and particles are referred to by the tree cells, so
+  * that the multipole moments can be updated with reb_tree_update_gravity_data().
+  */
+struct reb_gravity_interactions {
+	struct reb_gravity_interaction_buffer* buffers;	///< One buffer per thread.
+	int buffers_N;					///< Number of buffers.
+	int* buffer;					///< Buffer containing the interactions of each particle.
+	int* start;					///< Index of the first interaction of each particle in its buffer.
+	int* end;					///< Index after the last interaction of each particle in its buffer.
+	int N;						///< Number of particles when the lists were built.
+	int allocatedN;					///< Size allocated for buffer, start and end.
+	int nghost[3];					///< Number of ghost boxes in each direction when the lists were built.
+};
+
+/**
+  * Walks the tree for every particle and saves the cells and leaves it interacts with in
+  * r->gravity_interactions. The accelerations are not changed. The tree needs to be up 
+  * to date, including its gravity data. Not supported with MPI.
+  */
+void reb_gravity_interactions_build(struct reb_simulation* const r);
+
+/**
+  * Calculates the gravitational acceleration of all particles from the interaction lists 
+  * built by reb_gravity_interactions_build(). The multipole moments of the tree cells are 
+  * first updated to the current particle positions. The structure of the tree must not 
+  * have changed since the lists were built.
+  */
+void reb_calculate_acceleration_from_interactions(struct reb_simulation* const r);
+
+/**
+  * Frees the interaction lists.
+  */
+void reb_gravity_interactions_free(struct reb_simulation* const r);
+
 #endif
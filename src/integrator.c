@@ -34,7 +34,7 @@
 #include <time.h>
 #include "rebound.h"
 #include "gravity.h"
-#include "output.h"
+#include "profiling.h"
 #include "integrator.h"
 #include "integrator_whfast.h"
 #include "integrator_ias15.h"
@@ -131,13 +131,13 @@ void reb_integrator_reset(struct reb_simulation* r){
 
 void reb_update_acceleration(struct reb_simulation* r){
 	// This should probably go elsewhere
-	PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
-	PROFILING_START()
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY_WALK)
 	reb_calculate_acceleration(r);
 	if (r->N_var){
 		reb_calculate_acceleration_var(r);
 	}
 	if (r->additional_forces) r->additional_forces(r);
-	PROFILING_STOP(PROFILING_CAT_GRAVITY)
-	PROFILING_START()
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
 }
@@ -52,6 +52,7 @@ void integrator_generate_constants(void);
 #include "tools.h"
 #include "integrator.h"
 #include "integrator_ias15.h"
+#include "profiling.h"
 
 /**
  * @brief Struct containing pointers to intermediate values
@@ -76,6 +77,13 @@ static void predict_next_step(double ratio, int N3,  const struct reb_dpconst7 _
 
 static const double safety_factor 			= 0.25;	/**< Maximum increase/deacrease of consecutve timesteps. */
 
+/**
+ * @brief Minimum number of particles for which the loops over particles are distributed over OpenMP threads.
+ * @details For fewer particles, the overhead of starting a parallel region 
+ * in every substep is larger than the time spent in the loops.
+ */
+#define REB_IAS15_OPENMP_N 256
+
 // Gauss Radau spacings
 static const double h[8]	= { 0.0, 0.0562625605369221464656521910, 0.1802406917368923649875799428, 0.3526247171131696373739077702, 0.5471536263305553830014485577, 0.7342101772154105410531523211, 0.8853209468390957680903597629, 0.9775206135612875018911745004}; 
 // Other constants
@@ -87,14 +95,16 @@ static const double d[21] = {0.0562625605369221464656522, 0.00316547571817082924
 static const double w[8] = {0.03125, 0.185358154802979278540728972807180754479812609, 0.304130620646785128975743291458180383736715043, 0.376517545389118556572129261157225608762708603, 0.391572167452493593082499533303669362149363727, 0.347014795634501068709955597003528601733139176, 0.249647901329864963257869294715235590174262844, 0.114508814744257199342353731044292225247093225};
 
 
-static void free_dp7(struct reb_dp7* dp7){
-	free(dp7->p0);
-	free(dp7->p1);
-	free(dp7->p2);
-	free(dp7->p3);
-	free(dp7->p4);
-	free(dp7->p5);
-	free(dp7->p6);
+static void set_dp7(struct reb_dp7* const dp7, double* const p, const int stride){
+	dp7->p0 = p;
+	dp7->p1 = p+1*stride;
+	dp7->p2 = p+2*stride;
+	dp7->p3 = p+3*stride;
+	dp7->p4 = p+4*stride;
+	dp7->p5 = p+5*stride;
+	dp7->p6 = p+6*stride;
+}
+static void set_dp7_null(struct reb_dp7* const dp7){
 	dp7->p0 = NULL;
 	dp7->p1 = NULL;
 	dp7->p2 = NULL;
@@ -114,15 +124,43 @@ static void clear_dp7(struct reb_dp7* const dp7, const int N3){
 		dp7->p6[k] = 0.;
 	}
 }
-static void realloc_dp7(struct reb_dp7* const dp7, const int N3){
-	dp7->p0 = realloc(dp7->p0,sizeof(double)*N3);
-	dp7->p1 = realloc(dp7->p1,sizeof(double)*N3);
-	dp7->p2 = realloc(dp7->p2,sizeof(double)*N3);
-	dp7->p3 = realloc(dp7->p3,sizeof(double)*N3);
-	dp7->p4 = realloc(dp7->p4,sizeof(double)*N3);
-	dp7->p5 = realloc(dp7->p5,sizeof(double)*N3);
-	dp7->p6 = realloc(dp7->p6,sizeof(double)*N3);
-    clear_dp7(dp7,N3);
+
+/**
+ * @brief Makes sure the arena has space for N3 components in every array.
+ * @details All 51 arrays are stored in one allocation, each one in a 
+ * contiguous segment of arena_allocatedN components. Segments are padded to 
+ * a multiple of 64 bytes so that every array is aligned to a cache line.
+ * Arrays that are used together in the same loop are next to each other.
+ * The capacity grows geometrically, so that adding particles one by one 
+ * does not trigger an allocation every time.
+ */
+static void reb_integrator_ias15_alloc(struct reb_simulation* const r, const int N3){
+	struct reb_simulation_integrator_ias15* const ri_ias15 = &(r->ri_ias15);
+	if (N3 <= ri_ias15->arena_allocatedN) return;
+	int n = 2*ri_ias15->arena_allocatedN;
+	if (n<N3) n = N3;
+	n = (n+7)&~7;
+	free(ri_ias15->arena);  // Content does not need to be preserved.
+	if (posix_memalign((void**)&(ri_ias15->arena), 64, sizeof(double)*51*n)){
+		reb_exit("Cannot allocate memory for IAS15.");
+	}
+	ri_ias15->arena_allocatedN = n;
+	double* p = ri_ias15->arena;
+	ri_ias15->x0   = p; p += n;
+	ri_ias15->v0   = p; p += n;
+	ri_ias15->a0   = p; p += n;
+	ri_ias15->csx  = p; p += n;
+	ri_ias15->csv  = p; p += n;
+	ri_ias15->csa0 = p; p += n;
+	ri_ias15->at   = p; p += n;
+	ri_ias15->xd   = p; p += n;
+	ri_ias15->vd   = p; p += n;
+	set_dp7(&(ri_ias15->b),   p, n); p += 7*n;
+	set_dp7(&(ri_ias15->csb), p, n); p += 7*n;
+	set_dp7(&(ri_ias15->g),   p, n); p += 7*n;
+	set_dp7(&(ri_ias15->e),   p, n); p += 7*n;
+	set_dp7(&(ri_ias15->br),  p, n); p += 7*n;
+	set_dp7(&(ri_ias15->er),  p, n);
 }
 
 static struct reb_dpconst7 dpcast(struct reb_dp7 dp){
@@ -144,53 +182,129 @@ static inline void add_cs(double* p, double* csp, double inp){
 	*csp = (t - *p) - y;
 	*p = t;
 }
- 
-// Does the actual timestep.
-static int reb_integrator_ias15_step(struct reb_simulation* r) {
-	struct reb_particle* const particles = r->particles;
+
+/**
+ * @brief Difference of the acceleration at an intermediate step to the one at the beginning of the step.
+ * @param at Acceleration at the intermediate step.
+ * @param at_cs Compensated summation coefficient of at (0 if gravity is not compensated).
+ * @param a0 Acceleration at the beginning of the step.
+ * @param csa0 Compensated summation coefficient of a0.
+ */
+static inline double reb_integrator_ias15_gk(const double at, const double at_cs, const double a0, const double csa0){
+	double gk = at;
+	double gk_cs = at_cs;
+	add_cs(&gk, &gk_cs, -a0);
+	add_cs(&gk, &gk_cs, csa0);
+	return gk;
+}
+
+/**
+ * @brief Improves the g and b values of component k using the acceleration at intermediate step n.
+ * @details Called with a constant n from within the loops over components, so 
+ * that the switch is resolved at compile time.
+ * @param n Intermediate step (1-7).
+ * @param k Component.
+ * @param gk Acceleration difference, see reb_integrator_ias15_gk().
+ * @param g g values.
+ * @param b b values.
+ * @param csb Compensated summation coefficients of b.
+ * @return Change of g at step n. After the last step, this is the change of b6.
+ */
+static inline double reb_integrator_ias15_correct_component(const int n, const int k, const double gk, const struct reb_dpconst7 g, const struct reb_dpconst7 b, const struct reb_dpconst7 csb){
+	double tmp = 0.;
+	switch (n) {
+		case 1: 
+			tmp = g.p0[k];
+			g.p0[k]  = gk/rr[0];
+			tmp = g.p0[k] - tmp;
+			add_cs(&(b.p0[k]), &(csb.p0[k]), tmp);
+			break;
+		case 2: 
+			tmp = g.p1[k];
+			g.p1[k] = (gk/rr[1] - g.p0[k])/rr[2];
+			tmp = g.p1[k] - tmp;
+			add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[0]);
+			add_cs(&(b.p1[k]), &(csb.p1[k]), tmp);
+			break;
+		case 3: 
+			tmp = g.p2[k];
+			g.p2[k] = ((gk/rr[3] - g.p0[k])/rr[4] - g.p1[k])/rr[5];
+			tmp = g.p2[k] - tmp;
+			add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[1]);
+			add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[2]);
+			add_cs(&(b.p2[k]), &(csb.p2[k]), tmp);
+			break;
+		case 4:
+			tmp = g.p3[k];
+			g.p3[k] = (((gk/rr[6] - g.p0[k])/rr[7] - g.p1[k])/rr[8] - g.p2[k])/rr[9];
+			tmp = g.p3[k] - tmp;
+			add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[3]);
+			add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[4]);
+			add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[5]);
+			add_cs(&(b.p3[k]), &(csb.p3[k]), tmp);
+			break;
+		case 5:
+			tmp = g.p4[k];
+			g.p4[k] = ((((gk/rr[10] - g.p0[k])/rr[11] - g.p1[k])/rr[12] - g.p2[k])/rr[13] - g.p3[k])/rr[14];
+			tmp = g.p4[k] - tmp;
+			add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[6]);
+			add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[7]);
+			add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[8]);
+			add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[9]);
+			add_cs(&(b.p4[k]), &(csb.p4[k]), tmp);
+			break;
+		case 6:
+			tmp = g.p5[k];
+			g.p5[k] = (((((gk/rr[15] - g.p0[k])/rr[16] - g.p1[k])/rr[17] - g.p2[k])/rr[18] - g.p3[k])/rr[19] - g.p4[k])/rr[20];
+			tmp = g.p5[k] - tmp;
+			add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[10]);
+			add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[11]);
+			add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[12]);
+			add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[13]);
+			add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[14]);
+			add_cs(&(b.p5[k]), &(csb.p5[k]), tmp);
+			break;
+		case 7:
+			tmp = g.p6[k];
+			g.p6[k] = ((((((gk/rr[21] - g.p0[k])/rr[22] - g.p1[k])/rr[23] - g.p2[k])/rr[24] - g.p3[k])/rr[25] - g.p4[k])/rr[26] - g.p5[k])/rr[27];
+			tmp = g.p6[k] - tmp;	
+			add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[15]);
+			add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[16]);
+			add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[17]);
+			add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[18]);
+			add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[19]);
+			add_cs(&(b.p5[k]), &(csb.p5[k]), tmp * c[20]);
+			add_cs(&(b.p6[k]), &(csb.p6[k]), tmp);
+			break;
+	}
+	return tmp;
+}
+
+// The following functions contain the loops over all particles of one step.
+// The loops are shared among the threads of the calling team (orphaned 
+// OpenMP worksharing) and run serially if called outside of a parallel 
+// region. Each component is calculated with the same floating point 
+// operations in the same order, independent of the number of threads and 
+// of vectorization. Results, including compensated summation, are therefore
+// identical to the serial version.
+
+/**
+ * @brief Saves the initial positions, velocities and accelerations and initializes g from the predicted b values.
+ */
+static void reb_integrator_ias15_begin(struct reb_simulation* const r){
+	const struct reb_particle* const particles = r->particles;
 	const int N = r->N;
 	const int N3 = 3*N;
-	if (N3 > r->ri_ias15.allocatedN) {
-		realloc_dp7(&(r->ri_ias15.g),N3);
-		realloc_dp7(&(r->ri_ias15.b),N3);
-		realloc_dp7(&(r->ri_ias15.csb),N3);
-		realloc_dp7(&(r->ri_ias15.e),N3);
-		realloc_dp7(&(r->ri_ias15.br),N3);
-		realloc_dp7(&(r->ri_ias15.er),N3);
-		r->ri_ias15.at = realloc(r->ri_ias15.at,sizeof(double)*N3);
-		r->ri_ias15.x0 = realloc(r->ri_ias15.x0,sizeof(double)*N3);
-		r->ri_ias15.v0 = realloc(r->ri_ias15.v0,sizeof(double)*N3);
-		r->ri_ias15.a0 = realloc(r->ri_ias15.a0,sizeof(double)*N3);
-		r->ri_ias15.csx= realloc(r->ri_ias15.csx,sizeof(double)*N3);
-		r->ri_ias15.csv= realloc(r->ri_ias15.csv,sizeof(double)*N3);
-		r->ri_ias15.csa0 = realloc(r->ri_ias15.csa0,sizeof(double)*N3);
-		double* restrict const csx = r->ri_ias15.csx; 
-		double* restrict const csv = r->ri_ias15.csv; 
-		for (int i=0;i<N3;i++){
-			// Kill compensated summation coefficients
-			csx[i] = 0;
-			csv[i] = 0;
-		}
-		r->ri_ias15.allocatedN = N3;
-	}
-	
-	// reb_update_acceleration(); // Not needed. Forces are already calculated in main routine.
-	
-	double s[9];				// Summation coefficients 
-	double* restrict const csx = r->ri_ias15.csx; 
-	double* restrict const csv = r->ri_ias15.csv; 
-	double* restrict const csa0 = r->ri_ias15.csa0; 
-	double* restrict const at = r->ri_ias15.at; 
 	double* restrict const x0 = r->ri_ias15.x0; 
 	double* restrict const v0 = r->ri_ias15.v0; 
 	double* restrict const a0 = r->ri_ias15.a0; 
-	struct reb_vec3d* gravity_cs = r->gravity_cs; 
+	double* restrict const csa0 = r->ri_ias15.csa0; 
+	const struct reb_vec3d* const gravity_cs = r->gravity_cs; 
+	const int compensated = (r->gravity==REB_GRAVITY_COMPENSATED);
 	const struct reb_dpconst7 g  = dpcast(r->ri_ias15.g);
-	const struct reb_dpconst7 e  = dpcast(r->ri_ias15.e);
 	const struct reb_dpconst7 b  = dpcast(r->ri_ias15.b);
 	const struct reb_dpconst7 csb= dpcast(r->ri_ias15.csb);
-	const struct reb_dpconst7 er = dpcast(r->ri_ias15.er);
-	const struct reb_dpconst7 br = dpcast(r->ri_ias15.br);
+#pragma omp for
 	for(int k=0;k<N;k++) {
 		x0[3*k]   = particles[k].x;
 		x0[3*k+1] = particles[k].y;
@@ -201,21 +315,18 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
 		a0[3*k]   = particles[k].ax;
 		a0[3*k+1] = particles[k].ay; 
 		a0[3*k+2] = particles[k].az;
-	}
-	if (r->gravity==REB_GRAVITY_COMPENSATED){
-		for(int k=0;k<N;k++) {
+		if (compensated){
 			csa0[3*k]   = gravity_cs[k].x;
 			csa0[3*k+1] = gravity_cs[k].y;  
 			csa0[3*k+2] = gravity_cs[k].z;
-		}
-	}else{
-		gravity_cs = (struct reb_vec3d*)csa0; // Always 0.
-		for(int k=0;k<N3;k++) {
-			csa0[k]   = 0;
+		}else{
+			csa0[3*k]   = 0;
+			csa0[3*k+1] = 0;
+			csa0[3*k+2] = 0;
 		}
 	}
-	for (int k=0;k<N3;k++){
-		// Memset might be faster!
+#pragma omp for simd
+	for(int k=0;k<N3;k++) {
 		csb.p0[k] = 0.;
 		csb.p1[k] = 0.;
 		csb.p2[k] = 0.;
@@ -223,9 +334,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
 		csb.p4[k] = 0.;
 		csb.p5[k] = 0.;
 		csb.p6[k] = 0.;
-	}
 
-	for(int k=0;k<N3;k++) {
 		g.p0[k] = b.p6[k]*d[15] + b.p5[k]*d[10] + b.p4[k]*d[6] + b.p3[k]*d[3]  + b.p2[k]*d[1]  + b.p1[k]*d[0]  + b.p0[k];
 		g.p1[k] = b.p6[k]*d[16] + b.p5[k]*d[11] + b.p4[k]*d[7] + b.p3[k]*d[4]  + b.p2[k]*d[2]  + b.p1[k];
 		g.p2[k] = b.p6[k]*d[17] + b.p5[k]*d[12] + b.p4[k]*d[8] + b.p3[k]*d[5]  + b.p2[k];
@@ -234,6 +343,350 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
 		g.p5[k] = b.p6[k]*d[20] + b.p5[k];
 		g.p6[k] = b.p6[k];
 	}
+}
+
+/**
+ * @brief Predicts positions (and velocities) at an intermediate step using the b values.
+ * @details Positions and velocities are predicted in the same loop, so that b is only read once.
+ * @param r REBOUND simulation to operate on
+ * @param s Summation coefficients for positions.
+ * @param sv Summation coefficients for velocities.
+ * @param predict_velocities Set to 1 if velocities are needed for the force calculation.
+ */
+static void reb_integrator_ias15_predict(struct reb_simulation* const r, const double* const s, const double* const sv, const int predict_velocities){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const double* restrict const csx = r->ri_ias15.csx; 
+	const double* restrict const csv = r->ri_ias15.csv; 
+	const double* restrict const x0 = r->ri_ias15.x0; 
+	const double* restrict const v0 = r->ri_ias15.v0; 
+	const double* restrict const a0 = r->ri_ias15.a0; 
+	const struct reb_dpconst7 b  = dpcast(r->ri_ias15.b);
+#pragma omp for
+	for(int i=0;i<N;i++) {						// Predict positions at interval n using b values
+		const int k0 = 3*i+0;
+		const int k1 = 3*i+1;
+		const int k2 = 3*i+2;
+
+		double xk0  = -csx[k0] + (s[8]*b.p6[k0] + s[7]*b.p5[k0] + s[6]*b.p4[k0] + s[5]*b.p3[k0] + s[4]*b.p2[k0] + s[3]*b.p1[k0] + s[2]*b.p0[k0] + s[1]*a0[k0] + s[0]*v0[k0] );
+		particles[i].x = xk0 + x0[k0];
+		double xk1  = -csx[k1] + (s[8]*b.p6[k1] + s[7]*b.p5[k1] + s[6]*b.p4[k1] + s[5]*b.p3[k1] + s[4]*b.p2[k1] + s[3]*b.p1[k1] + s[2]*b.p0[k1] + s[1]*a0[k1] + s[0]*v0[k1] );
+		particles[i].y = xk1 + x0[k1];
+		double xk2  = -csx[k2] + (s[8]*b.p6[k2] + s[7]*b.p5[k2] + s[6]*b.p4[k2] + s[5]*b.p3[k2] + s[4]*b.p2[k2] + s[3]*b.p1[k2] + s[2]*b.p0[k2] + s[1]*a0[k2] + s[0]*v0[k2] );
+		particles[i].z = xk2 + x0[k2];
+
+		if (predict_velocities){					// Predict velocities at interval n using b values
+			double vk0 =  -csv[k0] + sv[7]*b.p6[k0] + sv[6]*b.p5[k0] + sv[5]*b.p4[k0] + sv[4]*b.p3[k0] + sv[3]*b.p2[k0] + sv[2]*b.p1[k0] + sv[1]*b.p0[k0] + sv[0]*a0[k0];
+			particles[i].vx = vk0 + v0[k0];
+			double vk1 =  -csv[k1] + sv[7]*b.p6[k1] + sv[6]*b.p5[k1] + sv[5]*b.p4[k1] + sv[4]*b.p3[k1] + sv[3]*b.p2[k1] + sv[2]*b.p1[k1] + sv[1]*b.p0[k1] + sv[0]*a0[k1];
+			particles[i].vy = vk1 + v0[k1];
+			double vk2 =  -csv[k2] + sv[7]*b.p6[k2] + sv[6]*b.p5[k2] + sv[5]*b.p4[k2] + sv[4]*b.p3[k2] + sv[3]*b.p2[k2] + sv[2]*b.p1[k2] + sv[1]*b.p0[k2] + sv[0]*a0[k2];
+			particles[i].vz = vk2 + v0[k2];
+		}
+	}
+}
+
+/**
+ * @brief Improves the g and b values using the accelerations at intermediate step n.
+ * @details After the last intermediate step, the largest acceleration, the largest 
+ * change of b6 and the largest fractional change of b6 are merged into maxak, 
+ * maxb6ktmp and maxerror. These have to be shared among all threads and set to 
+ * zero by the caller.
+ */
+static void reb_integrator_ias15_correct(struct reb_simulation* const r, const int n, double* const maxak, double* const maxb6ktmp, double* const maxerror){
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const int N3 = 3*N;
+	double* restrict const at = r->ri_ias15.at; 
+	const double* restrict const a0 = r->ri_ias15.a0; 
+	const double* restrict const csa0 = r->ri_ias15.csa0; 
+	// Compensated summation coefficients of the accelerations (always 0 if gravity is not compensated).
+	const double* restrict const gravity_cs = (r->gravity==REB_GRAVITY_COMPENSATED)?(const double*)r->gravity_cs:csa0; 
+	const struct reb_dpconst7 g  = dpcast(r->ri_ias15.g);
+	const struct reb_dpconst7 b  = dpcast(r->ri_ias15.b);
+	const struct reb_dpconst7 csb= dpcast(r->ri_ias15.csb);
+#pragma omp for
+	for(int k=0;k<N;++k) {
+		at[3*k]   = particles[k].ax;
+		at[3*k+1] = particles[k].ay;  
+		at[3*k+2] = particles[k].az;
+	}
+	switch (n) {							// Improve b and g values
+		case 1:
+#pragma omp for simd
+			for(int k=0;k<N3;++k) {
+				reb_integrator_ias15_correct_component(1, k, reb_integrator_ias15_gk(at[k], gravity_cs[k], a0[k], csa0[k]), g, b, csb);
+			} break;
+		case 2:
+#pragma omp for simd
+			for(int k=0;k<N3;++k) {
+				reb_integrator_ias15_correct_component(2, k, reb_integrator_ias15_gk(at[k], gravity_cs[k], a0[k], csa0[k]), g, b, csb);
+			} break;
+		case 3:
+#pragma omp for simd
+			for(int k=0;k<N3;++k) {
+				reb_integrator_ias15_correct_component(3, k, reb_integrator_ias15_gk(at[k], gravity_cs[k], a0[k], csa0[k]), g, b, csb);
+			} break;
+		case 4:
+#pragma omp for simd
+			for(int k=0;k<N3;++k) {
+				reb_integrator_ias15_correct_component(4, k, reb_integrator_ias15_gk(at[k], gravity_cs[k], a0[k], csa0[k]), g, b, csb);
+			} break;
+		case 5:
+#pragma omp for simd
+			for(int k=0;k<N3;++k) {
+				reb_integrator_ias15_correct_component(5, k, reb_integrator_ias15_gk(at[k], gravity_cs[k], a0[k], csa0[k]), g, b, csb);
+			} break;
+		case 6:
+#pragma omp for simd
+			for(int k=0;k<N3;++k) {
+				reb_integrator_ias15_correct_component(6, k, reb_integrator_ias15_gk(at[k], gravity_cs[k], a0[k], csa0[k]), g, b, csb);
+			} break;
+		case 7:
+		{
+			const int epsilon_global = r->ri_ias15.epsilon_global;
+			// Maxima of this thread.
+			double _maxak = 0.0;
+			double _maxb6ktmp = 0.0;
+			double _maxerror = 0.0;
+#pragma omp for nowait
+			for(int k=0;k<N3;++k) {
+				const double tmp = reb_integrator_ias15_correct_component(7, k, reb_integrator_ias15_gk(at[k], gravity_cs[k], a0[k], csa0[k]), g, b, csb);
+				
+				// Monitor change in b.p6[k] relative to at[k]. The predictor corrector scheme is converged if it is close to 0.
+				if (epsilon_global){
+					const double ak  = fabs(at[k]);
+					if (isnormal(ak) && ak>_maxak){
+						_maxak = ak;
+					}
+					const double b6ktmp = fabs(tmp);  // change of b6ktmp coefficient
+					if (isnormal(b6ktmp) && b6ktmp>_maxb6ktmp){
+						_maxb6ktmp = b6ktmp;
+					}
+				}else{
+					const double ak  = at[k];
+					const double b6ktmp = tmp; 
+					const double errork = fabs(b6ktmp/ak);
+					if (isnormal(errork) && errork>_maxerror){
+						_maxerror = errork;
+					}
+				}
+			} 
+#pragma omp critical (reb_integrator_ias15)
+			{
+				if (_maxak>*maxak) *maxak = _maxak;
+				if (_maxb6ktmp>*maxb6ktmp) *maxb6ktmp = _maxb6ktmp;
+				if (_maxerror>*maxerror) *maxerror = _maxerror;
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Finds the largest acceleration, the largest b6 and the largest fractional b6 (error estimate).
+ * @details The maxima are merged into maxak, maxb6k and maxerror. These have 
+ * to be shared among all threads and set to zero by the caller.
+ */
+static void reb_integrator_ias15_error(struct reb_simulation* const r, double* const maxak, double* const maxb6k, double* const maxerror){
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const double* restrict const at = r->ri_ias15.at; 
+	const double* restrict const b6 = r->ri_ias15.b.p6; 
+	// Maxima of this thread.
+	double _maxak = 0.0;
+	double _maxb6k = 0.0;
+	double _maxerror = 0.0;
+	if (r->ri_ias15.epsilon_global){
+#pragma omp for nowait
+		for(int i=0;i<N;i++){ // Looping over all particles and all 3 components of the acceleration. 
+			const double v2 = particles[i].vx*particles[i].vx+particles[i].vy*particles[i].vy+particles[i].vz*particles[i].vz;
+			const double x2 = particles[i].x*particles[i].x+particles[i].y*particles[i].y+particles[i].z*particles[i].z;
+			// Skip slowly varying accelerations
+			if (fabs(v2*r->dt*r->dt/x2) < 1e-16) continue;
+			for(int k=3*i;k<3*(i+1);k++) { 
+				const double ak  = fabs(at[k]);
+				if (isnormal(ak) && ak>_maxak){
+					_maxak = ak;
+				}
+				const double b6k = fabs(b6[k]); 
+				if (isnormal(b6k) && b6k>_maxb6k){
+					_maxb6k = b6k;
+				}
+			}
+		}
+	}else{
+#pragma omp for nowait
+		for(int k=0;k<3*N;k++) {
+			const double ak  = at[k];
+			const double b6k = b6[k]; 
+			const double errork = fabs(b6k/ak);
+			if (isnormal(errork) && errork>_maxerror){
+				_maxerror = errork;
+			}
+		}
+	}
+#pragma omp critical (reb_integrator_ias15)
+	{
+		if (_maxak>*maxak) *maxak = _maxak;
+		if (_maxb6k>*maxb6k) *maxb6k = _maxb6k;
+		if (_maxerror>*maxerror) *maxerror = _maxerror;
+	}
+}
+
+/**
+ * @brief Finds the new positions and velocities at the end of the step and predicts the b values for the next step.
+ * @param r REBOUND simulation to operate on
+ * @param dt_done Timestep that has been done.
+ * @param ratio Ratio of the next to the current timestep.
+ */
+static void reb_integrator_ias15_finish(struct reb_simulation* const r, const double dt_done, const double ratio){
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const int N3 = 3*N;
+	double* restrict const csx = r->ri_ias15.csx; 
+	double* restrict const csv = r->ri_ias15.csv; 
+	double* restrict const x0 = r->ri_ias15.x0; 
+	double* restrict const v0 = r->ri_ias15.v0; 
+	double* restrict const xd = r->ri_ias15.xd; 
+	double* restrict const vd = r->ri_ias15.vd; 
+	const double* restrict const a0 = r->ri_ias15.a0; 
+	const struct reb_dpconst7 b  = dpcast(r->ri_ias15.b);
+	const struct reb_dpconst7 e  = dpcast(r->ri_ias15.e);
+	const struct reb_dpconst7 er = dpcast(r->ri_ias15.er);
+	const struct reb_dpconst7 br = dpcast(r->ri_ias15.br);
+	// Find new position and velocity values at end of the sequence
+	const double dt_done2 = dt_done * dt_done;
+#pragma omp for simd
+	for(int k=0;k<N3;++k) {
+		xd[k] = x0[k];	// Keep initial values for dense output
+		vd[k] = v0[k];
+		{
+			add_cs(&(x0[k]), &(csx[k]), b.p6[k]/72.*dt_done2);
+			add_cs(&(x0[k]), &(csx[k]), b.p5[k]/56.*dt_done2);
+			add_cs(&(x0[k]), &(csx[k]), b.p4[k]/42.*dt_done2);
+			add_cs(&(x0[k]), &(csx[k]), b.p3[k]/30.*dt_done2);
+			add_cs(&(x0[k]), &(csx[k]), b.p2[k]/20.*dt_done2);
+			add_cs(&(x0[k]), &(csx[k]), b.p1[k]/12.*dt_done2);
+			add_cs(&(x0[k]), &(csx[k]), b.p0[k]/6.*dt_done2);
+			add_cs(&(x0[k]), &(csx[k]), a0[k]/2.*dt_done2);
+			add_cs(&(x0[k]), &(csx[k]), v0[k]*dt_done);
+		}
+		{
+			add_cs(&(v0[k]), &(csv[k]), b.p6[k]/8.*dt_done);
+			add_cs(&(v0[k]), &(csv[k]), b.p5[k]/7.*dt_done);
+			add_cs(&(v0[k]), &(csv[k]), b.p4[k]/6.*dt_done);
+			add_cs(&(v0[k]), &(csv[k]), b.p3[k]/5.*dt_done);
+			add_cs(&(v0[k]), &(csv[k]), b.p2[k]/4.*dt_done);
+			add_cs(&(v0[k]), &(csv[k]), b.p1[k]/3.*dt_done);
+			add_cs(&(v0[k]), &(csv[k]), b.p0[k]/2.*dt_done);
+			add_cs(&(v0[k]), &(csv[k]), a0[k]*dt_done);
+		}
+	}
+
+	// Swap particle buffers
+#pragma omp for
+	for(int k=0;k<N;++k) {
+		particles[k].x = x0[3*k+0];	// Set final position
+		particles[k].y = x0[3*k+1];
+		particles[k].z = x0[3*k+2];
+
+		particles[k].vx = v0[3*k+0];	// Set final velocity
+		particles[k].vy = v0[3*k+1];
+		particles[k].vz = v0[3*k+2];
+	}
+	copybuffers(e,er,N3);		
+	copybuffers(b,br,N3);		
+	predict_next_step(ratio, N3, e, b, e, b);
+}
+ 
+/**
+ * @brief Makes sure all arrays have space for N3 components. 
+ * @details If the number of particles has increased, all b and e values and 
+ * compensated summation coefficients are reset.
+ */
+static void reb_integrator_ias15_prepare(struct reb_simulation* const r, const int N3){
+	if (N3 > r->ri_ias15.allocatedN) {
+		reb_integrator_ias15_alloc(r, N3);
+		clear_dp7(&(r->ri_ias15.g),N3);
+		clear_dp7(&(r->ri_ias15.b),N3);
+		clear_dp7(&(r->ri_ias15.csb),N3);
+		clear_dp7(&(r->ri_ias15.e),N3);
+		clear_dp7(&(r->ri_ias15.br),N3);
+		clear_dp7(&(r->ri_ias15.er),N3);
+		double* restrict const csx = r->ri_ias15.csx; 
+		double* restrict const csv = r->ri_ias15.csv; 
+		for (int i=0;i<N3;i++){
+			// Kill compensated summation coefficients
+			csx[i] = 0;
+			csv[i] = 0;
+		}
+		r->ri_ias15.allocatedN = N3;
+	}
+}
+
+/**
+ * @brief Returns 1 if the accelerations at the substeps are calculated from tree interaction lists.
+ */
+static int reb_integrator_ias15_interaction_lists(const struct reb_simulation* const r){
+#ifdef MPI
+	return 0;
+#else // MPI
+	return (r->ri_ias15.tree_interaction_lists && r->gravity==REB_GRAVITY_TREE && r->tree_root!=NULL);
+#endif // MPI
+}
+
+/**
+ * @brief Calculates the accelerations at a substep.
+ */
+static void reb_integrator_ias15_update_acceleration(struct reb_simulation* r){
+	if (!reb_integrator_ias15_interaction_lists(r)){
+		reb_update_acceleration(r);
+		return;
+	}
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY_WALK)
+	reb_calculate_acceleration_from_interactions(r);
+	if (r->N_var){
+		reb_calculate_acceleration_var(r);
+	}
+	if (r->additional_forces) r->additional_forces(r);
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
+}
+
+// Does the actual timestep.
+static int reb_integrator_ias15_step(struct reb_simulation* r) {
+	struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const int N3 = 3*N;
+	reb_integrator_ias15_prepare(r, N3);
+	
+	// reb_update_acceleration(); // Not needed. Forces are already calculated in main routine.
+	
+	// Loops over many particles are distributed over OpenMP threads. With a few 
+	// particles, starting the threads would take longer than the loops themselves.
+	// The loops are then called outside of a parallel region and run serially.
+	const int parallel = (N>=REB_IAS15_OPENMP_N);
+	double s[9];				// Summation coefficients 
+	double sv[8];				// Summation coefficients for velocities
+	const int predict_velocities = (r->calculate_megno || (r->additional_forces && r->force_is_velocity_dependent));
+	const double* restrict const x0 = r->ri_ias15.x0; 
+	const double* restrict const v0 = r->ri_ias15.v0; 
+	const struct reb_dpconst7 e  = dpcast(r->ri_ias15.e);
+	const struct reb_dpconst7 b  = dpcast(r->ri_ias15.b);
+	const struct reb_dpconst7 er = dpcast(r->ri_ias15.er);
+	const struct reb_dpconst7 br = dpcast(r->ri_ias15.br);
+	if (parallel){
+#pragma omp parallel
+		{
+			PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+			reb_integrator_ias15_begin(r);
+			PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+		}
+	}else{
+		reb_integrator_ias15_begin(r);
+	}
 
 	double integrator_megno_thisdt = 0.;
 	double integrator_megno_thisdt_init = 0.;
@@ -285,179 +738,52 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
 			
 			r->t = t_beginning + s[0];
 
-			// Prepare particles arrays for force calculation
-			for(int i=0;i<N;i++) {						// Predict positions at interval n using b values
-				const int k0 = 3*i+0;
-				const int k1 = 3*i+1;
-				const int k2 = 3*i+2;
-
-				double xk0  = -csx[k0] + (s[8]*b.p6[k0] + s[7]*b.p5[k0] + s[6]*b.p4[k0] + s[5]*b.p3[k0] + s[4]*b.p2[k0] + s[3]*b.p1[k0] + s[2]*b.p0[k0] + s[1]*a0[k0] + s[0]*v0[k0] );
-				particles[i].x = xk0 + x0[k0];
-				double xk1  = -csx[k1] + (s[8]*b.p6[k1] + s[7]*b.p5[k1] + s[6]*b.p4[k1] + s[5]*b.p3[k1] + s[4]*b.p2[k1] + s[3]*b.p1[k1] + s[2]*b.p0[k1] + s[1]*a0[k1] + s[0]*v0[k1] );
-				particles[i].y = xk1 + x0[k1];
-				double xk2  = -csx[k2] + (s[8]*b.p6[k2] + s[7]*b.p5[k2] + s[6]*b.p4[k2] + s[5]*b.p3[k2] + s[4]*b.p2[k2] + s[3]*b.p1[k2] + s[2]*b.p0[k2] + s[1]*a0[k2] + s[0]*v0[k2] );
-				particles[i].z = xk2 + x0[k2];
+			if (predict_velocities){
+				sv[0] = r->dt * h[n];
+				sv[1] =      sv[0] * h[n] / 2.;
+				sv[2] = 2. * sv[1] * h[n] / 3.;
+				sv[3] = 3. * sv[2] * h[n] / 4.;
+				sv[4] = 4. * sv[3] * h[n] / 5.;
+				sv[5] = 5. * sv[4] * h[n] / 6.;
+				sv[6] = 6. * sv[5] * h[n] / 7.;
+				sv[7] = 7. * sv[6] * h[n] / 8.;
 			}
-			if (r->calculate_megno || (r->additional_forces && r->force_is_velocity_dependent)){
-				s[0] = r->dt * h[n];
-				s[1] =      s[0] * h[n] / 2.;
-				s[2] = 2. * s[1] * h[n] / 3.;
-				s[3] = 3. * s[2] * h[n] / 4.;
-				s[4] = 4. * s[3] * h[n] / 5.;
-				s[5] = 5. * s[4] * h[n] / 6.;
-				s[6] = 6. * s[5] * h[n] / 7.;
-				s[7] = 7. * s[6] * h[n] / 8.;
-
-				for(int i=0;i<N;i++) {					// Predict velocities at interval n using b values
-					const int k0 = 3*i+0;
-					const int k1 = 3*i+1;
-					const int k2 = 3*i+2;
-
-					double vk0 =  -csv[k0] + s[7]*b.p6[k0] + s[6]*b.p5[k0] + s[5]*b.p4[k0] + s[4]*b.p3[k0] + s[3]*b.p2[k0] + s[2]*b.p1[k0] + s[1]*b.p0[k0] + s[0]*a0[k0];
-					particles[i].vx = vk0 + v0[k0];
-					double vk1 =  -csv[k1] + s[7]*b.p6[k1] + s[6]*b.p5[k1] + s[5]*b.p4[k1] + s[4]*b.p3[k1] + s[3]*b.p2[k1] + s[2]*b.p1[k1] + s[1]*b.p0[k1] + s[0]*a0[k1];
-					particles[i].vy = vk1 + v0[k1];
-					double vk2 =  -csv[k2] + s[7]*b.p6[k2] + s[6]*b.p5[k2] + s[5]*b.p4[k2] + s[4]*b.p3[k2] + s[3]*b.p2[k2] + s[2]*b.p1[k2] + s[1]*b.p0[k2] + s[0]*a0[k2];
-					particles[i].vz = vk2 + v0[k2];
+
+			// Prepare particles arrays for force calculation
+			if (parallel){
+#pragma omp parallel
+				{
+					PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+					reb_integrator_ias15_predict(r, s, sv, predict_velocities);
+					PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
 				}
+			}else{
+				reb_integrator_ias15_predict(r, s, sv, predict_velocities);
 			}
 
-
-			reb_update_acceleration(r);				// Calculate forces at interval n
+			reb_integrator_ias15_update_acceleration(r);		// Calculate forces at interval n
 			if (r->calculate_megno){
 				integrator_megno_thisdt += w[n] * r->t * reb_tools_megno_deltad_delta(r);
 			}
 
-			for(int k=0;k<N;++k) {
-				at[3*k]   = particles[k].ax;
-				at[3*k+1] = particles[k].ay;  
-				at[3*k+2] = particles[k].az;
-			}
-			switch (n) {							// Improve b and g values
-				case 1: 
-					for(int k=0;k<N3;++k) {
-						double tmp = g.p0[k];
-						double gk = at[k];
-						double gk_cs = ((double*)(gravity_cs))[k];
-						add_cs(&gk, &gk_cs, -a0[k]);
-						add_cs(&gk, &gk_cs, csa0[k]);
-						g.p0[k]  = gk/rr[0];
-						add_cs(&(b.p0[k]), &(csb.p0[k]), g.p0[k]-tmp);
-					} break;
-				case 2: 
-					for(int k=0;k<N3;++k) {
-						double tmp = g.p1[k];
-						double gk = at[k];
-						double gk_cs = ((double*)(gravity_cs))[k];
-						add_cs(&gk, &gk_cs, -a0[k]);
-						add_cs(&gk, &gk_cs, csa0[k]);
-						g.p1[k] = (gk/rr[1] - g.p0[k])/rr[2];
-						tmp = g.p1[k] - tmp;
-						add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[0]);
-						add_cs(&(b.p1[k]), &(csb.p1[k]), tmp);
-					} break;
-				case 3: 
-					for(int k=0;k<N3;++k) {
-						double tmp = g.p2[k];
-						double gk = at[k];
-						double gk_cs = ((double*)(gravity_cs))[k];
-						add_cs(&gk, &gk_cs, -a0[k]);
-						add_cs(&gk, &gk_cs, csa0[k]);
-						g.p2[k] = ((gk/rr[3] - g.p0[k])/rr[4] - g.p1[k])/rr[5];
-						tmp = g.p2[k] - tmp;
-						add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[1]);
-						add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[2]);
-						add_cs(&(b.p2[k]), &(csb.p2[k]), tmp);
-					} break;
-				case 4:
-					for(int k=0;k<N3;++k) {
-						double tmp = g.p3[k];
-						double gk = at[k];
-						double gk_cs = ((double*)(gravity_cs))[k];
-						add_cs(&gk, &gk_cs, -a0[k]);
-						add_cs(&gk, &gk_cs, csa0[k]);
-						g.p3[k] = (((gk/rr[6] - g.p0[k])/rr[7] - g.p1[k])/rr[8] - g.p2[k])/rr[9];
-						tmp = g.p3[k] - tmp;
-						add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[3]);
-						add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[4]);
-						add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[5]);
-						add_cs(&(b.p3[k]), &(csb.p3[k]), tmp);
-					} break;
-				case 5:
-					for(int k=0;k<N3;++k) {
-						double tmp = g.p4[k];
-						double gk = at[k];
-						double gk_cs = ((double*)(gravity_cs))[k];
-						add_cs(&gk, &gk_cs, -a0[k]);
-						add_cs(&gk, &gk_cs, csa0[k]);
-						g.p4[k] = ((((gk/rr[10] - g.p0[k])/rr[11] - g.p1[k])/rr[12] - g.p2[k])/rr[13] - g.p3[k])/rr[14];
-						tmp = g.p4[k] - tmp;
-						add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[6]);
-						add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[7]);
-						add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[8]);
-						add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[9]);
-						add_cs(&(b.p4[k]), &(csb.p4[k]), tmp);
-					} break;
-				case 6:
-					for(int k=0;k<N3;++k) {
-						double tmp = g.p5[k];
-						double gk = at[k];
-						double gk_cs = ((double*)(gravity_cs))[k];
-						add_cs(&gk, &gk_cs, -a0[k]);
-						add_cs(&gk, &gk_cs, csa0[k]);
-						g.p5[k] = (((((gk/rr[15] - g.p0[k])/rr[16] - g.p1[k])/rr[17] - g.p2[k])/rr[18] - g.p3[k])/rr[19] - g.p4[k])/rr[20];
-						tmp = g.p5[k] - tmp;
-						add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[10]);
-						add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[11]);
-						add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[12]);
-						add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[13]);
-						add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[14]);
-						add_cs(&(b.p5[k]), &(csb.p5[k]), tmp);
-					} break;
-				case 7:
+			double maxak = 0.0;
+			double maxb6ktmp = 0.0;
+			double maxerror = 0.0;
+			if (parallel){
+#pragma omp parallel
 				{
-					double maxak = 0.0;
-					double maxb6ktmp = 0.0;
-					for(int k=0;k<N3;++k) {
-						double tmp = g.p6[k];
-						double gk = at[k];
-						double gk_cs = ((double*)(gravity_cs))[k];
-						add_cs(&gk, &gk_cs, -a0[k]);
-						add_cs(&gk, &gk_cs, csa0[k]);
-						g.p6[k] = ((((((gk/rr[21] - g.p0[k])/rr[22] - g.p1[k])/rr[23] - g.p2[k])/rr[24] - g.p3[k])/rr[25] - g.p4[k])/rr[26] - g.p5[k])/rr[27];
-						tmp = g.p6[k] - tmp;	
-						add_cs(&(b.p0[k]), &(csb.p0[k]), tmp * c[15]);
-						add_cs(&(b.p1[k]), &(csb.p1[k]), tmp * c[16]);
-						add_cs(&(b.p2[k]), &(csb.p2[k]), tmp * c[17]);
-						add_cs(&(b.p3[k]), &(csb.p3[k]), tmp * c[18]);
-						add_cs(&(b.p4[k]), &(csb.p4[k]), tmp * c[19]);
-						add_cs(&(b.p5[k]), &(csb.p5[k]), tmp * c[20]);
-						add_cs(&(b.p6[k]), &(csb.p6[k]), tmp);
-						
-						// Monitor change in b.p6[k] relative to at[k]. The predictor corrector scheme is converged if it is close to 0.
-						if (r->ri_ias15.epsilon_global){
-							const double ak  = fabs(at[k]);
-							if (isnormal(ak) && ak>maxak){
-								maxak = ak;
-							}
-							const double b6ktmp = fabs(tmp);  // change of b6ktmp coefficient
-							if (isnormal(b6ktmp) && b6ktmp>maxb6ktmp){
-								maxb6ktmp = b6ktmp;
-							}
-						}else{
-							const double ak  = at[k];
-							const double b6ktmp = tmp; 
-							const double errork = fabs(b6ktmp/ak);
-							if (isnormal(errork) && errork>predictor_corrector_error){
-								predictor_corrector_error = errork;
-							}
-						}
-					} 
-					if (r->ri_ias15.epsilon_global){
-						predictor_corrector_error = maxb6ktmp/maxak;
-					}
-					
-					break;
+					PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+					reb_integrator_ias15_correct(r, n, &maxak, &maxb6ktmp, &maxerror);
+					PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+				}
+			}else{
+				reb_integrator_ias15_correct(r, n, &maxak, &maxb6ktmp, &maxerror);
+			}
+			if (n==7){
+				if (r->ri_ias15.epsilon_global){
+					predictor_corrector_error = maxb6ktmp/maxak;
+				}else{
+					predictor_corrector_error = maxerror;
 				}
 			}
 		}
@@ -476,36 +802,24 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
 		// r->ri_ias15.epsilon_global==0
 		//   Here, the fractional error is calculated for each particle individually and we use the maximum of the fractional error.
 		//   This might fail in cases where a particle does not experience any (physical) acceleration besides roundoff errors. 
+		double maxak = 0.0;
+		double maxb6k = 0.0;
+		double maxerror = 0.0;
+		if (parallel){
+#pragma omp parallel
+			{
+				PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+				reb_integrator_ias15_error(r, &maxak, &maxb6k, &maxerror);
+				PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+			}
+		}else{
+			reb_integrator_ias15_error(r, &maxak, &maxb6k, &maxerror);
+		}
 		double integrator_error = 0.0;
 		if (r->ri_ias15.epsilon_global){
-			double maxak = 0.0;
-			double maxb6k = 0.0;
-			for(int i=0;i<N;i++){ // Looping over all particles and all 3 components of the acceleration. 
-				const double v2 = particles[i].vx*particles[i].vx+particles[i].vy*particles[i].vy+particles[i].vz*particles[i].vz;
-				const double x2 = particles[i].x*particles[i].x+particles[i].y*particles[i].y+particles[i].z*particles[i].z;
-				// Skip slowly varying accelerations
-				if (fabs(v2*r->dt*r->dt/x2) < 1e-16) continue;
-				for(int k=3*i;k<3*(i+1);k++) { 
-					const double ak  = fabs(at[k]);
-					if (isnormal(ak) && ak>maxak){
-						maxak = ak;
-					}
-					const double b6k = fabs(b.p6[k]); 
-					if (isnormal(b6k) && b6k>maxb6k){
-						maxb6k = b6k;
-					}
-				}
-			}
 			integrator_error = maxb6k/maxak;
 		}else{
-			for(int k=0;k<N3;k++) {
-				const double ak  = at[k];
-				const double b6k = b.p6[k]; 
-				const double errork = fabs(b6k/ak);
-				if (isnormal(errork) && errork>integrator_error){
-					integrator_error = errork;
-				}
-			}
+			integrator_error = maxerror;
 		}
 
 		double dt_new;
@@ -543,10 +857,364 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
 		r->dt = dt_new;
 	}
 
-	// Find new position and velocity values at end of the sequence
-	const double dt_done2 = dt_done * dt_done;
-	for(int k=0;k<N3;++k) {
+	// Find new positions and velocities, swap particle buffers and predict the next b values
+	double ratio = r->dt/dt_done;
+	if (parallel){
+#pragma omp parallel
 		{
+			PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+			reb_integrator_ias15_finish(r, dt_done, ratio);
+			PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+		}
+	}else{
+		reb_integrator_ias15_finish(r, dt_done, ratio);
+	}
+
+	r->t += dt_done;
+	r->dt_last_done = dt_done;
+	r->ri_ias15.dense_N = N;
+
+	if (r->calculate_megno){
+		double dY = dt_done*integrator_megno_thisdt;
+		reb_tools_megno_update(r, dY);
+	}
+
+	return 1; // Success.
+}
+
+/////////////////////////
+//   Block timesteps
+//
+// With block timesteps, particle i is advanced with the timestep dt/2^l_i, 
+// where dt is the timestep of the slowest particles (r->dt) and l_i is the 
+// level of the particle. One step of level l consists of two steps of level 
+// l+1. Every level runs its own predictor corrector loop with the Gauss-Radau 
+// spacings of its own timestep. The accelerations of a particle are only 
+// calculated at the substeps of its own level. At these times, the positions 
+// of slower particles are given by the polynomial of their current step (with 
+// the b values predicted from their previous step, as the step has not been 
+// corrected yet), and the positions of faster particles are taken from their 
+// completed steps, which record them at the substeps of all slower levels.
+// x0, v0, a0 and b of each particle always refer to the beginning of its 
+// current step. The particle structure is only used for force calculations 
+// until the end of the (slowest) step.
+
+/**
+ * @brief Maximum number of block timestep levels.
+ */
+#define REB_IAS15_BLOCK_LEVELS_MAX 16
+
+/**
+ * @brief Levels and times of one block timestep.
+ */
+struct reb_ias15_block {
+	int L;                                      ///< Deepest level in use.
+	int L_max;                                  ///< Deepest level allowed.
+	int start[REB_IAS15_BLOCK_LEVELS_MAX+2];    ///< Particles of level l are block_index[start[l]] ... block_index[start[l+1]-1].
+	double t[REB_IAS15_BLOCK_LEVELS_MAX+1];     ///< Beginning of the current step of each level.
+	double dt[REB_IAS15_BLOCK_LEVELS_MAX+1];    ///< Timestep of each level.
+};
+
+static struct reb_dpconst7 dpoffset(struct reb_dp7 dp, const int k){
+	struct reb_dpconst7 dpc = {
+		.p0 = dp.p0+k, 
+		.p1 = dp.p1+k, 
+		.p2 = dp.p2+k, 
+		.p3 = dp.p3+k, 
+		.p4 = dp.p4+k, 
+		.p5 = dp.p5+k, 
+		.p6 = dp.p6+k, 
+	};
+	return dpc;
+}
+
+/**
+ * @brief Returns 1 if block timesteps can be used with the current settings.
+ */
+static int reb_integrator_ias15_block_supported(const struct reb_simulation* const r){
+	return (r->gravity==REB_GRAVITY_BASIC || r->gravity==REB_GRAVITY_NONE)
+		&& r->ri_ias15.epsilon>0
+		&& r->N_var==0
+		&& !r->calculate_megno
+		&& r->event==NULL	// Events need the dense output of a global step.
+		&& !(r->additional_forces && r->force_is_velocity_dependent);
+}
+
+/**
+ * @brief Makes sure the block timestep arrays have space for N particles and L_max levels.
+ * @details If the number of particles has changed, all particles are put on level 0.
+ */
+static void reb_integrator_ias15_block_alloc(struct reb_simulation* const r, const int N, const int L_max){
+	struct reb_simulation_integrator_ias15* const ri_ias15 = &(r->ri_ias15);
+	if (N > ri_ias15->block_allocatedN){
+		ri_ias15->block_level = realloc(ri_ias15->block_level, sizeof(int)*N);
+		ri_ias15->block_index = realloc(ri_ias15->block_index, sizeof(int)*N);
+		ri_ias15->block_dt    = realloc(ri_ias15->block_dt, sizeof(double)*N);
+		ri_ias15->block_allocatedN = N;
+	}
+	const int nodes_N = L_max*7*3*N;
+	if (nodes_N > ri_ias15->block_nodes_allocatedN){
+		ri_ias15->block_nodes = realloc(ri_ias15->block_nodes, sizeof(double)*nodes_N);
+		ri_ias15->block_nodes_allocatedN = nodes_N;
+	}
+	if (ri_ias15->block_N != N){
+		for (int i=0;i<N;i++){
+			ri_ias15->block_level[i] = 0;
+		}
+		ri_ias15->block_N = N;
+	}
+}
+
+/**
+ * @brief Sorts the particles by level (counting sort) and sets the timesteps of all levels.
+ * @param r REBOUND simulation to operate on
+ * @param blk Block timestep to initialize.
+ * @param L_max Deepest level allowed. Particles on deeper levels are moved to this level.
+ */
+static void reb_integrator_ias15_block_sort(struct reb_simulation* const r, struct reb_ias15_block* const blk, const int L_max){
+	const int N = r->N;
+	int* const level = r->ri_ias15.block_level;
+	int* const index = r->ri_ias15.block_index;
+	int pos[REB_IAS15_BLOCK_LEVELS_MAX+1] = {0};
+	blk->L = 0;
+	blk->L_max = L_max;
+	for (int i=0;i<N;i++){
+		if (level[i]>L_max) level[i] = L_max;
+		if (level[i]>blk->L) blk->L = level[i];
+		pos[level[i]]++;
+	}
+	blk->start[0] = 0;
+	for (int l=0;l<=blk->L;l++){
+		const int count = pos[l];
+		pos[l] = blk->start[l];
+		blk->start[l+1] = blk->start[l] + count;
+	}
+	for (int i=0;i<N;i++){
+		index[pos[level[i]]++] = i;
+	}
+	for (int l=0;l<=blk->L;l++){
+		blk->dt[l] = ldexp(r->dt, -l);
+	}
+}
+
+/**
+ * @brief Predicts the positions of some particles at a time within their current step.
+ * @param r REBOUND simulation to operate on
+ * @param index Indices of the particles.
+ * @param index_N Number of particles.
+ * @param hn Time within the step, 0 at the beginning and 1 at the end.
+ * @param dt Timestep of the particles.
+ */
+static void reb_integrator_ias15_block_predict(struct reb_simulation* const r, const int* const index, const int index_N, const double hn, const double dt){
+	struct reb_particle* const particles = r->particles;
+	const double* restrict const csx = r->ri_ias15.csx; 
+	const double* restrict const x0 = r->ri_ias15.x0; 
+	const double* restrict const v0 = r->ri_ias15.v0; 
+	const double* restrict const a0 = r->ri_ias15.a0; 
+	const struct reb_dpconst7 b  = dpcast(r->ri_ias15.b);
+	double s[9];
+	s[0] = dt * hn;
+	s[1] = s[0] * s[0] / 2.;
+	s[2] = s[1] * hn / 3.;
+	s[3] = s[2] * hn / 2.;
+	s[4] = 3. * s[3] * hn / 5.;
+	s[5] = 2. * s[4] * hn / 3.;
+	s[6] = 5. * s[5] * hn / 7.;
+	s[7] = 3. * s[6] * hn / 4.;
+	s[8] = 7. * s[7] * hn / 9.;
+	for(int p=0;p<index_N;p++) {
+		const int i = index[p];
+		double* const x = &(particles[i].x);
+		for(int j=0;j<3;j++) {
+			const int k = 3*i+j;
+			const double xk = -csx[k] + (s[8]*b.p6[k] + s[7]*b.p5[k] + s[6]*b.p4[k] + s[5]*b.p3[k] + s[4]*b.p2[k] + s[3]*b.p1[k] + s[2]*b.p0[k] + s[1]*a0[k] + s[0]*v0[k] );
+			x[j] = xk + x0[k];
+		}
+	}
+}
+
+/**
+ * @brief Calculates the accelerations of the particles of level l at intermediate step n of their current step.
+ * @details If n is 0, all levels >= l are at the beginning of their step and 
+ * the accelerations of all of them are calculated.
+ */
+static void reb_integrator_ias15_block_update_acceleration(struct reb_simulation* const r, const struct reb_ias15_block* const blk, const int l, const int n){
+	struct reb_particle* const particles = r->particles;
+	const int N3 = 3*r->N;
+	const int* const index = r->ri_ias15.block_index;
+	const double tau = blk->t[l] + blk->dt[l]*h[n];
+	for (int m=0;m<=blk->L;m++){
+		const int* const im = index + blk->start[m];
+		const int im_N = blk->start[m+1] - blk->start[m];
+		if (m<l){
+			// Slower particles, interpolated within their current step.
+			reb_integrator_ias15_block_predict(r, im, im_N, (tau-blk->t[m])/blk->dt[m], blk->dt[m]);
+		}else if (m==l && n>0){
+			reb_integrator_ias15_block_predict(r, im, im_N, h[n], blk->dt[m]);
+		}else{
+			// At the beginning of their step, or recorded by their completed steps.
+			const double* const x = (n==0)?r->ri_ias15.x0:(r->ri_ias15.block_nodes + (l*7+n-1)*N3);
+			for (int p=0;p<im_N;p++){
+				const int i = im[p];
+				particles[i].x = x[3*i+0];
+				particles[i].y = x[3*i+1];
+				particles[i].z = x[3*i+2];
+			}
+		}
+	}
+	r->t = tau;
+	const int active_N = ((n==0)?blk->start[blk->L+1]:blk->start[l+1]) - blk->start[l];
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
+	reb_calculate_acceleration_for_particles(r, index + blk->start[l], active_N);
+	if (r->additional_forces) r->additional_forces(r);
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
+}
+
+/**
+ * @brief Does one step of level l, including all steps of faster levels within it.
+ * @param r REBOUND simulation to operate on
+ * @param blk Block timestep.
+ * @param l Level.
+ * @param t Beginning of the step.
+ * @param begin_done Set to 1 if the accelerations at the beginning of the step are already in a0.
+ */
+static void reb_integrator_ias15_block_level_step(struct reb_simulation* const r, struct reb_ias15_block* const blk, const int l, const double t, const int begin_done){
+	struct reb_particle* const particles = r->particles;
+	struct reb_simulation_integrator_ias15* const ri_ias15 = &(r->ri_ias15);
+	const int N3 = 3*r->N;
+	const int* const il = ri_ias15->block_index + blk->start[l];
+	const int il_N = blk->start[l+1] - blk->start[l];
+	double* restrict const x0 = ri_ias15->x0; 
+	double* restrict const v0 = ri_ias15->v0; 
+	double* restrict const a0 = ri_ias15->a0; 
+	double* restrict const csx = ri_ias15->csx; 
+	double* restrict const csv = ri_ias15->csv; 
+	double* restrict const at = ri_ias15->at; 
+	const struct reb_dpconst7 g  = dpcast(ri_ias15->g);
+	const struct reb_dpconst7 b  = dpcast(ri_ias15->b);
+	const struct reb_dpconst7 csb= dpcast(ri_ias15->csb);
+	blk->t[l] = t;
+
+	if (!begin_done){
+		reb_integrator_ias15_block_update_acceleration(r, blk, l, 0);
+		const int ia_N = blk->start[blk->L+1] - blk->start[l];
+		for (int p=0;p<ia_N;p++){
+			const int i = il[p];
+			a0[3*i+0] = particles[i].ax;
+			a0[3*i+1] = particles[i].ay;
+			a0[3*i+2] = particles[i].az;
+		}
+	}
+	for (int p=0;p<il_N;p++){
+		for (int k=3*il[p];k<3*il[p]+3;k++){
+			csb.p0[k] = 0.;
+			csb.p1[k] = 0.;
+			csb.p2[k] = 0.;
+			csb.p3[k] = 0.;
+			csb.p4[k] = 0.;
+			csb.p5[k] = 0.;
+			csb.p6[k] = 0.;
+
+			g.p0[k] = b.p6[k]*d[15] + b.p5[k]*d[10] + b.p4[k]*d[6] + b.p3[k]*d[3]  + b.p2[k]*d[1]  + b.p1[k]*d[0]  + b.p0[k];
+			g.p1[k] = b.p6[k]*d[16] + b.p5[k]*d[11] + b.p4[k]*d[7] + b.p3[k]*d[4]  + b.p2[k]*d[2]  + b.p1[k];
+			g.p2[k] = b.p6[k]*d[17] + b.p5[k]*d[12] + b.p4[k]*d[8] + b.p3[k]*d[5]  + b.p2[k];
+			g.p3[k] = b.p6[k]*d[18] + b.p5[k]*d[13] + b.p4[k]*d[9] + b.p3[k];
+			g.p4[k] = b.p6[k]*d[19] + b.p5[k]*d[14] + b.p4[k];
+			g.p5[k] = b.p6[k]*d[20] + b.p5[k];
+			g.p6[k] = b.p6[k];
+		}
+	}
+
+	// Faster particles
+	if (l<blk->L){
+		reb_integrator_ias15_block_level_step(r, blk, l+1, t, 1);
+		reb_integrator_ias15_block_level_step(r, blk, l+1, t+blk->dt[l+1], 0);
+	}
+	if (il_N==0){
+		return;
+	}
+
+	// Predictor corrector loop for the particles of this level, same stopping criteria as for a global step.
+	double predictor_corrector_error = 1e300;
+	double predictor_corrector_error_last = 2;
+	int iterations = 0;	
+	while(1){
+		if(predictor_corrector_error<1e-16){
+			break;
+		}
+		if(iterations > 2 && predictor_corrector_error_last <= predictor_corrector_error){
+			break;
+		}
+		if (iterations>=12){
+			ri_ias15->iterations_max_exceeded++;
+			const int integrator_iterations_warning = 10;
+			if (ri_ias15->iterations_max_exceeded==integrator_iterations_warning ){
+				reb_warning("At least 10 predictor corrector loops in IAS15 did not converge. This is typically an indication of the timestep being too large.");
+			}
+			break;
+		}
+		predictor_corrector_error_last = predictor_corrector_error;
+		iterations++;
+		for(int n=1;n<8;n++) {
+			reb_integrator_ias15_block_update_acceleration(r, blk, l, n);
+			double maxak = 0.0;
+			double maxb6ktmp = 0.0;
+			double maxerror = 0.0;
+			for (int p=0;p<il_N;p++){
+				const int i = il[p];
+				const double* const a = &(particles[i].ax);
+				for (int j=0;j<3;j++){
+					const int k = 3*i+j;
+					at[k] = a[j];
+					const double tmp = reb_integrator_ias15_correct_component(n, k, reb_integrator_ias15_gk(at[k], 0., a0[k], 0.), g, b, csb);
+					if (n==7){
+						const double ak  = fabs(at[k]);
+						if (isnormal(ak) && ak>maxak){
+							maxak = ak;
+						}
+						const double b6ktmp = fabs(tmp);
+						if (isnormal(b6ktmp) && b6ktmp>maxb6ktmp){
+							maxb6ktmp = b6ktmp;
+						}
+						const double errork = fabs(tmp/at[k]);
+						if (isnormal(errork) && errork>maxerror){
+							maxerror = errork;
+						}
+					}
+				}
+			}
+			if (n==7){
+				if (ri_ias15->epsilon_global){
+					predictor_corrector_error = maxb6ktmp/maxak;
+				}else{
+					predictor_corrector_error = maxerror;
+				}
+			}
+		}
+	}
+
+	// Record positions at the substeps of slower levels that fall within this step
+	for (int m=0;m<l;m++){
+		for (int n=1;n<8;n++){
+			const double hn = (blk->t[m] + blk->dt[m]*h[n] - t)/blk->dt[l];
+			if (hn<0. || hn>=1.) continue;
+			reb_integrator_ias15_block_predict(r, il, il_N, hn, blk->dt[l]);
+			double* const x = ri_ias15->block_nodes + (m*7+n-1)*N3;
+			for (int p=0;p<il_N;p++){
+				const int i = il[p];
+				x[3*i+0] = particles[i].x;
+				x[3*i+1] = particles[i].y;
+				x[3*i+2] = particles[i].z;
+			}
+		}
+	}
+
+	// Find new positions and velocities and predict the b values for the next step of this level
+	const double dt_done = blk->dt[l];
+	const double dt_done2 = dt_done * dt_done;
+	for (int p=0;p<il_N;p++){
+		const int i = il[p];
+		for (int k=3*i;k<3*i+3;k++){
 			add_cs(&(x0[k]), &(csx[k]), b.p6[k]/72.*dt_done2);
 			add_cs(&(x0[k]), &(csx[k]), b.p5[k]/56.*dt_done2);
 			add_cs(&(x0[k]), &(csx[k]), b.p4[k]/42.*dt_done2);
@@ -556,8 +1224,7 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
 			add_cs(&(x0[k]), &(csx[k]), b.p0[k]/6.*dt_done2);
 			add_cs(&(x0[k]), &(csx[k]), a0[k]/2.*dt_done2);
 			add_cs(&(x0[k]), &(csx[k]), v0[k]*dt_done);
-		}
-		{
+
 			add_cs(&(v0[k]), &(csv[k]), b.p6[k]/8.*dt_done);
 			add_cs(&(v0[k]), &(csv[k]), b.p5[k]/7.*dt_done);
 			add_cs(&(v0[k]), &(csv[k]), b.p4[k]/6.*dt_done);
@@ -567,36 +1234,239 @@ static int reb_integrator_ias15_step(struct reb_simulation* r) {
 			add_cs(&(v0[k]), &(csv[k]), b.p0[k]/2.*dt_done);
 			add_cs(&(v0[k]), &(csv[k]), a0[k]*dt_done);
 		}
+		const struct reb_dpconst7 ei = dpoffset(ri_ias15->e, 3*i);
+		const struct reb_dpconst7 bi = dpoffset(ri_ias15->b, 3*i);
+		copybuffers(ei, dpoffset(ri_ias15->er, 3*i), 3);
+		copybuffers(bi, dpoffset(ri_ias15->br, 3*i), 3);
+		predict_next_step(1., 3, ei, bi, ei, bi);
 	}
+}
 
-	r->t += dt_done;
-	r->dt_last_done = dt_done;
+/**
+ * @brief Returns the slowest level with a timestep not larger than dt_i.
+ */
+static int reb_integrator_ias15_block_level(const double dt_slowest, const int L_max, const double dt_i){
+	int l = 0;
+	double dt_l = dt_slowest;
+	while (l<L_max && dt_l>dt_i){
+		l++;
+		dt_l *= 0.5;
+	}
+	return l;
+}
 
-	if (r->calculate_megno){
-		double dY = dt_done*integrator_megno_thisdt;
-		reb_tools_megno_update(r, dY);
+/**
+ * @brief Assigns levels according to the timesteps in block_dt.
+ * @details The timestep of the slowest level is the largest timestep in 
+ * block_dt, but at most 2^L_max times the smallest one. Every particle is 
+ * put on the slowest level with a timestep not larger than its own. 
+ * The particle with the largest gravitational acceleration on a particle 
+ * (e.g. the planet of a moon) is put on the same level if it is slower.
+ * Otherwise, the error of its predicted position would dominate the error 
+ * of the faster particle. Afterwards, block_dt contains the length of the 
+ * last step of every particle.
+ * @param r REBOUND simulation to operate on
+ * @param blk Block timestep that has been done.
+ * @return New timestep of the slowest level.
+ */
+static double reb_integrator_ias15_block_assign_levels(struct reb_simulation* const r, const struct reb_ias15_block* const blk){
+	struct reb_simulation_integrator_ias15* const ri_ias15 = &(r->ri_ias15);
+	const struct reb_particle* const particles = r->particles;
+	const int N = r->N;
+	const int _N_active = (r->N_active==-1)?N:r->N_active;
+	int* const level = ri_ias15->block_level;
+	int* const level_new = ri_ias15->block_index;	// Not needed until the next step is sorted.
+	double* const block_dt = ri_ias15->block_dt;
+	double dt_min = block_dt[0];
+	double dt_max = block_dt[0];
+	for (int i=1;i<N;i++){
+		if (block_dt[i]<dt_min) dt_min = block_dt[i];
+		if (block_dt[i]>dt_max) dt_max = block_dt[i];
+	}
+	double dt_new = dt_max;
+	if (dt_new > ldexp(dt_min, blk->L_max)) dt_new = ldexp(dt_min, blk->L_max);
+	for (int i=0;i<N;i++){
+		level_new[i] = reb_integrator_ias15_block_level(dt_new, blk->L_max, block_dt[i]);
 	}
+	if (r->gravity!=REB_GRAVITY_NONE){
+		for (int i=0;i<N;i++){
+			const int l = reb_integrator_ias15_block_level(dt_new, blk->L_max, block_dt[i]);
+			int j_max = -1;
+			double a_max = 0.;
+			for (int j=0;j<_N_active;j++){
+				if (i==j) continue;
+				const double dx = particles[i].x - particles[j].x;
+				const double dy = particles[i].y - particles[j].y;
+				const double dz = particles[i].z - particles[j].z;
+				const double a = particles[j].m/(dx*dx + dy*dy + dz*dz);
+				if (a>a_max){
+					a_max = a;
+					j_max = j;
+				}
+			}
+			if (j_max>=0 && level_new[j_max]<l){
+				level_new[j_max] = l;
+			}
+		}
+	}
+	for (int i=0;i<N;i++){
+		block_dt[i] = fabs(blk->dt[level[i]]);
+		level[i] = level_new[i];
+	}
+	return copysign(dt_new, r->dt);
+}
 
-	// Swap particle buffers
-	for(int k=0;k<N;++k) {
-		particles[k].x = x0[3*k+0];	// Set final position
-		particles[k].y = x0[3*k+1];
-		particles[k].z = x0[3*k+2];
+/**
+ * @brief Finds the timestep of particle i from its own error estimate and stores it in block_dt.
+ * @details The error is estimated from the largest component of b6 and the 
+ * largest acceleration of the particle in its last step. 
+ * @param r REBOUND simulation to operate on
+ * @param i Particle index.
+ * @param dt_done Last timestep of the particle.
+ * @return 1 if the timestep is significantly smaller than dt_done and the step needs to be repeated.
+ */
+static int reb_integrator_ias15_block_dt(struct reb_simulation* const r, const int i, const double dt_done){
+	struct reb_simulation_integrator_ias15* const ri_ias15 = &(r->ri_ias15);
+	const double* restrict const at = ri_ias15->at; 
+	const double* restrict const b6 = ri_ias15->br.p6; 
+	double maxak = 0.0;
+	double maxb6k = 0.0;
+	for(int k=3*i;k<3*(i+1);k++) { 
+		const double ak  = fabs(at[k]);
+		if (isnormal(ak) && ak>maxak){
+			maxak = ak;
+		}
+		const double b6k = fabs(b6[k]); 
+		if (isnormal(b6k) && b6k>maxb6k){
+			maxb6k = b6k;
+		}
+	}
+	const double integrator_error = maxb6k/maxak;
+	double dt_new;
+	if  (isnormal(integrator_error)){ 	
+		dt_new = pow(ri_ias15->epsilon/integrator_error,1./7.)*dt_done;
+	}else{
+		dt_new = dt_done/safety_factor;
+	}
+	if (fabs(dt_new)<ri_ias15->min_dt) dt_new = copysign(ri_ias15->min_dt,dt_new);
+	const int rejected = (fabs(dt_new/dt_done) < safety_factor);
+	if (dt_new/dt_done > 1./safety_factor) dt_new = dt_done /safety_factor;
+	ri_ias15->block_dt[i] = fabs(dt_new);
+	return rejected;
+}
 
-		particles[k].vx = v0[3*k+0];	// Set final velocity
-		particles[k].vy = v0[3*k+1];
-		particles[k].vz = v0[3*k+2];
+/**
+ * @brief Assigns levels after a global step, using the error estimate of every particle.
+ */
+static void reb_integrator_ias15_block_init(struct reb_simulation* const r, const int L_max){
+	const int N = r->N;
+	const double dt_done = r->dt_last_done;
+	reb_integrator_ias15_block_alloc(r, N, L_max);
+	struct reb_ias15_block blk;
+	reb_integrator_ias15_block_sort(r, &blk, L_max);	// All particles are on level 0.
+	blk.dt[0] = dt_done;
+	for (int i=0;i<N;i++){
+		reb_integrator_ias15_block_dt(r, i, dt_done);
 	}
-	copybuffers(e,er,N3);		
-	copybuffers(b,br,N3);		
-	double ratio = r->dt/dt_done;
-	predict_next_step(ratio, N3, e, b, e, b);
+	r->dt = reb_integrator_ias15_block_assign_levels(r, &blk);
+}
+
+// Does one timestep with block timesteps.
+static int reb_integrator_ias15_block_step(struct reb_simulation* const r, const int L_max){
+	struct reb_particle* const particles = r->particles;
+	struct reb_simulation_integrator_ias15* const ri_ias15 = &(r->ri_ias15);
+	const int N = r->N;
+	const int N3 = 3*N;
+	reb_integrator_ias15_prepare(r, N3);
+	reb_integrator_ias15_block_alloc(r, N, L_max);
+	struct reb_ias15_block blk;
+	reb_integrator_ias15_block_sort(r, &blk, L_max);
+	// Predict b values for the timesteps actually used. The timestep might 
+	// have been changed since the levels were assigned (e.g. to finish exactly 
+	// at a given time). Good predictions are important because slower particles
+	// are interpolated with the predicted values.
+	for(int i=0;i<N;i++) {
+		const double ratio = fabs(blk.dt[ri_ias15->block_level[i]])/ri_ias15->block_dt[i];
+		if (ratio!=1.){
+			predict_next_step(ratio, 3, dpoffset(ri_ias15->er, 3*i), dpoffset(ri_ias15->br, 3*i), dpoffset(ri_ias15->e, 3*i), dpoffset(ri_ias15->b, 3*i));
+		}
+	}
+
+	double* restrict const x0 = ri_ias15->x0; 
+	double* restrict const v0 = ri_ias15->v0; 
+	double* restrict const a0 = ri_ias15->a0; 
+	double* restrict const csa0 = ri_ias15->csa0; 
+	double* restrict const xd = ri_ias15->xd; 
+	double* restrict const vd = ri_ias15->vd; 
+	// The accelerations at the beginning of the step have been calculated in the main routine. 
+	for(int i=0;i<N;i++) {
+		x0[3*i]   = particles[i].x;
+		x0[3*i+1] = particles[i].y;
+		x0[3*i+2] = particles[i].z;
+		v0[3*i]   = particles[i].vx;
+		v0[3*i+1] = particles[i].vy;
+		v0[3*i+2] = particles[i].vz;
+		a0[3*i]   = particles[i].ax;
+		a0[3*i+1] = particles[i].ay; 
+		a0[3*i+2] = particles[i].az;
+	}
+	for(int k=0;k<N3;k++) {
+		xd[k] = x0[k];	// Initial values in case the step gets rejected
+		vd[k] = v0[k];
+		csa0[k] = 0.;
+	}
+
+	const double t_beginning = r->t;
+	reb_integrator_ias15_block_level_step(r, &blk, 0, t_beginning, 1);
+	r->t = t_beginning;
+
+	// Find new timestep of every particle.
+	int rejected = 0;
+	for (int i=0;i<N;i++){
+		rejected |= reb_integrator_ias15_block_dt(r, i, blk.dt[ri_ias15->block_level[i]]);
+	}
+
+	if (rejected){
+		// Reset particles. The step is repeated as a global step with the smallest 
+		// timestep, because the predicted b values for the beginning of the step are 
+		// not available anymore.
+		double dt_min = ri_ias15->block_dt[0];
+		for(int i=0;i<N;i++) {
+			particles[i].x = xd[3*i+0];
+			particles[i].y = xd[3*i+1];
+			particles[i].z = xd[3*i+2];
+			particles[i].vx = vd[3*i+0];
+			particles[i].vy = vd[3*i+1];
+			particles[i].vz = vd[3*i+2];
+			if (ri_ias15->block_dt[i]<dt_min) dt_min = ri_ias15->block_dt[i];
+		}
+		reb_integrator_ias15_clear(r);
+		r->dt = copysign(dt_min, r->dt);
+		r->dt_last_done = 0.;
+		reb_update_acceleration(r);
+		return 0; // Step rejected.
+	}
+
+	for(int i=0;i<N;i++) {
+		particles[i].x = x0[3*i+0];	// Set final position
+		particles[i].y = x0[3*i+1];
+		particles[i].z = x0[3*i+2];
+		particles[i].vx = v0[3*i+0];	// Set final velocity
+		particles[i].vy = v0[3*i+1];
+		particles[i].vz = v0[3*i+2];
+	}
+	const double dt_done = r->dt;
+	r->dt = reb_integrator_ias15_block_assign_levels(r, &blk);
+	r->t += dt_done;
+	r->dt_last_done = dt_done;
+	ri_ias15->dense_N = 0;	// Dense output is not available.
 	return 1; // Success.
 }
 
 static void predict_next_step(double ratio, int N3,  const struct reb_dpconst7 _e, const struct reb_dpconst7 _b, const struct reb_dpconst7 e, const struct reb_dpconst7 b){
     if (ratio>20.){
         // Do not predict if stepsize increase is very large. 
+#pragma omp for simd
         for(int k=0;k<N3;++k) {
             e.p0[k] = 0.; e.p1[k] = 0.; e.p2[k] = 0.; e.p3[k] = 0.; e.p4[k] = 0.; e.p5[k] = 0.; e.p6[k] = 0.;
             b.p0[k] = 0.; b.p1[k] = 0.; b.p2[k] = 0.; b.p3[k] = 0.; b.p4[k] = 0.; b.p5[k] = 0.; b.p6[k] = 0.;
@@ -614,6 +1484,7 @@ static void predict_next_step(double ratio, int N3,  const struct reb_dpconst7 _
         const double q6 = q3 * q3;
         const double q7 = q3 * q4;
 
+#pragma omp for simd
         for(int k=0;k<N3;++k) {
             double be0 = _b.p0[k] - _e.p0[k];
             double be1 = _b.p1[k] - _e.p1[k];
@@ -644,6 +1515,7 @@ static void predict_next_step(double ratio, int N3,  const struct reb_dpconst7 _
 }
 
 static void copybuffers(const struct reb_dpconst7 _a, const struct reb_dpconst7 _b, int N3){
+#pragma omp for simd
 	for (int i=0;i<N3;i++){	
 		_b.p0[i] = _a.p0[i];
 		_b.p1[i] = _a.p1[i];
@@ -659,6 +1531,59 @@ static void copybuffers(const struct reb_dpconst7 _a, const struct reb_dpconst7
 //	}
 }
 
+int reb_integrator_ias15_dense_output(struct reb_simulation* const r, const double t, struct reb_particle* const particles){
+	const int N = r->N;
+	const double dt_done = r->dt_last_done;
+	if (r->integrator!=REB_INTEGRATOR_IAS15 || r->ri_ias15.dense_N!=N || dt_done==0.){
+		return 0; // No step available.
+	}
+	// Position in the last step, 0 at the beginning and 1 at the end.
+	const double t_beginning = r->t - dt_done;
+	double hn = (t - t_beginning)/dt_done;
+	if (hn<-1e-12 || hn>1.+1e-12){	// Allow for round-off errors at the boundaries.
+		return 0; // Not in the last step.
+	}
+	if (hn<0.) hn = 0.;
+	if (hn>1.) hn = 1.;
+	// Same coefficients as used for predicting positions and velocities during the step.
+	double s[9];
+	s[0] = dt_done * hn;
+	s[1] = s[0] * s[0] / 2.;
+	s[2] = s[1] * hn / 3.;
+	s[3] = s[2] * hn / 2.;
+	s[4] = 3. * s[3] * hn / 5.;
+	s[5] = 2. * s[4] * hn / 3.;
+	s[6] = 5. * s[5] * hn / 7.;
+	s[7] = 3. * s[6] * hn / 4.;
+	s[8] = 7. * s[7] * hn / 9.;
+	double sv[8];
+	sv[0] = dt_done * hn;
+	sv[1] =      sv[0] * hn / 2.;
+	sv[2] = 2. * sv[1] * hn / 3.;
+	sv[3] = 3. * sv[2] * hn / 4.;
+	sv[4] = 4. * sv[3] * hn / 5.;
+	sv[5] = 5. * sv[4] * hn / 6.;
+	sv[6] = 6. * sv[5] * hn / 7.;
+	sv[7] = 7. * sv[6] * hn / 8.;
+
+	// The b values of the last step are stored in br until the next step succeeds.
+	const double* restrict const xd = r->ri_ias15.xd; 
+	const double* restrict const vd = r->ri_ias15.vd; 
+	const double* restrict const a0 = r->ri_ias15.a0; 
+	const struct reb_dpconst7 b  = dpcast(r->ri_ias15.br);
+	for(int i=0;i<N;i++) {
+		particles[i] = r->particles[i];
+		double* const x = &(particles[i].x);
+		double* const v = &(particles[i].vx);
+		for(int j=0;j<3;j++) {
+			const int k = 3*i+j;
+			x[j] = xd[k] + (s[8]*b.p6[k] + s[7]*b.p5[k] + s[6]*b.p4[k] + s[5]*b.p3[k] + s[4]*b.p2[k] + s[3]*b.p1[k] + s[2]*b.p0[k] + s[1]*a0[k] + s[0]*vd[k]);
+			v[j] = vd[k] + (sv[7]*b.p6[k] + sv[6]*b.p5[k] + sv[5]*b.p4[k] + sv[4]*b.p3[k] + sv[3]*b.p2[k] + sv[2]*b.p1[k] + sv[1]*b.p0[k] + sv[0]*a0[k]);
+		}
+	}
+	return 1;
+}
+
 // Do nothing here. This is only used in a leapfrog-like DKD integrator. IAS15 performs one complete timestep.
 void reb_integrator_ias15_part1(struct reb_simulation* r){
 }
@@ -667,14 +1592,35 @@ void reb_integrator_ias15_part2(struct reb_simulation* r){
 #ifdef GENERATE_CONSTANTS
 	integrator_generate_constants();
 #endif  // GENERATE_CONSTANTS
-	// Try until a step was successful.
-	while(!reb_integrator_ias15_step(r));
+	if (r->ri_ias15.block_levels && !reb_integrator_ias15_block_supported(r)){
+		reb_warning("IAS15 block timesteps are not supported with the current settings. Using a global timestep.");
+		r->ri_ias15.block_levels = 0;
+	}
+	if (reb_integrator_ias15_interaction_lists(r)){
+		// The tree is not updated during the step. Walk it only once.
+		reb_gravity_interactions_build(r);
+	}
+	if (r->ri_ias15.block_levels && r->N){
+		const int L_max = (r->ri_ias15.block_levels<REB_IAS15_BLOCK_LEVELS_MAX)?r->ri_ias15.block_levels:REB_IAS15_BLOCK_LEVELS_MAX;
+		if (r->ri_ias15.block_N==r->N && reb_integrator_ias15_block_step(r, L_max)){
+			return;
+		}
+		// The levels are not known yet or the block step has been rejected. 
+		// Do a global step and find the levels from its error estimates.
+		while(!reb_integrator_ias15_step(r));
+		reb_integrator_ias15_block_init(r, L_max);
+	}else{
+		// Try until a step was successful.
+		while(!reb_integrator_ias15_step(r));
+	}
 }
 
 void reb_integrator_ias15_synchronize(struct reb_simulation* r){
 }
 void reb_integrator_ias15_clear(struct reb_simulation* r){
 	const int N3 = r->ri_ias15.allocatedN;
+	r->ri_ias15.dense_N = 0;
+	r->ri_ias15.block_N = 0;
     if (N3){
         clear_dp7(&(r->ri_ias15.g),N3);
         clear_dp7(&(r->ri_ias15.e),N3);
@@ -695,26 +1641,36 @@ void reb_integrator_ias15_clear(struct reb_simulation* r){
 
 void reb_integrator_ias15_reset(struct reb_simulation* r){
 	r->ri_ias15.allocatedN 	= 0;
-	free_dp7(&(r->ri_ias15.g));
-	free_dp7(&(r->ri_ias15.e));
-	free_dp7(&(r->ri_ias15.b));
-	free_dp7(&(r->ri_ias15.csb));
-	free_dp7(&(r->ri_ias15.er));
-	free_dp7(&(r->ri_ias15.br));
-	free(r->ri_ias15.at);
+	r->ri_ias15.arena_allocatedN = 0;
+	r->ri_ias15.dense_N = 0;
+	free(r->ri_ias15.arena);
+	r->ri_ias15.arena =  NULL;
+	set_dp7_null(&(r->ri_ias15.g));
+	set_dp7_null(&(r->ri_ias15.e));
+	set_dp7_null(&(r->ri_ias15.b));
+	set_dp7_null(&(r->ri_ias15.csb));
+	set_dp7_null(&(r->ri_ias15.er));
+	set_dp7_null(&(r->ri_ias15.br));
 	r->ri_ias15.at =  NULL;
-	free(r->ri_ias15.x0);
 	r->ri_ias15.x0 =  NULL;
-	free(r->ri_ias15.v0);
 	r->ri_ias15.v0 =  NULL;
-	free(r->ri_ias15.a0);
 	r->ri_ias15.a0 =  NULL;
-	free(r->ri_ias15.csx);
 	r->ri_ias15.csx=  NULL;
-	free(r->ri_ias15.csv);
 	r->ri_ias15.csv=  NULL;
-	free(r->ri_ias15.csa0);
 	r->ri_ias15.csa0 =  NULL;
+	r->ri_ias15.xd =  NULL;
+	r->ri_ias15.vd =  NULL;
+	r->ri_ias15.block_allocatedN = 0;
+	r->ri_ias15.block_N = 0;
+	free(r->ri_ias15.block_level);
+	r->ri_ias15.block_level = NULL;
+	free(r->ri_ias15.block_index);
+	r->ri_ias15.block_index = NULL;
+	free(r->ri_ias15.block_dt);
+	r->ri_ias15.block_dt = NULL;
+	r->ri_ias15.block_nodes_allocatedN = 0;
+	free(r->ri_ias15.block_nodes);
+	r->ri_ias15.block_nodes = NULL;
 }
 
 #ifdef GENERATE_CONSTANTS
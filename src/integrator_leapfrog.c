@@ -33,10 +33,212 @@
 #include <math.h>
 #include <time.h>
 #include "rebound.h"
+#include "integrator_leapfrog.h"
+#include "gravity.h"
+#include "boundary.h"
+#include "tree.h"
+#include "profiling.h"
+
+/**
+ * @brief Maximum number of block timestep levels.
+ */
+#define REB_LEAPFROG_BLOCK_LEVELS_MAX 16
+
+// Block timesteps (Kick-Drift-Kick)
+//
+// A timestep dt is divided into 2^L substeps of length h = dt/2^L. 
+// A particle on level l is kicked by half of its own timestep dt/2^l at
+// the beginning and at the end of that timestep. All particles are
+// drifted together, but only up to the next substep at which any 
+// particle's timestep ends. There, the tree is updated to the new
+// positions, the accelerations of the particles whose timesteps end are
+// calculated, and these particles get their closing kick, a new level
+// and the opening kick of their next timestep. A particle can only move to
+// a level whose timesteps start at the current substep. The closing kicks
+// at the end of dt use the accelerations that reb_step() calculates after
+// part1. These are also used for the opening kicks of the next timestep.
+
+/**
+ * @brief Returns 1 if block timesteps can be used with the current settings, 0 otherwise.
+ */
+static int reb_integrator_leapfrog_block_supported(struct reb_simulation* const r){
+#ifdef MPI
+	return 0;
+#endif // MPI
+	if (r->gravity!=REB_GRAVITY_BASIC && r->gravity!=REB_GRAVITY_TREE && r->gravity!=REB_GRAVITY_NONE) return 0;
+	if (r->softening<=0.) return 0;
+	if (r->N_var) return 0;
+	if (r->contact!=REB_CONTACT_NONE) return 0;
+	return 1;
+}
+
+/**
+ * @brief Returns the level of the longest timestep that satisfies the timestep criterion.
+ * @param l_min The level is not smaller than l_min.
+ */
+static int reb_integrator_leapfrog_block_level(const struct reb_simulation* const r, const struct reb_particle* const p, const int L, const int l_min){
+	const double a2 = p->ax*p->ax + p->ay*p->ay + p->az*p->az;
+	const double dt = fabs(r->dt);
+	// Compare squares: dt/2^l < sqrt(2*eta*softening/|a|)
+	const double dt2_max = 2.*r->ri_leapfrog.block_eta*r->softening;
+	int l = l_min;
+	while (l<L && ldexp(dt,-l)*ldexp(dt,-l)*sqrt(a2)>dt2_max){
+		l++;
+	}
+	return l;
+}
+
+/**
+ * @brief Updates the tree to the current particle positions (same as in reb_step()).
+ * @details This might remove particles which left the box and changes the order of particles.
+ */
+static void reb_integrator_leapfrog_block_tree_update(struct reb_simulation* const r){
+	if (r->gravity==REB_GRAVITY_TREE){
+		reb_boundary_check(r);
+		reb_tree_update(r);
+		reb_tree_update_gravity_data(r);
+	}
+}
+
+/**
+ * @brief Counts the particles on levels l and higher for 0<=l<=L.
+ */
+static void reb_integrator_leapfrog_block_level_N(const int* const level, const int N, const int L, int* const level_N){
+	for (int l=0;l<=L;l++){
+		level_N[l] = 0;
+	}
+	for (int i=0;i<N;i++){
+		level_N[level[i]]++;
+	}
+	for (int l=L-1;l>=0;l--){
+		level_N[l] += level_N[l+1];
+	}
+}
+
+/**
+ * @brief Calculates the accelerations of all particles at the beginning of a timestep.
+ * @details Only needed if the accelerations of the last timestep are not available.
+ */
+static void reb_integrator_leapfrog_block_acceleration(struct reb_simulation* const r){
+	reb_integrator_leapfrog_block_tree_update(r);
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
+	reb_calculate_acceleration(r);
+	if (r->additional_forces) r->additional_forces(r);
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
+}
+
+/**
+ * @brief Drifts all particles.
+ */
+static void reb_integrator_leapfrog_block_drift(struct reb_simulation* const r, const double dt){
+	const int N = r->N;
+	struct reb_particle* restrict const particles = r->particles;
+#pragma omp parallel for schedule(guided)
+	for (int i=0;i<N;i++){
+		particles[i].x  += dt * particles[i].vx;
+		particles[i].y  += dt * particles[i].vy;
+		particles[i].z  += dt * particles[i].vz;
+	}
+}
+
+/**
+ * @brief Kicks particle i by half of the timestep of its level.
+ */
+static inline void reb_integrator_leapfrog_block_kick(struct reb_simulation* const r, const int i){
+	struct reb_particle* const p = &(r->particles[i]);
+	const double dt2 = 0.5*ldexp(r->dt,-r->ri_leapfrog.block_level[i]);
+	p->vx += dt2 * p->ax;
+	p->vy += dt2 * p->ay;
+	p->vz += dt2 * p->az;
+}
+
+/**
+ * @brief Does everything of a block timestep except for the final closing kicks.
+ */
+static void reb_integrator_leapfrog_block_part1(struct reb_simulation* const r){
+	struct reb_simulation_integrator_leapfrog* const ri_leapfrog = &(r->ri_leapfrog);
+	const int L = ri_leapfrog->block_levels<REB_LEAPFROG_BLOCK_LEVELS_MAX?ri_leapfrog->block_levels:REB_LEAPFROG_BLOCK_LEVELS_MAX;
+	if (ri_leapfrog->block_N!=r->N){
+		reb_integrator_leapfrog_block_acceleration(r);
+	}
+	int N = r->N;
+	if (ri_leapfrog->block_allocatedN<N){
+		ri_leapfrog->block_allocatedN = N;
+		ri_leapfrog->block_level = realloc(ri_leapfrog->block_level, sizeof(int)*N);
+		ri_leapfrog->block_index = realloc(ri_leapfrog->block_index, sizeof(int)*N);
+	}
+	int* const level = ri_leapfrog->block_level;
+	int* const index = ri_leapfrog->block_index;
+	for (int i=0;i<N;i++){
+		level[i] = reb_integrator_leapfrog_block_level(r, &(r->particles[i]), L, 0);
+		reb_integrator_leapfrog_block_kick(r, i);
+	}
+	// Number of particles on levels l and higher.
+	int level_N[REB_LEAPFROG_BLOCK_LEVELS_MAX+1];
+	reb_integrator_leapfrog_block_level_N(level, N, L, level_N);
+
+	const double t0 = r->t;
+	const double h = ldexp(r->dt,-L);
+	const int substeps = 1<<L;
+	int drifted = 0; // Number of substeps the particles have been drifted.
+	for (int s=1;s<substeps;s++){
+		// Timesteps on levels l_min and higher end at substep s.
+		int l_min = L;
+		while (((s>>(L-l_min))&1)==0){
+			l_min--;
+		}
+		if (level_N[l_min]==0) continue;
+		reb_integrator_leapfrog_block_drift(r, (s-drifted)*h);
+		drifted = s;
+		r->t = t0 + s*h;
+
+		reb_integrator_leapfrog_block_tree_update(r);
+		if (r->N!=N){
+			// Particles have been removed.
+			N = r->N;
+			reb_integrator_leapfrog_block_level_N(level, N, L, level_N);
+			if (level_N[l_min]==0) continue;
+		}
+		int index_N = 0;
+		for (int i=0;i<N;i++){
+			if (level[i]>=l_min){
+				index[index_N++] = i;
+			}
+		}
+		PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
+		reb_calculate_acceleration_for_particles(r, index, index_N);
+		if (r->additional_forces) r->additional_forces(r);
+		PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
+
+		for (int k=0;k<index_N;k++){
+			const int i = index[k];
+			reb_integrator_leapfrog_block_kick(r, i);
+			for (int l=0;l<=level[i];l++){
+				level_N[l]--;
+			}
+			level[i] = reb_integrator_leapfrog_block_level(r, &(r->particles[i]), L, l_min);
+			for (int l=0;l<=level[i];l++){
+				level_N[l]++;
+			}
+			reb_integrator_leapfrog_block_kick(r, i);
+		}
+	}
+	reb_integrator_leapfrog_block_drift(r, (substeps-drifted)*h);
+	r->t = t0 + r->dt;
+}
 
 // Leapfrog integrator (Drift-Kick-Drift)
 // for non-rotating frame.
 void reb_integrator_leapfrog_part1(struct reb_simulation* r){
+	if (r->ri_leapfrog.block_levels){
+		if (reb_integrator_leapfrog_block_supported(r)){
+			reb_integrator_leapfrog_block_part1(r);
+			return;
+		}
+		reb_warning("Block timesteps are not supported with the current settings. Using a global timestep.");
+		r->ri_leapfrog.block_levels = 0;
+		r->ri_leapfrog.block_N = 0;
+	}
 	const int N = r->N;
 	struct reb_particle* restrict const particles = r->particles;
 	const double dt = r->dt;
@@ -51,6 +253,15 @@ void reb_integrator_leapfrog_part1(struct reb_simulation* r){
 void reb_integrator_leapfrog_part2(struct reb_simulation* r){
 	const int N = r->N;
 	struct reb_particle* restrict const particles = r->particles;
+	if (r->ri_leapfrog.block_levels){
+		// Closing kicks at the end of the timestep.
+		for (int i=0;i<N;i++){
+			reb_integrator_leapfrog_block_kick(r, i);
+		}
+		r->ri_leapfrog.block_N = N;
+		r->dt_last_done = r->dt;
+		return;
+	}
 	const double dt = r->dt;
 #pragma omp parallel for schedule(guided)
 	for (int i=0;i<N;i++){
@@ -63,12 +274,28 @@ void reb_integrator_leapfrog_part2(struct reb_simulation* r){
 	}
 	r->t+=dt/2.;
 	r->dt_last_done = r->dt;
+	r->ri_leapfrog.block_N = 0;
 }
 	
 void reb_integrator_leapfrog_synchronize(struct reb_simulation* r){
-	// Do nothing.
+	// Particles might get modified after this. 
+	// Recalculate the accelerations at the beginning of the next block timestep.
+	r->ri_leapfrog.block_N = 0;
+}
+
+void reb_integrator_leapfrog_swap(struct reb_simulation* const r, const int i, const int j){
+	struct reb_simulation_integrator_leapfrog* const ri_leapfrog = &(r->ri_leapfrog);
+	if (ri_leapfrog->block_level==NULL || i==j || i>=ri_leapfrog->block_allocatedN || j>=ri_leapfrog->block_allocatedN) return;
+	const int level = ri_leapfrog->block_level[i];
+	ri_leapfrog->block_level[i] = ri_leapfrog->block_level[j];
+	ri_leapfrog->block_level[j] = level;
 }
 
 void reb_integrator_leapfrog_reset(struct reb_simulation* r){
-	// Do nothing.
+	r->ri_leapfrog.block_allocatedN = 0;
+	r->ri_leapfrog.block_N = 0;
+	free(r->ri_leapfrog.block_level);
+	r->ri_leapfrog.block_level = NULL;
+	free(r->ri_leapfrog.block_index);
+	r->ri_leapfrog.block_index = NULL;
 }
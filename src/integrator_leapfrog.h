@@ -28,4 +28,9 @@ void reb_integrator_leapfrog_part1(struct reb_simulation* r);          ///< Inte
 void reb_integrator_leapfrog_part2(struct reb_simulation* r);          ///< Internal function used to call a specific integrator
 void reb_integrator_leapfrog_synchronize(struct reb_simulation* r);    ///< Internal function used to call a specific integrator
 void reb_integrator_leapfrog_reset(struct reb_simulation* r);          ///< Internal function used to call a specific integrator
+/**
+  * Swaps the block timestep levels of particles i and j. Called by the tree 
+  * when it moves particles within the particle array.
+  */
+void reb_integrator_leapfrog_swap(struct reb_simulation* const r, const int i, const int j);
 #endif
@@ -140,6 +140,11 @@ static void stiefel_Gs3(double *restrict Gs, double beta, double X) {
 
 #define WHFAST_NMAX_QUART 64 	///< Maximum number of iterations for quartic solver
 #define WHFAST_NMAX_NEWT  32	///< Maximum number of iterations for Newton's method
+/**
+ * @brief Minimum number of particles for which the Kepler steps are distributed over OpenMP threads.
+ * @details For fewer particles, starting a parallel region takes longer than the Kepler steps.
+ */
+#define WHFAST_OPENMP_N 64
 /****************************** 
  * Keplerian motion           */
 static void kepler_step(const struct reb_simulation* const r, struct reb_particle* const restrict p_j, const double* const eta,  const double G, unsigned int i, double _dt, unsigned int* timestep_warning){
@@ -181,7 +186,7 @@ double X;
 	if(fastabs(X-oldX) > 0.01*X_per_period){
 		// Linear guess
 		X = beta*_dt/M;
-		static double prevX[WHFAST_NMAX_QUART+1];
+		double prevX[WHFAST_NMAX_QUART+1];
 		for(int n_lag=1; n_lag < WHFAST_NMAX_QUART; n_lag++){
 			stiefel_Gs3(Gs, beta, X);
 			const double f = r0*X + eta0*Gs[2] + zeta0*Gs[3] - _dt;
@@ -228,9 +233,8 @@ double X;
 			double sqrt_beta = sqrt(beta);
 			double invperiod = sqrt_beta*beta/(2.*M_PI*M);
 			double X_per_period = 2.*M_PI/sqrt_beta;
-			if (fabs(_dt)*invperiod>1. && *timestep_warning == 0){
+			if (fabs(_dt)*invperiod>1.){
 				(*timestep_warning)++;
-				reb_warning("Timestep is larger than at least one orbital period.");
 			}
 			X_min = X_per_period * floor(_dt*invperiod);
 			X_max = X_min + X_per_period;
@@ -468,8 +472,15 @@ static void interaction_step(struct reb_simulation* const r, struct reb_particle
  * DKD Scheme                */
 
 static void kepler_drift(const struct reb_simulation* const r, struct reb_particle* const p_j, const double* const eta, const double G, const double _dt, unsigned int* timestep_warning, const int N_real){
-	for (unsigned int i=1;i<N_real;i++){
-		kepler_step(r, p_j, eta, G, i, _dt, timestep_warning);
+	// Number of particles for which the timestep is larger than the orbital period.
+	unsigned int timestep_warnings = 0;
+#pragma omp parallel for schedule(guided) reduction(+:timestep_warnings) if(N_real>=WHFAST_OPENMP_N)
+	for (int i=1;i<N_real;i++){
+		kepler_step(r, p_j, eta, G, i, _dt, &timestep_warnings);
+	}
+	if (timestep_warnings && *timestep_warning == 0){
+		(*timestep_warning)++;
+		reb_warning("Timestep is larger than at least one orbital period.");
 	}
 	p_j[0].x += _dt*p_j[0].vx;
 	p_j[0].y += _dt*p_j[0].vy;
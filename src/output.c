@@ -33,6 +33,7 @@
 #include "rebound.h"
 #include "tools.h"
 #include "output.h"
+#include "profiling.h"
 #include "integrator_sei.h"
 #include "input.h"
 #ifdef MPI
@@ -60,25 +61,6 @@ int reb_output_check(struct reb_simulation* r, double interval){
 }
 
 
-#ifdef PROFILING
-#warning PROFILING enabled. Rebound is NOT thread-safe.
-double profiling_time_sum[PROFILING_CAT_NUM];
-double profiling_time_initial 	= 0;
-double profiling_timing_initial	= 0;
-double profiling_time_final 	= 0;
-void profiling_start(void){
-	struct timeval tim;
-	gettimeofday(&tim, NULL);
-	profiling_time_initial = tim.tv_sec+(tim.tv_usec/1000000.0);
-}
-void profiling_stop(int cat){
-	struct timeval tim;
-	gettimeofday(&tim, NULL);
-	profiling_time_final = tim.tv_sec+(tim.tv_usec/1000000.0);
-	profiling_time_sum[cat] += profiling_time_final - profiling_time_initial;
-}
-#endif // PROFILING
-
 void reb_output_timing(struct reb_simulation* r, const double tmax){
 	const int N = r->N;
 #ifdef MPI
@@ -97,7 +79,7 @@ void reb_output_timing(struct reb_simulation* r, const double tmax){
 		printf("\r");
 #ifdef PROFILING
 		fputs("\033[A\033[2K",stdout);
-		for (int i=0;i<=PROFILING_CAT_NUM;i++){
+		for (int i=0;i<=REB_PROFILING_CAT_NUM;i++){
 			fputs("\033[A\033[2K",stdout);
 		}
 #endif // PROFILING
@@ -117,43 +99,43 @@ void reb_output_timing(struct reb_simulation* r, const double tmax){
 		printf("t/tmax= %5.2f%%",r->t/tmax*100.0);
 	}
 #ifdef PROFILING
-	if (profiling_timing_initial==0){
-		struct timeval tim;
-		gettimeofday(&tim, NULL);
-		profiling_timing_initial = tim.tv_sec+(tim.tv_usec/1000000.0);
-	}
-	printf("\nCATEGORY       TIME \n");
+	const int _hw = r->profiling_hw_counters && reb_profiling_hw_available(r);
+	printf("\nCATEGORY             TIME  IMBAL%s\n",_hw?"    IPC  L1D MISSES  LLC MISSES  BR MISSES":"");
+	const double _wall = reb_profiling_get_wall_time(r);
 	double _sum = 0;
-	for (int i=0;i<=PROFILING_CAT_NUM;i++){
-		switch (i){
-			case PROFILING_CAT_INTEGRATOR:
-				printf("Integrator     ");
-				break;
-			case PROFILING_CAT_BOUNDARY:
-				printf("Boundary check ");
-				break;
-			case PROFILING_CAT_GRAVITY:
-				printf("Gravity/Forces ");
-				break;
-			case PROFILING_CAT_COLLISION:
-				printf("Collisions     ");
-				break;
-#ifdef OPENGL
-			case PROFILING_CAT_VISUALIZATION:
-				printf("Visualization  ");
-				break;
-#endif // OPENGL
-			case PROFILING_CAT_NUM:
-				printf("Other          ");
-				break;
+	for (int i=0;i<REB_PROFILING_CAT_NUM;i++){
+		const double _time = reb_profiling_get_time_inclusive(r, i, -1);
+		if (reb_profiling_get_parent(i)==-1){
+			printf("%-20s ",reb_profiling_get_name(i));
+			_sum += _time;
+		}else{
+			printf("  %-18s ",reb_profiling_get_name(i));
+		}
+		printf("%5.2f%%",_wall>0?_time/_wall*100.:0.);
+		// Ratio of the slowest thread to the average thread inside parallel regions
+		double _parallel_max = 0.;
+		for (int t=0;t<r->profiling_threads_N;t++){
+			const double _parallel = reb_profiling_get_parallel_time(r, i, t);
+			if (_parallel>_parallel_max) _parallel_max = _parallel;
 		}
-		if (i==PROFILING_CAT_NUM){
-			printf("%5.2f%%",(1.-_sum/(profiling_time_final - profiling_timing_initial))*100.);
+		const double _parallel_sum = reb_profiling_get_parallel_time(r, i, -1);
+		if (_parallel_sum>0){
+			printf("  %5.2f",_parallel_max*r->profiling_threads_N/_parallel_sum);
 		}else{
-			printf("%5.2f%%\n",profiling_time_sum[i]/(profiling_time_final - profiling_timing_initial)*100.);
-			_sum += profiling_time_sum[i];
+			printf("       ");
+		}
+		if (_hw){
+			const unsigned long long _cycles = reb_profiling_get_hw_inclusive(r, i, REB_PROFILING_HW_CYCLES, -1);
+			const unsigned long long _instructions = reb_profiling_get_hw_inclusive(r, i, REB_PROFILING_HW_INSTRUCTIONS, -1);
+			printf("  %5.2f  %10llu  %10llu %10llu",
+				_cycles>0?(double)_instructions/(double)_cycles:0.,
+				reb_profiling_get_hw_inclusive(r, i, REB_PROFILING_HW_L1D_MISSES, -1),
+				reb_profiling_get_hw_inclusive(r, i, REB_PROFILING_HW_LLC_MISSES, -1),
+				reb_profiling_get_hw_inclusive(r, i, REB_PROFILING_HW_BRANCH_MISSES, -1));
 		}
+		printf("\n");
 	}
+	printf("%-20s %5.2f%%","other",_wall>0?(1.-_sum/_wall)*100.:0.);
 #endif // PROFILING
 	fflush(stdout);
 	r->output_timing_last = temp;
@@ -287,3 +269,115 @@ void reb_output_velocity_dispersion(struct reb_simulation* r, char* filename){
 	fprintf(of,"%e\t%e\t%e\t%e\t%e\t%e\t%e\n",r->t,A_tot.x,A_tot.y,A_tot.z,Q_tot.x,Q_tot.y,Q_tot.z);
 	fclose(of);
 }
+
+/**
+ * @brief Opens a file for the profiling output (one file per node if MPI is used).
+ */
+static FILE* reb_output_profiling_open(struct reb_simulation* r, char* filename){
+#ifdef MPI
+	char filename_mpi[1024];
+	sprintf(filename_mpi,"%s_%d",filename,r->mpi_id);
+	FILE* of = fopen(filename_mpi,"w");
+#else // MPI
+	FILE* of = fopen(filename,"w");
+#endif // MPI
+	if (of==NULL){
+		reb_exit("Can not open file.");
+	}
+	return of;
+}
+
+void reb_output_profiling_csv(struct reb_simulation* r, char* filename){
+	FILE* of = reb_output_profiling_open(r, filename);
+	// Hardware counter columns are only written if they were requested.
+	const int hw = r->profiling_hw_counters;
+	fprintf(of,"category,parent,thread,calls,time,time_inclusive,parallel_calls,parallel_time");
+	for (int k=0;hw && k<REB_PROFILING_HW_NUM;k++){
+		fprintf(of,",%s",reb_profiling_get_hw_name(k));
+	}
+	fprintf(of,"\n");
+	for (int i=0;i<REB_PROFILING_CAT_NUM;i++){
+		const int parent = reb_profiling_get_parent(i);
+		for (int t=-1;t<r->profiling_threads_N;t++){
+			fprintf(of,"%s,%s,%d,%ld,%.9e,%.9e,%ld,%.9e",
+				reb_profiling_get_name(i),
+				parent==-1?"":reb_profiling_get_name(parent),
+				t,
+				reb_profiling_get_calls(r,i,t),
+				reb_profiling_get_time(r,i,t),
+				reb_profiling_get_time_inclusive(r,i,t),
+				reb_profiling_get_parallel_calls(r,i,t),
+				reb_profiling_get_parallel_time(r,i,t));
+			for (int k=0;hw && k<REB_PROFILING_HW_NUM;k++){
+				fprintf(of,",%llu",reb_profiling_get_hw(r,i,k,t));
+			}
+			fprintf(of,"\n");
+		}
+	}
+	fclose(of);
+}
+
+void reb_output_profiling_json(struct reb_simulation* r, char* filename){
+	FILE* of = reb_output_profiling_open(r, filename);
+	fprintf(of,"{\n  \"wall_time\": %.9e,\n  \"threads\": %d,\n",reb_profiling_get_wall_time(r),r->profiling_threads_N);
+	if (r->profiling_hw_counters){
+		fprintf(of,"  \"hw_counters_available\": %s,\n",reb_profiling_hw_available(r)?"true":"false");
+	}
+	fprintf(of,"  \"categories\": [\n");
+	for (int i=0;i<REB_PROFILING_CAT_NUM;i++){
+		const int parent = reb_profiling_get_parent(i);
+		fprintf(of,"    {\"name\": \"%s\", ",reb_profiling_get_name(i));
+		if (parent==-1){
+			fprintf(of,"\"parent\": null, ");
+		}else{
+			fprintf(of,"\"parent\": \"%s\", ",reb_profiling_get_name(parent));
+		}
+		fprintf(of,"\"calls\": %ld, \"time\": %.9e, \"time_inclusive\": %.9e, \"time_per_thread\": [",
+			reb_profiling_get_calls(r,i,-1),
+			reb_profiling_get_time(r,i,-1),
+			reb_profiling_get_time_inclusive(r,i,-1));
+		for (int t=0;t<r->profiling_threads_N;t++){
+			fprintf(of,"%s%.9e",t?", ":"",reb_profiling_get_time(r,i,t));
+		}
+		fprintf(of,"], \"parallel_calls\": %ld, \"parallel_time_per_thread\": [",reb_profiling_get_parallel_calls(r,i,-1));
+		for (int t=0;t<r->profiling_threads_N;t++){
+			fprintf(of,"%s%.9e",t?", ":"",reb_profiling_get_parallel_time(r,i,t));
+		}
+		fprintf(of,"]");
+		if (r->profiling_hw_counters){
+			fprintf(of,", \"hw_counters\": {");
+			for (int k=0;k<REB_PROFILING_HW_NUM;k++){
+				fprintf(of,"%s\"%s\": %llu",k?", ":"",reb_profiling_get_hw_name(k),reb_profiling_get_hw(r,i,k,-1));
+			}
+			fprintf(of,"}");
+		}
+		fprintf(of,"}%s\n",i<REB_PROFILING_CAT_NUM-1?",":"");
+	}
+	fprintf(of,"  ]\n}\n");
+	fclose(of);
+}
+
+void reb_output_trace(struct reb_simulation* r, char* filename){
+	FILE* of = reb_output_profiling_open(r, filename);
+#ifdef MPI
+	const int pid = r->mpi_id;
+#else // MPI
+	const int pid = 0;
+#endif // MPI
+	fprintf(of,"{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(of,"{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"REBOUND node %d\"}}",pid,pid);
+	for (int t=0;t<r->profiling_threads_N;t++){
+		const struct reb_profiling_counters* const c = &(r->profiling_counters[t]);
+		fprintf(of,",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",pid,t,t);
+		if (c->trace==NULL) continue;
+		// Oldest event first
+		unsigned long first = c->trace_N>(unsigned long)c->trace_allocatedN ? c->trace_N-c->trace_allocatedN : 0;
+		for (unsigned long i=first;i<c->trace_N;i++){
+			const struct reb_trace_event* const e = &(c->trace[i & (c->trace_allocatedN-1)]);
+			fprintf(of,",\n{\"name\": \"%s\", \"cat\": \"rebound\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+				reb_profiling_get_name(e->cat), pid, t, e->start*1e6, e->duration*1e6);
+		}
+	}
+	fprintf(of,"\n]}\n");
+	fclose(of);
+}
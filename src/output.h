@@ -26,27 +26,5 @@
 #define _OUTPUT_H
 struct reb_simulation;
 
-#ifdef PROFILING
-/**
- * Profiling categories
- */
-enum profiling_categories {
-	PROFILING_CAT_INTEGRATOR,
-	PROFILING_CAT_BOUNDARY,
-	PROFILING_CAT_GRAVITY,
-	PROFILING_CAT_COLLISION,
-#ifdef OPENGL
-	PROFILING_CAT_VISUALIZATION,
-#endif // OPENGL
-	PROFILING_CAT_NUM,
-};
-void profiling_start(void);
-void profiling_stop(int cat);
-#define PROFILING_START() profiling_start();	///< Start profiling block 
-#define PROFILING_STOP(C) profiling_stop(C);	///< Stop profiling block 
-#else // PROFILING
-#define PROFILING_START()	///< Start profiling block (dummy, does nothing) 
-#define PROFILING_STOP(C)	///< Stop profiling block (dummy, does nothing)
-#endif // PROFILING
 
 #endif
@@ -56,6 +56,7 @@ static void reb_add_local(struct reb_simulation* const r, struct reb_particle pt
 
 	r->particles[r->N] = pt;
 	r->particles[r->N].sim = r;
+	reb_particle_lookup_insert(r, pt.id, r->N);
 	if (r->gravity==REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE){
 		reb_tree_add_particle_to_tree(r, r->N);
 	}
@@ -108,11 +109,13 @@ EXPORTIT void reb_remove_all(struct reb_simulation* const r){
 	r->N_var 	= 0;
 	free(r->particles);
 	r->particles 	= NULL;
+	reb_particle_lookup_free(r);
 }
 
 EXPORTIT int reb_remove(struct reb_simulation* const r, int index, int keepSorted){
 	if (r->N==1){
 	    r->N = 0;
+		reb_particle_lookup_free(r);
 		fprintf(stderr, "Last particle removed.\n");
 		return 1;
 	}
@@ -124,10 +127,12 @@ EXPORTIT int reb_remove(struct reb_simulation* const r, int index, int keepSorte
 		fprintf(stderr, "\nRemoving particles not supported when calculating MEGNO.  Did not remove particle.\n");
 		return 0;
 	}
+	reb_particle_lookup_delete(r, r->particles[index].id);
 	if(keepSorted){
 	    r->N--;
 		for(int j=index; j<r->N; j++){
 			r->particles[j] = r->particles[j+1];
+			reb_particle_lookup_insert(r, r->particles[j].id, j);
 		}
         if (r->tree_root){
 		    fprintf(stderr, "\nREBOUND cannot remove a particle a tree and keep the particles sorted. Did not remove particle.\n");
@@ -140,6 +145,9 @@ EXPORTIT int reb_remove(struct reb_simulation* const r, int index, int keepSorte
         }else{
 	        r->N--;
 		    r->particles[index] = r->particles[r->N];
+            if (index<r->N){
+                reb_particle_lookup_insert(r, r->particles[index].id, index);
+            }
         }
 	}
 
@@ -148,15 +156,184 @@ EXPORTIT int reb_remove(struct reb_simulation* const r, int index, int keepSorte
 
 EXPORTIT int reb_remove_by_id(struct reb_simulation* const r, int id, int keepSorted){
 	int success = 0;
+	struct reb_particle* p = reb_get_particle_by_id(r, id);
+	if (p){
+		success = reb_remove(r, p - r->particles, keepSorted);
+	}
+
+	if(!success){
+		fprintf(stderr, "\nIndex passed to particles_remove_id (id = %d) not found in particles array.  Did not remove particle.\n", id);
+	}
+	return success;
+}
+
+EXPORTIT struct reb_particle* reb_get_particle_by_id(struct reb_simulation* const r, int id){
+	if (r->particle_lookup_enabled){
+		int index = reb_particle_lookup_get_index(r, id);
+		if (r->particle_lookup_stale || (index>=0 && (index>=r->N || r->particles[index].id!=id))){
+			// Table is out of date (e.g. ids changed manually). Rebuild and try again.
+			reb_particle_lookup_rebuild(r);
+			index = reb_particle_lookup_get_index(r, id);
+		}
+		if (index<0){
+			return NULL;
+		}
+		return &(r->particles[index]);
+	}
 	for(int i=0;i<r->N;i++){
 		if(r->particles[i].id == id){
-			success = reb_remove(r, i, keepSorted);
+			return &(r->particles[i]);
+		}
+	}
+	return NULL;
+}
+
+// Hash table mapping particle ids to indices.
+// Open addressing with linear probing. The table is kept at most half full.
+// Ids do not need to be unique. Like the linear search, the table returns the
+// particle with the lowest index. Particles are only ever moved to a lower 
+// index, so inserting a higher index means that the id is shared.
+
+static inline unsigned int reb_particle_lookup_hash(const int id){
+	return (unsigned int)id * 2654435761u; // Knuth's multiplicative hash
+}
+
+/**
+ * @brief Returns the slot in the hash table containing id, or -1 if id is not in the table.
+ */
+static int reb_particle_lookup_find_slot(const struct reb_simulation* const r, const int id){
+	if (r->particle_lookup_allocatedN==0){
+		return -1;
+	}
+	const unsigned int mask = r->particle_lookup_allocatedN-1;
+	unsigned int slot = reb_particle_lookup_hash(id) & mask;
+	while (r->particle_lookup[slot].index!=-1){
+		if (r->particle_lookup[slot].id==id){
+			return slot;
+		}
+		slot = (slot+1) & mask;
+	}
+	return -1;
+}
+
+/**
+ * @brief Resizes the hash table to newN slots (must be a power of two) and reinserts all entries.
+ */
+static void reb_particle_lookup_resize(struct reb_simulation* const r, const int newN){
+	struct reb_particle_lookup_entry* old = r->particle_lookup;
+	const int oldN = r->particle_lookup_allocatedN;
+	r->particle_lookup = malloc(sizeof(struct reb_particle_lookup_entry)*newN);
+	r->particle_lookup_allocatedN = newN;
+	r->particle_lookup_N = 0;
+	for (int i=0;i<newN;i++){
+		r->particle_lookup[i].index = -1;
+	}
+	for (int i=0;i<oldN;i++){
+		if (old[i].index!=-1){
+			reb_particle_lookup_insert(r, old[i].id, old[i].index);
+			r->particle_lookup[reb_particle_lookup_find_slot(r, old[i].id)].duplicate = old[i].duplicate;
+		}
+	}
+	free(old);
+}
+
+int reb_particle_lookup_get_index(const struct reb_simulation* const r, const int id){
+	const int slot = reb_particle_lookup_find_slot(r, id);
+	if (slot<0){
+		return -1;
+	}
+	return r->particle_lookup[slot].index;
+}
+
+void reb_particle_lookup_insert(struct reb_simulation* const r, const int id, const int index){
+	if (!r->particle_lookup_enabled){
+		r->particle_lookup_stale = 1;
+		return;
+	}
+	if (2*(r->particle_lookup_N+1) > r->particle_lookup_allocatedN){
+		int newN = r->particle_lookup_allocatedN?2*r->particle_lookup_allocatedN:128;
+		reb_particle_lookup_resize(r, newN);
+	}
+	const unsigned int mask = r->particle_lookup_allocatedN-1;
+	unsigned int slot = reb_particle_lookup_hash(id) & mask;
+	while (r->particle_lookup[slot].index!=-1){
+		if (r->particle_lookup[slot].id==id){
+			if (index<r->particle_lookup[slot].index){
+				// Particle moved to a lower index
+				r->particle_lookup[slot].index = index;
+			}else if (index>r->particle_lookup[slot].index){
+				r->particle_lookup[slot].duplicate = 1;
+			}
+			return;
+		}
+		slot = (slot+1) & mask;
+	}
+	r->particle_lookup[slot].id = id;
+	r->particle_lookup[slot].index = index;
+	r->particle_lookup[slot].duplicate = 0;
+	r->particle_lookup_N++;
+}
+
+void reb_particle_lookup_delete(struct reb_simulation* const r, const int id){
+	if (!r->particle_lookup_enabled){
+		r->particle_lookup_stale = 1;
+		return;
+	}
+	int slot = reb_particle_lookup_find_slot(r, id);
+	if (slot<0){
+		return;
+	}
+	if (r->particle_lookup[slot].duplicate){
+		// Other particles might share this id. Their lowest index is not 
+		// known, so the table is rebuilt at the next lookup.
+		r->particle_lookup_stale = 1;
+		return;
+	}
+	// Backward shift deletion. Avoids tombstones.
+	const unsigned int mask = r->particle_lookup_allocatedN-1;
+	unsigned int i = slot;
+	unsigned int j = slot;
+	while (1){
+		j = (j+1) & mask;
+		if (r->particle_lookup[j].index==-1){
 			break;
 		}
+		unsigned int k = reb_particle_lookup_hash(r->particle_lookup[j].id) & mask;
+		// Move entry j into the hole at i unless its home slot k lies cyclically in (i,j].
+		if ( (j>i && (k<=i || k>j)) || (j<i && (k<=i && k>j)) ){
+			r->particle_lookup[i] = r->particle_lookup[j];
+			i = j;
+		}
 	}
+	r->particle_lookup[i].index = -1;
+	r->particle_lookup_N--;
+}
 
-	if(!success){
-		fprintf(stderr, "\nIndex passed to particles_remove_id (id = %d) not found in particles array.  Did not remove particle.\n", id);
+void reb_particle_lookup_rebuild(struct reb_simulation* const r){
+	if (!r->particle_lookup_enabled){
+		return;
 	}
-	return success;
+	int newN = 128;
+	while (newN < 2*r->N){
+		newN *= 2;
+	}
+	free(r->particle_lookup);
+	r->particle_lookup = NULL;
+	r->particle_lookup_allocatedN = 0;
+	reb_particle_lookup_resize(r, newN);
+	for (int i=0;i<r->N;i++){
+		if (r->tree_root && isnan(r->particles[i].y)){
+			continue; // Flagged for removal
+		}
+		reb_particle_lookup_insert(r, r->particles[i].id, i);
+	}
+	r->particle_lookup_stale = 0;
+}
+
+void reb_particle_lookup_free(struct reb_simulation* const r){
+	free(r->particle_lookup);
+	r->particle_lookup = NULL;
+	r->particle_lookup_allocatedN = 0;
+	r->particle_lookup_N = 0;
+	r->particle_lookup_stale = 1;
 }
@@ -35,4 +35,45 @@ struct reb_treecell;
  * @return Index of the rootbox.
  */
 int reb_get_rootbox_for_particle(const struct reb_simulation* const r, struct reb_particle pt);
+
+/**
+ * @brief Returns the index stored in the id lookup table, or -1 if the id is not in the table.
+ * @details The result is not validated against the particles array.
+ * @param r REBOUND simulation to be considered
+ * @param id Particle id.
+ */
+int reb_particle_lookup_get_index(const struct reb_simulation* const r, const int id);
+
+/**
+ * @brief Adds or updates an entry of the id lookup table.
+ * @details If the id is already in the table, the lower index is kept and a 
+ * higher index marks the id as shared by several particles. Particles must only
+ * be moved to lower indices. If particle_lookup_enabled is not set, the table
+ * is only marked as stale.
+ * @param r REBOUND simulation to be considered
+ * @param id Particle id.
+ * @param index New index of the particle in the particles array.
+ */
+void reb_particle_lookup_insert(struct reb_simulation* const r, const int id, const int index);
+
+/**
+ * @brief Removes an id from the id lookup table.
+ * @details If the id is shared by several particles or particle_lookup_enabled
+ * is not set, the table is only marked as stale.
+ * @param r REBOUND simulation to be considered
+ * @param id Particle id.
+ */
+void reb_particle_lookup_delete(struct reb_simulation* const r, const int id);
+
+/**
+ * @brief Rebuilds the id lookup table from the particles array.
+ * @param r REBOUND simulation to be considered
+ */
+void reb_particle_lookup_rebuild(struct reb_simulation* const r);
+
+/**
+ * @brief Frees the id lookup table. It will be rebuilt when needed.
+ * @param r REBOUND simulation to be considered
+ */
+void reb_particle_lookup_free(struct reb_simulation* const r);
 #endif // _PARTICLE_H
@@ -0,0 +1,494 @@
+/**
+ * @file 	profiling.c
+ * @brief 	Per-simulation profiling of the different parts of a timestep.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ * @details	Each thread has its own set of counters, so profiling scopes
+ * can be opened inside OpenMP parallel regions without locking.
+ * Scopes can be nested. Time is always attributed to the innermost
+ * open scope only. The time of a category including all its
+ * subcategories can be obtained with reb_profiling_get_time_inclusive().
+ * If trace_enabled is set, every closed scope is additionally recorded 
+ * in a per-thread ring buffer, which can be written to a file in the 
+ * Chrome trace format with reb_output_trace().
+ * If profiling_hw_counters is set, hardware performance counters are 
+ * read with perf_event_open on Linux and attributed to scopes in the 
+ * same way as the time.
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2016 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif // __linux__
+#include "rebound.h"
+#include "profiling.h"
+#ifdef OPENMP
+#include <omp.h>
+#endif // OPENMP
+
+static const char* reb_profiling_names[REB_PROFILING_CAT_NUM] = {
+	[REB_PROFILING_CAT_INTEGRATOR]		= "integrator",
+	[REB_PROFILING_CAT_INTEGRATOR_PART1]	= "integrator_part1",
+	[REB_PROFILING_CAT_INTEGRATOR_PART2]	= "integrator_part2",
+	[REB_PROFILING_CAT_BOUNDARY]		= "boundary",
+	[REB_PROFILING_CAT_TREE_UPDATE]		= "tree_update",
+	[REB_PROFILING_CAT_GRAVITY]		= "gravity",
+	[REB_PROFILING_CAT_GRAVITY_MULTIPOLES]	= "gravity_multipoles",
+	[REB_PROFILING_CAT_GRAVITY_WALK]	= "gravity_walk",
+	[REB_PROFILING_CAT_COLLISION]		= "collision",
+	[REB_PROFILING_CAT_COLLISION_SEARCH]	= "collision_search",
+	[REB_PROFILING_CAT_COLLISION_RESOLVE]	= "collision_resolve",
+	[REB_PROFILING_CAT_COMMUNICATION]	= "communication",
+	[REB_PROFILING_CAT_VISUALIZATION]	= "visualization",
+};
+
+static const int reb_profiling_parents[REB_PROFILING_CAT_NUM] = {
+	[REB_PROFILING_CAT_INTEGRATOR]		= -1,
+	[REB_PROFILING_CAT_INTEGRATOR_PART1]	= REB_PROFILING_CAT_INTEGRATOR,
+	[REB_PROFILING_CAT_INTEGRATOR_PART2]	= REB_PROFILING_CAT_INTEGRATOR,
+	[REB_PROFILING_CAT_BOUNDARY]		= -1,
+	[REB_PROFILING_CAT_TREE_UPDATE]		= -1,
+	[REB_PROFILING_CAT_GRAVITY]		= -1,
+	[REB_PROFILING_CAT_GRAVITY_MULTIPOLES]	= REB_PROFILING_CAT_GRAVITY,
+	[REB_PROFILING_CAT_GRAVITY_WALK]	= REB_PROFILING_CAT_GRAVITY,
+	[REB_PROFILING_CAT_COLLISION]		= -1,
+	[REB_PROFILING_CAT_COLLISION_SEARCH]	= REB_PROFILING_CAT_COLLISION,
+	[REB_PROFILING_CAT_COLLISION_RESOLVE]	= REB_PROFILING_CAT_COLLISION,
+	[REB_PROFILING_CAT_COMMUNICATION]	= -1,
+	[REB_PROFILING_CAT_VISUALIZATION]	= -1,
+};
+
+static const char* reb_profiling_hw_names[REB_PROFILING_HW_NUM] = {
+	[REB_PROFILING_HW_CYCLES]		= "cycles",
+	[REB_PROFILING_HW_INSTRUCTIONS]		= "instructions",
+	[REB_PROFILING_HW_L1D_MISSES]		= "l1d_misses",
+	[REB_PROFILING_HW_LLC_MISSES]		= "llc_misses",
+	[REB_PROFILING_HW_BRANCH_MISSES]	= "branch_misses",
+};
+
+double reb_profiling_clock(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+}
+
+/**
+ * @brief Returns 1 if called from inside an OpenMP parallel region.
+ * @details Scopes opened inside parallel regions do not contribute to the 
+ * exclusive times. Otherwise the time of a parallel region would be counted
+ * once per thread.
+ */
+static int reb_profiling_in_parallel(void){
+#ifdef OPENMP
+	return omp_in_parallel();
+#else // OPENMP
+	return 0;
+#endif // OPENMP
+}
+
+static int reb_profiling_thread_num(void){
+#ifdef OPENMP
+	return omp_get_thread_num();
+#else // OPENMP
+	return 0;
+#endif // OPENMP
+}
+
+/**
+ * @brief Reads the current values of the hardware counters of the calling thread.
+ */
+static void reb_profiling_hw_read(const struct reb_profiling_counters* const c, unsigned long long* values){
+#ifdef __linux__
+	// Group read format: number of events followed by their values, in the order they were opened.
+	unsigned long long buf[1+REB_PROFILING_HW_NUM];
+	if (read(c->hw_fd[0], buf, sizeof(buf))<(ssize_t)sizeof(unsigned long long)){
+		return;
+	}
+	int j = 1;
+	for (int i=0;i<REB_PROFILING_HW_NUM;i++){
+		if (c->hw_fd[i]>=0 && j<=(int)buf[0]){
+			values[i] = buf[j++];
+		}
+	}
+#endif // __linux__
+}
+
+/**
+ * @brief Opens the hardware counters for the calling thread.
+ * @details Counters which are not supported by the CPU are skipped.
+ * If the cycle counter cannot be opened, no counters are used.
+ */
+static void reb_profiling_hw_open(struct reb_profiling_counters* const c){
+	c->hw_status = -1;
+	for (int i=0;i<REB_PROFILING_HW_NUM;i++){
+		c->hw_fd[i] = -1;
+	}
+#ifdef __linux__
+	static const unsigned long long configs[REB_PROFILING_HW_NUM][2] = {
+		[REB_PROFILING_HW_CYCLES]		= {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		[REB_PROFILING_HW_INSTRUCTIONS]		= {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		[REB_PROFILING_HW_L1D_MISSES]		= {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16)},
+		[REB_PROFILING_HW_LLC_MISSES]		= {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		[REB_PROFILING_HW_BRANCH_MISSES]	= {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	};
+	for (int i=0;i<REB_PROFILING_HW_NUM;i++){
+		struct perf_event_attr pe;
+		memset(&pe, 0, sizeof(struct perf_event_attr));
+		pe.size = sizeof(struct perf_event_attr);
+		pe.type = configs[i][0];
+		pe.config = configs[i][1];
+		pe.disabled = (i==0);
+		pe.exclude_kernel = 1;	// Allows use without root privileges
+		pe.exclude_hv = 1;
+		pe.read_format = PERF_FORMAT_GROUP;
+		// Count the calling thread on any CPU.
+		c->hw_fd[i] = syscall(__NR_perf_event_open, &pe, 0, -1, i==0?-1:c->hw_fd[0], 0);
+		if (i==0 && c->hw_fd[0]<0){
+			return;
+		}
+	}
+	ioctl(c->hw_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(c->hw_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	c->hw_status = 1;
+	reb_profiling_hw_read(c, c->hw_last);
+#endif // __linux__
+}
+
+/**
+ * @brief Adds the hardware counter increments since the last call to category cat.
+ */
+static void reb_profiling_hw_accumulate(struct reb_profiling_counters* const c, const int cat){
+	unsigned long long now[REB_PROFILING_HW_NUM];
+	memcpy(now, c->hw_last, sizeof(now));
+	reb_profiling_hw_read(c, now);
+	if (cat>=0){
+		for (int i=0;i<REB_PROFILING_HW_NUM;i++){
+			c->hw[cat][i] += now[i] - c->hw_last[i];
+		}
+	}
+	memcpy(c->hw_last, now, sizeof(now));
+}
+
+/**
+ * @brief Allocates one set of counters per thread.
+ * @details Must not be called from within a parallel region.
+ */
+static void reb_profiling_allocate(struct reb_simulation* const r){
+#ifdef OPENMP
+	r->profiling_threads_N = omp_get_max_threads();
+#else // OPENMP
+	r->profiling_threads_N = 1;
+#endif // OPENMP
+	r->profiling_counters = calloc(r->profiling_threads_N,sizeof(struct reb_profiling_counters));
+	reb_profiling_reset(r);
+}
+
+/**
+ * @brief Allocates one trace ring buffer per thread.
+ * @details Must not be called from within a parallel region.
+ */
+static void reb_profiling_allocate_trace(struct reb_simulation* const r){
+	int N = 1024;
+	while (N<r->trace_capacity){
+		N *= 2;
+	}
+	for (int t=0;t<r->profiling_threads_N;t++){
+		struct reb_profiling_counters* const c = &(r->profiling_counters[t]);
+		c->trace = malloc(sizeof(struct reb_trace_event)*N);
+		c->trace_allocatedN = N;
+		c->trace_N = 0;
+	}
+}
+
+/**
+ * @brief Adds a closed scope to the trace of a thread.
+ */
+static void reb_profiling_trace_add(const struct reb_simulation* const r, struct reb_profiling_counters* const c, const int cat, const double start, const double end){
+	if (r->trace_enabled && c->trace){
+		struct reb_trace_event* const e = &(c->trace[c->trace_N & (c->trace_allocatedN-1)]);
+		e->start = start;
+		e->duration = end - start;
+		e->cat = cat;
+		c->trace_N++;
+	}
+}
+
+/**
+ * @brief Opens a scope inside a parallel region on the calling thread.
+ * @details Counters and buffers cannot be allocated inside a parallel region.
+ * Nothing is recorded if they do not exist yet. Worker threads open their own
+ * group of hardware counters and accumulate them exclusively into the scopes 
+ * on their parallel stack. The master thread's counters keep running in the
+ * enclosing serial scope.
+ */
+static void reb_profiling_parallel_start(struct reb_simulation* const r, const enum REB_PROFILING_CAT cat){
+	if (r->profiling_counters==NULL) return;
+	const int tid = reb_profiling_thread_num();
+	if (tid>=r->profiling_threads_N) return;
+	struct reb_profiling_counters* const c = &(r->profiling_counters[tid]);
+	if (c->parallel_stack_N>=REB_PROFILING_STACK_MAX) return;
+	if (r->profiling_hw_counters && tid>0){
+		if (c->hw_status==0){
+			reb_profiling_hw_open(c);
+		}
+		if (c->hw_status==1){
+			reb_profiling_hw_accumulate(c, c->parallel_stack_N>0?c->parallel_stack[c->parallel_stack_N-1]:-1);
+		}
+	}
+	c->parallel_stack[c->parallel_stack_N] = cat;
+	c->parallel_stack_start[c->parallel_stack_N] = reb_profiling_clock();
+	c->parallel_stack_N++;
+}
+
+/**
+ * @brief Closes the innermost scope inside a parallel region on the calling thread.
+ */
+static void reb_profiling_parallel_stop(struct reb_simulation* const r, const enum REB_PROFILING_CAT cat){
+	if (r->profiling_counters==NULL) return;
+	const int tid = reb_profiling_thread_num();
+	if (tid>=r->profiling_threads_N) return;
+	struct reb_profiling_counters* const c = &(r->profiling_counters[tid]);
+	if (c->parallel_stack_N==0 || c->parallel_stack[c->parallel_stack_N-1]!=cat) return;
+	const double now = reb_profiling_clock();
+	if (r->profiling_hw_counters && tid>0 && c->hw_status==1){
+		reb_profiling_hw_accumulate(c, cat);
+	}
+	c->parallel_stack_N--;
+	c->parallel_time[cat] += now - c->parallel_stack_start[c->parallel_stack_N];
+	c->parallel_calls[cat]++;
+	reb_profiling_trace_add(r, c, cat, c->parallel_stack_start[c->parallel_stack_N], now);
+}
+
+void reb_profiling_start(struct reb_simulation* const r, const enum REB_PROFILING_CAT cat){
+	if (reb_profiling_in_parallel()){
+		reb_profiling_parallel_start(r, cat);
+		return;
+	}
+	if (r->profiling_counters==NULL || (r->trace_enabled && r->profiling_counters[0].trace==NULL)){
+		if (r->profiling_counters==NULL){
+			reb_profiling_allocate(r);
+		}
+		if (r->trace_enabled && r->profiling_counters[0].trace==NULL){
+			reb_profiling_allocate_trace(r);
+		}
+	}
+	const int tid = reb_profiling_thread_num();
+	if (tid>=r->profiling_threads_N) return;
+	struct reb_profiling_counters* const c = &(r->profiling_counters[tid]);
+	if (c->stack_N>=REB_PROFILING_STACK_MAX) return;
+	if (r->profiling_hw_counters){
+		if (c->hw_status==0){
+			reb_profiling_hw_open(c);
+			if (c->hw_status==-1 && tid==0){
+				reb_warning("Hardware performance counters are not available. Check /proc/sys/kernel/perf_event_paranoid.");
+			}
+		}
+		if (c->hw_status==1){
+			reb_profiling_hw_accumulate(c, c->stack_N>0?c->stack[c->stack_N-1]:-1);
+		}
+	}
+	const double now = reb_profiling_clock();
+	if (c->stack_N>0){
+		// Pause enclosing scope
+		const int top = c->stack[c->stack_N-1];
+		c->time[top] += now - c->last;
+		if (top!=cat){
+			// Re-entering the innermost category (e.g. a helper function 
+			// opening the scope of its caller) does not count as a new call.
+			c->calls[cat]++;
+		}
+	}else{
+		c->calls[cat]++;
+	}
+	c->stack[c->stack_N] = cat;
+	c->stack_start[c->stack_N] = now;
+	c->stack_N++;
+	c->last = now;
+}
+
+void reb_profiling_stop(struct reb_simulation* const r, const enum REB_PROFILING_CAT cat){
+	if (reb_profiling_in_parallel()){
+		reb_profiling_parallel_stop(r, cat);
+		return;
+	}
+	if (r->profiling_counters==NULL) return;
+	const int tid = reb_profiling_thread_num();
+	if (tid>=r->profiling_threads_N) return;
+	struct reb_profiling_counters* const c = &(r->profiling_counters[tid]);
+	if (c->stack_N==0 || c->stack[c->stack_N-1]!=cat) return;
+	const double now = reb_profiling_clock();
+	c->time[cat] += now - c->last;
+	if (r->profiling_hw_counters && c->hw_status==1){
+		reb_profiling_hw_accumulate(c, cat);
+	}
+	c->stack_N--;
+	c->last = now;
+	reb_profiling_trace_add(r, c, cat, c->stack_start[c->stack_N], now);
+}
+
+void reb_profiling_free(struct reb_simulation* const r){
+	for (int t=0;t<r->profiling_threads_N;t++){
+		struct reb_profiling_counters* const c = &(r->profiling_counters[t]);
+		free(c->trace);
+		if (c->hw_status==1){
+			for (int i=0;i<REB_PROFILING_HW_NUM;i++){
+				if (c->hw_fd[i]>=0) close(c->hw_fd[i]);
+			}
+		}
+	}
+	free(r->profiling_counters);
+	r->profiling_counters = NULL;
+	r->profiling_threads_N = 0;
+}
+
+EXPORTIT void reb_profiling_reset(struct reb_simulation* const r){
+	const double now = reb_profiling_clock();
+	for (int t=0;t<r->profiling_threads_N;t++){
+		// Buffers and open hardware counters are kept.
+		struct reb_profiling_counters* const c = &(r->profiling_counters[t]);
+		memset(c->time, 0, sizeof(c->time));
+		memset(c->calls, 0, sizeof(c->calls));
+		memset(c->hw, 0, sizeof(c->hw));
+		memset(c->parallel_time, 0, sizeof(c->parallel_time));
+		memset(c->parallel_calls, 0, sizeof(c->parallel_calls));
+		c->stack_N = 0;
+		c->parallel_stack_N = 0;
+		c->trace_N = 0;
+		c->time_initial = now;
+	}
+}
+
+EXPORTIT const char* reb_profiling_get_name(int cat){
+	if (cat<0 || cat>=REB_PROFILING_CAT_NUM) return NULL;
+	return reb_profiling_names[cat];
+}
+
+EXPORTIT int reb_profiling_get_parent(int cat){
+	if (cat<0 || cat>=REB_PROFILING_CAT_NUM) return -1;
+	return reb_profiling_parents[cat];
+}
+
+EXPORTIT int reb_profiling_get_threads_N(const struct reb_simulation* const r){
+	return r->profiling_threads_N;
+}
+
+EXPORTIT double reb_profiling_get_time(const struct reb_simulation* const r, int cat, int thread){
+	if (cat<0 || cat>=REB_PROFILING_CAT_NUM) return 0.;
+	double time = 0.;
+	for (int t=0;t<r->profiling_threads_N;t++){
+		if (thread==-1 || thread==t){
+			time += r->profiling_counters[t].time[cat];
+		}
+	}
+	return time;
+}
+
+EXPORTIT double reb_profiling_get_time_inclusive(const struct reb_simulation* const r, int cat, int thread){
+	double time = 0.;
+	for (int c=0;c<REB_PROFILING_CAT_NUM;c++){
+		// Check if cat is c or one of its ancestors
+		for (int a=c; a!=-1; a=reb_profiling_parents[a]){
+			if (a==cat){
+				time += reb_profiling_get_time(r, c, thread);
+				break;
+			}
+		}
+	}
+	return time;
+}
+
+EXPORTIT long reb_profiling_get_calls(const struct reb_simulation* const r, int cat, int thread){
+	if (cat<0 || cat>=REB_PROFILING_CAT_NUM) return 0;
+	long calls = 0;
+	for (int t=0;t<r->profiling_threads_N;t++){
+		if (thread==-1 || thread==t){
+			calls += r->profiling_counters[t].calls[cat];
+		}
+	}
+	return calls;
+}
+
+EXPORTIT double reb_profiling_get_parallel_time(const struct reb_simulation* const r, int cat, int thread){
+	if (cat<0 || cat>=REB_PROFILING_CAT_NUM) return 0.;
+	double time = 0.;
+	for (int t=0;t<r->profiling_threads_N;t++){
+		if (thread==-1 || thread==t){
+			time += r->profiling_counters[t].parallel_time[cat];
+		}
+	}
+	return time;
+}
+
+EXPORTIT long reb_profiling_get_parallel_calls(const struct reb_simulation* const r, int cat, int thread){
+	if (cat<0 || cat>=REB_PROFILING_CAT_NUM) return 0;
+	long calls = 0;
+	for (int t=0;t<r->profiling_threads_N;t++){
+		if (thread==-1 || thread==t){
+			calls += r->profiling_counters[t].parallel_calls[cat];
+		}
+	}
+	return calls;
+}
+
+EXPORTIT double reb_profiling_get_wall_time(const struct reb_simulation* const r){
+	if (r->profiling_counters==NULL) return 0.;
+	return reb_profiling_clock() - r->profiling_counters[0].time_initial;
+}
+
+EXPORTIT const char* reb_profiling_get_hw_name(int counter){
+	if (counter<0 || counter>=REB_PROFILING_HW_NUM) return NULL;
+	return reb_profiling_hw_names[counter];
+}
+
+EXPORTIT int reb_profiling_hw_available(const struct reb_simulation* const r){
+	if (r->profiling_counters==NULL) return 0;
+	return r->profiling_counters[0].hw_status==1;
+}
+
+EXPORTIT unsigned long long reb_profiling_get_hw(const struct reb_simulation* const r, int cat, int counter, int thread){
+	if (cat<0 || cat>=REB_PROFILING_CAT_NUM) return 0;
+	if (counter<0 || counter>=REB_PROFILING_HW_NUM) return 0;
+	unsigned long long value = 0;
+	for (int t=0;t<r->profiling_threads_N;t++){
+		if (thread==-1 || thread==t){
+			value += r->profiling_counters[t].hw[cat][counter];
+		}
+	}
+	return value;
+}
+
+EXPORTIT unsigned long long reb_profiling_get_hw_inclusive(const struct reb_simulation* const r, int cat, int counter, int thread){
+	unsigned long long value = 0;
+	for (int c=0;c<REB_PROFILING_CAT_NUM;c++){
+		for (int a=c; a!=-1; a=reb_profiling_parents[a]){
+			if (a==cat){
+				value += reb_profiling_get_hw(r, c, counter, thread);
+				break;
+			}
+		}
+	}
+	return value;
+}
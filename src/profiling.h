@@ -0,0 +1,106 @@
+/**
+ * @file 	profiling.h
+ * @brief 	Per-simulation profiling of the different parts of a timestep.
+ * @author 	Hanno Rein <hanno@hanno-rein.de>
+ *
+ * @section 	LICENSE
+ * Copyright (c) 2016 Hanno Rein
+ *
+ * This file is part of rebound.
+ *
+ * rebound is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * rebound is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with rebound.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _PROFILING_H
+#define _PROFILING_H
+#include "rebound.h"
+
+#define REB_PROFILING_STACK_MAX 16	///< Maximum nesting depth of profiling scopes.
+
+/**
+ * @brief One event of the timeline trace, i.e. one closed profiling scope.
+ */
+struct reb_trace_event {
+	double start;		///< Time at which the scope was opened (seconds, monotonic clock).
+	double duration;	///< Time between opening and closing the scope (seconds).
+	int cat;		///< Profiling category.
+};
+
+/**
+ * @brief Profiling counters of one thread.
+ * @details Time is accumulated exclusively: while a nested scope is open,
+ * the time is only added to the innermost scope. The times of all
+ * categories are thus disjoint. Only scopes opened outside of OpenMP 
+ * parallel regions, i.e. by the master thread, contribute to time.
+ * Scopes opened inside parallel regions are kept on a separate stack
+ * of the thread that opened them. They are recorded in parallel_time,
+ * parallel_calls and in the trace of that thread.
+ */
+struct reb_profiling_counters {
+	double time[REB_PROFILING_CAT_NUM];	///< Exclusive wall time spent in each category (seconds).
+	long calls[REB_PROFILING_CAT_NUM];	///< Number of times each category has been entered.
+	int stack[REB_PROFILING_STACK_MAX];	///< Currently open scopes.
+	double stack_start[REB_PROFILING_STACK_MAX];	///< Times at which the currently open scopes were opened.
+	int stack_N;				///< Number of currently open scopes.
+	double last;				///< Time at which the innermost scope was (re-)entered.
+	double time_initial;			///< Time at which the counters were allocated or reset.
+	int parallel_stack[REB_PROFILING_STACK_MAX];	///< Currently open scopes inside a parallel region.
+	double parallel_stack_start[REB_PROFILING_STACK_MAX];	///< Times at which the currently open scopes inside a parallel region were opened.
+	int parallel_stack_N;			///< Number of currently open scopes inside a parallel region.
+	double parallel_time[REB_PROFILING_CAT_NUM];	///< Wall time spent in each category inside parallel regions (seconds, inclusive).
+	long parallel_calls[REB_PROFILING_CAT_NUM];	///< Number of times each category has been entered inside parallel regions.
+	struct reb_trace_event* trace;		///< Ring buffer of trace events. Only written to by the thread owning these counters.
+	int trace_allocatedN;			///< Size of the ring buffer. Always a power of two.
+	unsigned long trace_N;			///< Total number of events recorded. The ring buffer contains the last min(trace_N, trace_allocatedN) events.
+	int hw_status;				///< 0: hardware counters not opened yet, 1: open, -1: not available.
+	int hw_fd[REB_PROFILING_HW_NUM];	///< File descriptors of the hardware counters (-1 if not supported). The first one is the group leader.
+	unsigned long long hw_last[REB_PROFILING_HW_NUM];	///< Hardware counter values when the innermost scope was (re-)entered.
+	unsigned long long hw[REB_PROFILING_CAT_NUM][REB_PROFILING_HW_NUM];	///< Hardware counter values accumulated in each category (exclusive). For worker threads, only scopes inside parallel regions are counted.
+};
+
+/**
+ * @brief Returns the time of a monotonic high resolution clock in seconds.
+ */
+double reb_profiling_clock(void);
+
+/**
+ * @brief Opens a profiling scope on the calling thread.
+ * @details Use the PROFILING_START() macro instead of calling this function directly.
+ * The time spent in a parallel region is attributed to the enclosing scope of 
+ * the master thread, so that the times of all categories add up to the wall time.
+ * Scopes opened inside OpenMP parallel regions are only recorded in the trace
+ * of the calling thread. This shows the load balance between threads.
+ * @param r REBOUND simulation to operate on
+ * @param cat Profiling category
+ */
+void reb_profiling_start(struct reb_simulation* const r, const enum REB_PROFILING_CAT cat);
+
+/**
+ * @brief Closes the innermost profiling scope on the calling thread.
+ * @details Use the PROFILING_STOP() macro instead of calling this function directly.
+ * @param r REBOUND simulation to operate on
+ * @param cat Profiling category (must match the innermost open scope)
+ */
+void reb_profiling_stop(struct reb_simulation* const r, const enum REB_PROFILING_CAT cat);
+
+/**
+ * @brief Frees the profiling counters.
+ * @param r REBOUND simulation to operate on
+ */
+void reb_profiling_free(struct reb_simulation* const r);
+
+#define PROFILING_START(r,C) do{ if ((r)->profiling_enabled || (r)->trace_enabled) reb_profiling_start((r),(C)); }while(0);	///< Start profiling block
+#define PROFILING_STOP(r,C) do{ if ((r)->profiling_enabled || (r)->trace_enabled) reb_profiling_stop((r),(C)); }while(0);	///< Stop profiling block
+
+#endif // _PROFILING_H
@@ -42,11 +42,14 @@
 #include "integrator_wh.h"
 #include "integrator_whfast.h"
 #include "integrator_ias15.h"
+#include "integrator_leapfrog.h"
 #include "boundary.h"
 #include "gravity.h"
 #include "collision.h"
 #include "tree.h"
 #include "output.h"
+#include "profiling.h"
+#include "events.h"
 #include "tools.h"
 #include "particle.h"
 #ifdef MPI
@@ -69,32 +72,37 @@ const char* reb_version_str = "2.15.0";			// **VERSIONLINE** This line gets upda
 
 EXPORTIT void reb_step(struct reb_simulation* const r){
 	// A 'DKD'-like integrator will do the first 'D' part.
-	PROFILING_START()
+	PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR)
+	PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR_PART1)
 	reb_integrator_part1(r);
-	PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
+	PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR_PART1)
+	PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
 
 	// Update and simplify tree.
 	// Prepare particles for distribution to other nodes.
 	// This function also creates the tree if called for the first time.
 	if (r->tree_needs_update || r->gravity==REB_GRAVITY_TREE || r->collision==REB_COLLISION_TREE){
         // Check for root crossings.
-        PROFILING_START()
+        PROFILING_START(r, REB_PROFILING_CAT_BOUNDARY)
         reb_boundary_check(r);
-        PROFILING_STOP(PROFILING_CAT_BOUNDARY)
+        PROFILING_STOP(r, REB_PROFILING_CAT_BOUNDARY)
 
         // Update tree (this will remove particles which left the box)
-	    PROFILING_START()
+	    PROFILING_START(r, REB_PROFILING_CAT_TREE_UPDATE)
 		reb_tree_update(r);
-	    PROFILING_STOP(PROFILING_CAT_GRAVITY)
+	    PROFILING_STOP(r, REB_PROFILING_CAT_TREE_UPDATE)
 	}
 
-	PROFILING_START()
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY)
 #ifdef MPI
 	// Distribute particles and add newly received particles to tree.
+	PROFILING_START(r, REB_PROFILING_CAT_COMMUNICATION)
 	reb_communication_mpi_distribute_particles(r);
+	PROFILING_STOP(r, REB_PROFILING_CAT_COMMUNICATION)
 #endif // MPI
 
 	if (r->tree_root!=NULL && r->gravity==REB_GRAVITY_TREE){
+		PROFILING_START(r, REB_PROFILING_CAT_GRAVITY_MULTIPOLES)
 		// Update center of mass and quadrupole moments in tree in preparation of force calculation.
 		reb_tree_update_gravity_data(r);
 #ifdef MPI
@@ -102,43 +110,70 @@ EXPORTIT void reb_step(struct reb_simulation* const r){
 		reb_tree_prepare_essential_tree_for_gravity(r);
 
 		// Transfer essential tree and particles needed for collisions.
+		PROFILING_START(r, REB_PROFILING_CAT_COMMUNICATION)
 		reb_communication_mpi_distribute_essential_tree_for_gravity(r);
+		PROFILING_STOP(r, REB_PROFILING_CAT_COMMUNICATION)
 #endif // MPI
+		PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_MULTIPOLES)
 	}
 
 	// Calculate accelerations.
-	reb_calculate_acceleration(r);
+	PROFILING_START(r, REB_PROFILING_CAT_GRAVITY_WALK)
+	int tree_walk_neighbours = 0;
+#ifndef MPI
+	// The collision neighbour list can be rebuilt in the gravity tree walk.
+	tree_walk_neighbours = (r->gravity==REB_GRAVITY_TREE && r->collision==REB_COLLISION_TREE && r->collision_skin>0. && r->tree_root!=NULL);
+#endif // MPI
+	if (tree_walk_neighbours){
+		reb_calculate_acceleration_and_collision_neighbours(r);
+	}else{
+		reb_calculate_acceleration(r);
+	}
 	if (r->N_var){
 		reb_calculate_acceleration_var(r);
 	}
+	// Calculate contact forces between overlapping particles.
+	if (r->contact==REB_CONTACT_SOFTSPHERE){
+		PROFILING_START(r, REB_PROFILING_CAT_COLLISION)
+		reb_collision_softsphere_forces(r);
+		PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION)
+	}
 	// Calculate non-gravity accelerations.
 	if (r->additional_forces) r->additional_forces(r);
-	PROFILING_STOP(PROFILING_CAT_GRAVITY)
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY_WALK)
+	PROFILING_STOP(r, REB_PROFILING_CAT_GRAVITY)
 
 	// A 'DKD'-like integrator will do the 'KD' part.
-	PROFILING_START()
+	PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR)
+	PROFILING_START(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
 	reb_integrator_part2(r);
+	if (r->event){
+		reb_events_check(r);
+	}
 	if (r->post_timestep_modifications){
 		reb_integrator_synchronize(r);
 		r->post_timestep_modifications(r);
 		r->ri_whfast.recalculate_jacobi_this_timestep = 1;
 	}
-	PROFILING_STOP(PROFILING_CAT_INTEGRATOR)
+	PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR_PART2)
+	PROFILING_STOP(r, REB_PROFILING_CAT_INTEGRATOR)
 
 	// Do collisions here. We need both the positions and velocities at the same time.
 	// Check for root crossings.
-	PROFILING_START()
+	PROFILING_START(r, REB_PROFILING_CAT_BOUNDARY)
 	reb_boundary_check(r);
+	PROFILING_STOP(r, REB_PROFILING_CAT_BOUNDARY)
 	if (r->tree_needs_update){
         // Update tree (this will remove particles which left the box)
+	    PROFILING_START(r, REB_PROFILING_CAT_TREE_UPDATE)
 		reb_tree_update(r);
+	    PROFILING_STOP(r, REB_PROFILING_CAT_TREE_UPDATE)
 	}
-	PROFILING_STOP(PROFILING_CAT_BOUNDARY)
 
 	// Search for collisions using local and essential tree.
-	PROFILING_START()
+	PROFILING_START(r, REB_PROFILING_CAT_COLLISION)
 	reb_collision_search(r);
-	PROFILING_STOP(PROFILING_CAT_COLLISION)
+	PROFILING_STOP(r, REB_PROFILING_CAT_COLLISION)
 }
 
 void reb_exit(const char* const msg){
@@ -206,9 +241,23 @@ EXPORTIT void reb_free_pointers(struct reb_simulation* const r){
 	reb_tree_delete(r);
 	free(r->gravity_cs 	);
 	free(r->collisions	);
+	free(r->particle_lookup	);
+	reb_profiling_free(r);
+	reb_collision_grid_free(r);
+	reb_collision_sweep_free(r);
+	reb_collision_buffers_free(r);
+	free(r->collision_remap);
+	free(r->events);
+	free(r->events_particles);
+	free(r->events_f_last_particles);
+	reb_collision_schedule_free(r);
+	reb_collision_neighbours_free(r);
+	reb_gravity_interactions_free(r);
+	reb_collision_queue_free(r);
 	reb_integrator_wh_reset(r);
 	reb_integrator_whfast_reset(r);
 	reb_integrator_ias15_reset(r);
+	reb_integrator_leapfrog_reset(r);
 	free(r->particles	);
 }
 
@@ -218,12 +267,45 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
 	r->gravity_cs 			= NULL;
 	r->collisions_allocatedN	= 0;
 	r->collisions			= NULL;
+	r->collision_grid		= NULL;
+	r->collision_sweep		= NULL;
+	r->collision_buffers		= NULL;
+	r->collision_buffers_N		= 0;
+	r->collision_remap		= NULL;
+	r->collision_remap_allocatedN	= 0;
+	r->events_N			= 0;
+	r->events_allocatedN		= 0;
+	r->events			= NULL;
+	r->events_particles_allocatedN	= 0;
+	r->events_particles		= NULL;
+	r->events_f_last_N		= 0;
+	r->events_f_last_allocatedN	= 0;
+	r->events_f_last_particles	= NULL;
+	r->collision_schedule		= NULL;
+	r->collision_neighbours		= NULL;
+	r->gravity_interactions		= NULL;
+	r->collision_queue		= NULL;
+	r->particle_lookup_allocatedN	= 0;
+	r->particle_lookup_N		= 0;
+	r->particle_lookup		= NULL;
+	r->particle_lookup_stale	= 1;
+	r->tree_cell_slabs		= NULL;
+	r->tree_cell_slabs_N		= 0;
+	r->tree_cell_allocatedN		= 0;
+	r->tree_cell_free		= NULL;
+	r->profiling_threads_N		= 0;
+	r->profiling_counters		= NULL;
 	// ********** WHFAST
 	r->ri_whfast.allocated_N	= 0;
 	r->ri_whfast.eta		= NULL;
 	r->ri_whfast.p_j		= NULL;
 	// ********** IAS15
 	r->ri_ias15.allocatedN		= 0;
+	r->ri_ias15.arena_allocatedN	= 0;
+	r->ri_ias15.arena		= NULL;
+	r->ri_ias15.dense_N		= 0;
+	r->ri_ias15.xd  		= NULL;
+	r->ri_ias15.vd  		= NULL;
 	set_dp7_null(&(r->ri_ias15.g));
 	set_dp7_null(&(r->ri_ias15.b));
 	set_dp7_null(&(r->ri_ias15.csb));
@@ -238,6 +320,18 @@ void reb_reset_temporary_pointers(struct reb_simulation* const r){
 	r->ri_ias15.csv  		= NULL;
 	r->ri_ias15.csa0  		= NULL;
 	r->ri_ias15.at  		= NULL;
+	r->ri_ias15.block_allocatedN	= 0;
+	r->ri_ias15.block_N		= 0;
+	r->ri_ias15.block_level		= NULL;
+	r->ri_ias15.block_index		= NULL;
+	r->ri_ias15.block_dt		= NULL;
+	r->ri_ias15.block_nodes_allocatedN	= 0;
+	r->ri_ias15.block_nodes		= NULL;
+	// ********** LEAPFROG
+	r->ri_leapfrog.block_allocatedN	= 0;
+	r->ri_leapfrog.block_N		= 0;
+	r->ri_leapfrog.block_level	= NULL;
+	r->ri_leapfrog.block_index	= NULL;
 	// ********** WH
 	r->ri_wh.allocatedN 		= 0;
 	r->ri_wh.eta 			= NULL;
@@ -249,6 +343,7 @@ void reb_reset_function_pointers(struct reb_simulation* const r){
 	r->additional_forces 		= NULL;
 	r->heartbeat			= NULL;
 	r->post_timestep_modifications	= NULL;
+	r->event			= NULL;
 }
 
 struct reb_simulation* reb_create_simulation(){
@@ -290,22 +385,41 @@ EXPORTIT void reb_init_simulation(struct reb_simulation* r){
 	r->exit_max_distance 	= 0;
 	r->max_radius[0]	= 0.;
 	r->max_radius[1]	= 0.;
+	r->collision_seed	= 1;
+	r->collision_skin	= 0.;
+	r->collision_continuous	= 0;
 	r->status		= REB_RUNNING;
 	r->exact_finish_time 	= 1;
 	r->force_is_velocity_dependent = 0;
 	r->gravity_ignore_10	= 0;
 	r->calculate_megno	= 0;
+	r->events_epsilon	= 1e-14;
 	r->output_timing_last 	= -1;
+	r->particle_lookup_enabled = 0;
+#ifdef PROFILING
+	r->profiling_enabled 	= 1;
+#else // PROFILING
+	r->profiling_enabled 	= 0;
+#endif // PROFILING
+	r->trace_enabled	= 0;
+	r->trace_capacity	= 65536;
+	r->profiling_hw_counters = 0;
 
 	r->minimum_collision_velocity = 0;
 	r->collisions_plog 	= 0;
 	r->collisions_Nlog 	= 0;
+	r->contact_stiffness	= 0;
+	r->contact_damping	= 0;
+	r->contact_tangential_stiffness	= 0;
+	r->contact_tangential_damping	= 0;
+	r->contact_friction	= 0;
 
 	// Default modules
 	r->integrator   = REB_INTEGRATOR_IAS15;
 	r->boundary     = REB_BOUNDARY_NONE;
 	r->gravity      = REB_GRAVITY_BASIC;
 	r->collision    = REB_COLLISION_NONE;
+	r->contact      = REB_CONTACT_NONE;
 
 
 	// Integrators
@@ -323,8 +437,14 @@ EXPORTIT void reb_init_simulation(struct reb_simulation* r){
 	r->ri_ias15.epsilon 		= 1e-9;
 	r->ri_ias15.min_dt 		= 0;
 	r->ri_ias15.epsilon_global	= 1;
+	r->ri_ias15.block_levels	= 0;
+	r->ri_ias15.tree_interaction_lists	= 0;
 	r->ri_ias15.iterations_max_exceeded = 0;
 
+	// ********** LEAPFROG
+	r->ri_leapfrog.block_levels	= 0;
+	r->ri_leapfrog.block_eta	= 0.025;
+
 	// ********** SEI
 	r->ri_sei.OMEGA  	= 1;
 	r->ri_sei.OMEGAZ 	= -1;
@@ -543,16 +663,16 @@ EXPORTIT enum REB_STATUS reb_integrate(struct reb_simulation* const r_user, doub
             reb_display_init(0,NULL,r, display_mutex);
             exit(EXIT_SUCCESS); // NEVER REACHED
         } else {        // Parent (computation)
-            PROFILING_START()
+            PROFILING_START(r, REB_PROFILING_CAT_VISUALIZATION)
             while(reb_check_exit(r,tmax,&last_full_dt)<0){
                 sem_wait(display_mutex);
-                PROFILING_STOP(PROFILING_CAT_VISUALIZATION)
+                PROFILING_STOP(r, REB_PROFILING_CAT_VISUALIZATION)
                 reb_step(r);
                 reb_run_heartbeat(r);
-                PROFILING_START()
+                PROFILING_START(r, REB_PROFILING_CAT_VISUALIZATION)
                 sem_post(display_mutex);
             }
-            PROFILING_STOP(PROFILING_CAT_VISUALIZATION)
+            PROFILING_STOP(r, REB_PROFILING_CAT_VISUALIZATION)
         }
     }else{
 #endif // OPENGL
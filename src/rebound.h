@@ -126,6 +126,17 @@ struct reb_particle {
 };
 
 
+/**
+ * @brief Entry of the hash table which maps particle ids to indices in the particles array.
+ * @details For internal use only. An index of -1 marks an empty slot.
+ */
+struct reb_particle_lookup_entry {
+    int id;             ///< Particle id (the key).
+    int index;          ///< Index of the particle in the particles array. The lowest index if the id is not unique.
+    int duplicate;      ///< Set to 1 if more than one particle with this id has been inserted.
+};
+
+
 /**
  * @brief Structure representing a Keplerian orbit.
  * @details This structure is returned when calculating
@@ -193,6 +204,43 @@ struct reb_simulation_integrator_ias15 {
      **/
     unsigned int epsilon_global;
 
+    /**
+     * @brief Number of block timestep levels.
+     * @details If set to a value L>0, every particle gets its own timestep
+     * dt/2^l with 0<=l<=L, chosen from its own error estimate. Here dt is
+     * the timestep of the slowest particles. Particles with a timestep
+     * dt/2^l only have their accelerations calculated at the substeps of
+     * level l. The positions of all other particles at these times are
+     * interpolated using their IAS15 polynomials. This is faster than a
+     * global timestep if a few particles require much smaller timesteps
+     * than the rest of the system, e.g. a close binary or a moon in a
+     * planetary system. The error estimate is per particle, independent
+     * of epsilon_global. A particle is never slower than the particle that
+     * exerts the largest acceleration on it. The first step, and the step
+     * after a rejected step, are done with a global timestep. At most REB_IAS15_BLOCK_LEVELS_MAX (16) levels are
+     * used. Block timesteps require REB_GRAVITY_BASIC or REB_GRAVITY_NONE,
+     * an adaptive timestep (epsilon>0), no velocity dependent forces, no
+     * variational particles, no MEGNO and no event function. Otherwise IAS15 
+     * falls back to a global timestep. Dense output is not available with
+     * block timesteps.
+     * The default value is 0 (global timestep).
+     **/
+    unsigned int block_levels;
+
+    /**
+     * @brief Flag that determines whether tree interaction lists are used.
+     * @details If set to 1 and REB_GRAVITY_TREE is used, the tree is walked only
+     * once at the beginning of every timestep. The cells and particles each 
+     * particle interacts with are saved in interaction lists. At the substeps, 
+     * the multipole moments of the cells are updated to the predicted positions
+     * and the forces are calculated from the interaction lists, without opening
+     * cells again. Which cells are opened is thus decided at the beginning of the
+     * timestep. This is considerably faster than walking the tree at every 
+     * substep and every iteration of the predictor corrector loop. Without 
+     * interaction lists, the multipole moments are not updated at the substeps.
+     * Not available with MPI. The default value is 0 (tree walk at every substep).
+     **/
+    unsigned int tree_interaction_lists;
 
 
     /**
@@ -206,7 +254,10 @@ struct reb_simulation_integrator_ias15 {
 
 
 
-    int allocatedN;             ///< Size of allocated arrays.
+    int allocatedN;             ///< Size of arrays in use (3*N).
+    int arena_allocatedN;       ///< Number of components each array in the arena has space for.
+    double* restrict arena;     ///< Single allocation containing all arrays below.
+    int dense_N;                ///< Number of particles in the last completed step (0 if dense output is not available).
 
     double* restrict at;            ///< Temporary buffer for acceleration
     double* restrict x0;            ///<                      position (used for initial values at h=0)
@@ -215,6 +266,8 @@ struct reb_simulation_integrator_ias15 {
     double* restrict csx;           ///<                      compensated summation for x
     double* restrict csv;           ///<                      compensated summation for v
     double* restrict csa0;          ///<                      compensated summation for a
+    double* restrict xd;            ///<                      position at the beginning of the last completed step (dense output)
+    double* restrict vd;            ///<                      velocity at the beginning of the last completed step (dense output)
 
     struct reb_dp7 g;
     struct reb_dp7 b;
@@ -224,12 +277,69 @@ struct reb_simulation_integrator_ias15 {
     // The following values are used for resetting the b and e coefficients if a timestep gets rejected
     struct reb_dp7 br;
     struct reb_dp7 er;
+
+    // The following arrays are only used with block timesteps
+    int block_allocatedN;       ///< Size of the arrays block_level, block_index and block_dt (N).
+    int block_N;                ///< Number of particles the levels have been assigned for (0 if not assigned).
+    int* block_level;           ///< Timestep level of each particle.
+    int* block_index;           ///< Particle indices sorted by level.
+    double* block_dt;           ///< Length of the last step of each particle (temporarily its new timestep according to its own error estimate).
+    int block_nodes_allocatedN; ///< Size of the array block_nodes.
+    double* block_nodes;        ///< Positions of faster particles at the substeps of slower levels.
     /**
      * @endcond
      */
 
 };
 
+/**
+ * @brief This structure contains variables used by the Leapfrog integrator.
+ */
+struct reb_simulation_integrator_leapfrog {
+    /**
+     * @brief Number of block timestep levels.
+     * @details If set to a value L>0, the leapfrog integrator uses a
+     * Kick-Drift-Kick scheme with hierarchical block timesteps. Every 
+     * particle gets its own timestep dt/2^l with 0<=l<=L, where dt is the
+     * timestep of the slowest particles. The level is chosen from the 
+     * acceleration of the particle, such that its timestep is shorter than
+     * sqrt(2*block_eta*softening/|a|). Particles are kicked only at the
+     * end of their own timesteps. The accelerations of these particles are
+     * calculated with all other particles drifted to the same time. With
+     * REB_GRAVITY_TREE the tree is updated at every substep at which 
+     * accelerations are calculated, but the tree walk is only done for the
+     * particles whose timesteps end. This is faster than a
+     * global timestep if most particles can use a timestep much longer than
+     * that of the particles in the dense parts of the simulation, e.g. in
+     * the core of a star cluster. The accelerations at the end of one
+     * timestep are reused for the next one. They are recalculated after 
+     * reb_integrator_synchronize() has been called, e.g. at the end of 
+     * reb_integrate(). At most REB_LEAPFROG_BLOCK_LEVELS_MAX (16) levels
+     * are used. Block timesteps require REB_GRAVITY_BASIC, REB_GRAVITY_TREE
+     * or REB_GRAVITY_NONE, a softening length larger than 0, no variational 
+     * particles and no soft sphere contacts. They are not available with MPI.
+     * Otherwise the leapfrog integrator falls back to a global timestep.
+     * The default value is 0 (global timestep, Drift-Kick-Drift).
+     **/
+    unsigned int block_levels;
+    
+    /**
+     * @brief Accuracy parameter of the block timestep criterion.
+     * @details Only used if block_levels>0. The default value is 0.025.
+     **/
+    double block_eta;
+
+    /**
+     * @cond PRIVATE
+     * Internal data structures below. Nothing to be changed by the user.
+     */
+    int block_allocatedN;       ///< Size of the arrays block_level and block_index (N).
+    int block_N;                ///< Number of particles whose accelerations at the beginning of the next step are known (0 if they need to be recalculated).
+    int* block_level;           ///< Timestep level of each particle.
+    int* block_index;           ///< Indices of the particles whose timestep ends at the current substep.
+    /** @endcond */
+};
+
 /**
  * @brief This structure contains variables used by the SEI integrator.
  * @details This is where the user sets the orbital frequency OMEGA for
@@ -335,13 +445,21 @@ struct reb_collision{
     int p1;         ///< One of the colliding particles
     int p2;         ///< One of the colliding particles
     struct reb_ghostbox gb; ///< Ghostbox (of particle p1, used for periodic and shearing sheet boundary conditions)
-#if defined(COLLISIONS_SWEEP) || defined(COLLISIONS_SWEEPPHI)
-    double time;        ///< Time of collision.
-    int crossing;       ///< Collision occurs at the interface of two sweep boxes.
-#endif // COLLISIONS_SWEEP
+    double time;        ///< Time of collision relative to the current time. Particles are moved to this time before the collision is resolved. Only non-zero for the sweep algorithms.
     int ri;         ///< Index of rootcell (needed for MPI only).
 };
 
+/**
+ * @brief Structure describing a single event, i.e. a root of the event function.
+ * @details Events are found with reb_simulation.event and stored in reb_simulation.events.
+ */
+struct reb_event{
+    double t;               ///< Time of the event.
+    int direction;          ///< 1 if the event function changed from negative to positive, -1 if it changed from positive to negative.
+    int N;                  ///< Number of particles at the time of the event.
+    int particles_start;    ///< Index of the first particle of this event in reb_simulation.events_particles. The state of all N particles at time t is stored there.
+};
+
 
 /**
  * @brief Struct describing the properties of a set of variational equations.
@@ -362,6 +480,51 @@ struct reb_variational_configuration{
     int index_1st_order_b;      ///< Used for 2nd order variational particles only: Index of the first first order variational particle in the particles array.
 };
 
+/**
+ * @brief Profiling categories
+ * @details Categories are organized hierarchically. The parent of each category 
+ * can be obtained with reb_profiling_get_parent().
+ */
+enum REB_PROFILING_CAT {
+    REB_PROFILING_CAT_INTEGRATOR = 0,       ///< Integrator (excluding force calculations called by the integrator)
+    REB_PROFILING_CAT_INTEGRATOR_PART1 = 1, ///< First part of the integrator step (subcategory of INTEGRATOR)
+    REB_PROFILING_CAT_INTEGRATOR_PART2 = 2, ///< Second part of the integrator step (subcategory of INTEGRATOR)
+    REB_PROFILING_CAT_BOUNDARY = 3,         ///< Boundary checks
+    REB_PROFILING_CAT_TREE_UPDATE = 4,      ///< Tree updates
+    REB_PROFILING_CAT_GRAVITY = 5,          ///< Gravity and other forces
+    REB_PROFILING_CAT_GRAVITY_MULTIPOLES = 6,   ///< Update of the tree's multipole moments (subcategory of GRAVITY)
+    REB_PROFILING_CAT_GRAVITY_WALK = 7,     ///< Force calculation, i.e. tree walk or direct summation (subcategory of GRAVITY)
+    REB_PROFILING_CAT_COLLISION = 8,        ///< Collisions
+    REB_PROFILING_CAT_COLLISION_SEARCH = 9, ///< Collision search (subcategory of COLLISION)
+    REB_PROFILING_CAT_COLLISION_RESOLVE = 10,   ///< Collision resolution (subcategory of COLLISION)
+    REB_PROFILING_CAT_COMMUNICATION = 11,   ///< MPI communication
+    REB_PROFILING_CAT_VISUALIZATION = 12,   ///< Waiting for the visualization
+    REB_PROFILING_CAT_NUM = 13,             ///< Number of profiling categories
+};
+
+/**
+ * @brief Hardware performance counters
+ * @details These are only available on Linux and if the kernel allows
+ * unprivileged access to performance counters (perf_event_paranoid<=2).
+ */
+enum REB_PROFILING_HW {
+    REB_PROFILING_HW_CYCLES = 0,            ///< CPU cycles
+    REB_PROFILING_HW_INSTRUCTIONS = 1,      ///< Retired instructions
+    REB_PROFILING_HW_L1D_MISSES = 2,        ///< L1 data cache read misses
+    REB_PROFILING_HW_LLC_MISSES = 3,        ///< Last level cache misses
+    REB_PROFILING_HW_BRANCH_MISSES = 4,     ///< Mispredicted branches
+    REB_PROFILING_HW_NUM = 5,               ///< Number of hardware counters
+};
+
+struct reb_profiling_counters;
+struct reb_collision_grid;
+struct reb_collision_sweep;
+struct reb_collision_buffer;
+struct reb_collision_schedule;
+struct reb_collision_neighbours;
+struct reb_collision_queue;
+struct reb_gravity_interactions;
+
 
 /**
  * @brief Main struct encapsulating one entire REBOUND simulation
@@ -391,7 +554,12 @@ struct reb_simulation {
     int     gravity_cs_allocatedN;  ///< Current number of allocated space for cs array
     struct reb_treecell** tree_root;///< Pointer to the roots of the trees.
     int     tree_needs_update;      ///< Flag to force a tree update (after boundary check)
+    struct reb_treecell** tree_cell_slabs;  ///< Slabs from which tree cells are allocated (internal use).
+    int     tree_cell_slabs_N;      ///< Number of slabs in tree_cell_slabs.
+    int     tree_cell_allocatedN;   ///< Total number of tree cells in all slabs.
+    struct reb_treecell* tree_cell_free;    ///< Head of the list of unused tree cells (linked via oct[0]).
     double opening_angle2;          ///< Square of the cell opening angle \f$ \theta \f$.
+    struct reb_gravity_interactions* gravity_interactions;  ///< Interaction lists of the tree gravity calculation. Used by IAS15 if ri_ias15.tree_interaction_lists is set.
     enum REB_STATUS status;         ///< Set to 1 to exit the simulation at the end of the next timestep.
     int     exact_finish_time;      ///< Set to 1 to finish the integration exactly at tmax. Set to 0 to finish at the next dt. Default is 1.
 
@@ -403,6 +571,29 @@ struct reb_simulation {
     double usleep;                  ///< Wait this number of microseconds after each timestep, useful for slowing down visualization. Set to negative value to disable visualization (despite compiling with OPENGL=1).
     /** @} */
 
+    /**
+     * \name Variables related to the lookup of particles by their id
+     * @{
+     */
+    unsigned int particle_lookup_enabled;   ///< Set to 1 to maintain a hash table mapping particle ids to indices. Ids should be unique if enabled. Default: 0.
+    struct reb_particle_lookup_entry* particle_lookup;  ///< Open addressing hash table (internal use).
+    int     particle_lookup_allocatedN;     ///< Number of slots allocated in the hash table. Always a power of two.
+    int     particle_lookup_N;              ///< Number of used slots in the hash table.
+    unsigned int particle_lookup_stale;     ///< Set to 1 after changing ids manually. The hash table is then rebuilt at the next lookup.
+    /** @} */
+
+    /**
+     * \name Variables related to profiling
+     * @{
+     */
+    unsigned int profiling_enabled;         ///< Set to 1 to measure the time spent in different parts of the code. See reb_profiling_get_time(). Default: 0 (1 if compiled with PROFILING=1).
+    int     profiling_threads_N;            ///< Number of threads for which profiling counters are allocated.
+    struct reb_profiling_counters* profiling_counters;  ///< Per-thread profiling counters (internal use).
+    unsigned int trace_enabled;             ///< Set to 1 to record a timeline of all profiling scopes. See reb_output_trace(). Default: 0.
+    int     trace_capacity;                 ///< Number of events kept per thread. Older events are overwritten. Default: 65536.
+    unsigned int profiling_hw_counters;     ///< Set to 1 to also record hardware performance counters while profiling (Linux only). Default: 0.
+    /** @} */
+
     /**
      * \name Variables related to ghost/root boxes
      * @{
@@ -453,6 +644,23 @@ struct reb_simulation {
     double collisions_plog;             ///< Keep track of momentum exchange (used to calculate collisional viscosity in ring systems.
     double max_radius[2];               ///< Two largest particle radii, set automatically, needed for collision search.
     long collisions_Nlog;               ///< Keep track of number of collisions.
+    struct reb_collision_grid* collision_grid;  ///< Cell list used by REB_COLLISION_GRID. Rebuilt every timestep.
+    struct reb_collision_sweep* collision_sweep;    ///< Sorted particle list used by REB_COLLISION_SWEEP and REB_COLLISION_SWEEPPHI.
+    struct reb_collision_buffer* collision_buffers; ///< One collision buffer per OpenMP thread, used during the collision search.
+    int collision_buffers_N;            ///< Number of collision buffers.
+    int* collision_remap;               ///< Particles removed while resolving collisions are flagged with -1 in this table. Afterwards it contains the new index of each particle.
+    int collision_remap_allocatedN;     ///< Size allocated for collision_remap.
+    struct reb_collision_schedule* collision_schedule;  ///< Batches of independent collisions, used to resolve hard sphere collisions in parallel.
+    double collision_skin;              ///< If positive, REB_COLLISION_DIRECT and REB_COLLISION_TREE build a list of all pairs closer than the sum of their radii plus this skin distance, and only test these pairs until particles have moved by more than half the skin. Default: 0 (no neighbour list).
+    struct reb_collision_neighbours* collision_neighbours;  ///< Neighbour list used if collision_skin is positive.
+    unsigned long long collision_seed;  ///< State of the random number generator used to shuffle collisions before they are resolved. Set to reproduce a run exactly. Default: 1.
+    int collision_continuous;           ///< If 1, REB_COLLISION_DIRECT and REB_COLLISION_TREE search for collisions along the straight line trajectories of the particles during the last timestep. Collisions are resolved at their time of impact, in time order. Default: 0 (only particles overlapping at the end of the timestep collide).
+    struct reb_collision_queue* collision_queue;    ///< Event queue used to resolve collisions in time order if collision_continuous is set.
+    double contact_stiffness;           ///< Normal spring constant of soft sphere contacts (force per overlap). Used if contact is REB_CONTACT_SOFTSPHERE.
+    double contact_damping;             ///< Normal damping constant of soft sphere contacts (force per normal relative velocity).
+    double contact_tangential_stiffness;    ///< Tangential spring constant of soft sphere contacts (force per tangential displacement).
+    double contact_tangential_damping;  ///< Tangential damping constant of soft sphere contacts (force per tangential relative velocity).
+    double contact_friction;            ///< Coulomb friction coefficient of soft sphere contacts. The tangential force is at most this times the normal force.
     /** @} */
 
     /**
@@ -469,6 +677,24 @@ struct reb_simulation {
     long   megno_n;     ///< number of covariance updates
     /** @} */
 
+    /**
+     * \name Variables related to event detection (see the event callback function)
+     * @{
+     */
+    double events_epsilon;              ///< Precision with which the time of an event is determined, relative to the timestep. Default: 1e-14.
+    int events_N;                       ///< Number of events found. Set to 0 to clear the events.
+    int events_allocatedN;              ///< Size allocated for events.
+    struct reb_event* events;           ///< Array of all events found.
+    int events_particles_allocatedN;    ///< Size allocated for events_particles.
+    struct reb_particle* events_particles;  ///< Positions and velocities of all particles at the time of each event.
+    double events_f_last;               ///< Value of the event function at the end of the last timestep. Reused at the beginning of the next timestep (internal use).
+    double events_f_last_t;             ///< Time at which events_f_last was calculated (internal use).
+    int events_f_last_N;                ///< Number of particles when events_f_last was calculated. 0 if there is no cached value (internal use).
+    int events_f_last_allocatedN;       ///< Size allocated for events_f_last_particles.
+    struct reb_particle* events_f_last_particles;   ///< Particles at the time events_f_last was calculated. The cached value is only used if the particles have not changed since (internal use).
+    double (*events_f_last_event) (struct reb_simulation* const r); ///< Event function used to calculate events_f_last (internal use).
+    /** @} */
+
     /**
      * \name Variables describing the current module selection
      * @{
@@ -478,8 +704,11 @@ struct reb_simulation {
      */
     enum {
         REB_COLLISION_NONE = 0,     ///< Do not search for collisions (default)
-        REB_COLLISION_DIRECT = 1,   ///< Direct collision search O(N^2)
+        REB_COLLISION_DIRECT = 1,   ///< Direct collision search O(N^2), OpenMP parallel, each pair is only tested once
         REB_COLLISION_TREE = 2,     ///< Tree based collision search O(N log(N))
+        REB_COLLISION_GRID = 3,     ///< Uniform grid (cell list) collision search O(N), best for particles of similar size
+        REB_COLLISION_SWEEP = 4,    ///< Plane sweep along x, checks trajectories during the timestep, best if the x dimension dominates
+        REB_COLLISION_SWEEPPHI = 5, ///< Plane sweep along the azimuthal angle phi, checks trajectories during the timestep, best for narrow rings
         } collision;
     /**
      * @brief Available integrators
@@ -513,6 +742,14 @@ struct reb_simulation {
         REB_GRAVITY_COMPENSATED = 2,    ///< Direct summation algorithm O(N^2) but with compensated summation, slightly slower than BASIC but more accurate
         REB_GRAVITY_TREE = 3,       ///< Use the tree to calculate gravity, O(N log(N)), set opening_angle2 to adjust accuracy.
         } gravity;
+
+    /**
+     * @brief Available contact models
+     */
+    enum {
+        REB_CONTACT_NONE = 0,       ///< Overlapping particles are handled by the collision resolve function (default)
+        REB_CONTACT_SOFTSPHERE = 1, ///< Overlapping particles are pushed apart by spring-dashpot forces with Coulomb friction, needs REB_COLLISION_DIRECT or REB_COLLISION_TREE
+        } contact;
     /** @} */
 
 
@@ -525,6 +762,7 @@ struct reb_simulation {
     struct reb_simulation_integrator_hybrid ri_hybrid;  ///< The Hybrid struct
     struct reb_simulation_integrator_whfast ri_whfast;  ///< The WHFast struct
     struct reb_simulation_integrator_ias15 ri_ias15;    ///< The IAS15 struct
+    struct reb_simulation_integrator_leapfrog ri_leapfrog;  ///< The Leapfrog struct
     /** @} */
 
     /**
@@ -547,7 +785,8 @@ struct reb_simulation {
     /**
      * @brief Return the coefficient of restitution. By default it is NULL, assuming a coefficient of 1.
      * @details The velocity of the collision is given to allow for velocity dependent coefficients
-     * of restitution.
+     * of restitution. With OpenMP, hard sphere collisions are resolved in parallel and this 
+     * function might be called from several threads at the same time.
      */
     double (*coefficient_of_restitution) (const struct reb_simulation* const r, double v);
 
@@ -556,6 +795,17 @@ struct reb_simulation {
      * @details A return value of 0 indicates that both particles remain in the simulation. A return value of 1 (2) indicates that particle 1 (2) should be removed from the simulation. A return value of 3 indicates that both particles should be removed from the simulation.
      */
     int (*collision_resolve) (struct reb_simulation* const r, struct reb_collision);
+
+    /**
+     * @brief Event function. By default it is NULL, no events are searched for.
+     * @details After every timestep, REBOUND checks if this function changed its sign.
+     * If it did, the time of the root is found iteratively using the dense output of IAS15
+     * and stored together with the state of all particles in events. While the function 
+     * is called, r->t and the positions and velocities of r->particles are set to the time 
+     * being tested. The function should only read them. Events are only found if the function
+     * changes its sign at most once per timestep. Only supported by IAS15.
+     */
+    double (*event) (struct reb_simulation* const r);
     /** @} */
 
     /**
@@ -622,6 +872,20 @@ EXPORTIT enum REB_STATUS reb_integrate(struct reb_simulation* const r, double tm
  */
 EXPORTIT void reb_integrator_synchronize(struct reb_simulation* r);
 
+/**
+ * @brief Evaluates positions and velocities at any time within the last IAS15 step.
+ * @details IAS15 approximates the motion during each step by a high order polynomial.
+ * This function evaluates the polynomial of the last completed step (dense output). 
+ * Together with exact_finish_time=0, this can be used to create outputs at 
+ * arbitrary times without shortening the timestep. The particles in the simulation
+ * are not modified. 
+ * @param r The rebound simulation to be considered
+ * @param t Time at which positions and velocities are evaluated. Needs to be within the last step, i.e. between r->t-r->dt_last_done and r->t.
+ * @param particles Array with space for r->N particles. The particles are copied from the simulation, positions and velocities are replaced by their values at time t.
+ * @return Returns 1 if successful, 0 if t is not within the last step or no IAS15 step is available (e.g. because particles have been added since).
+ */
+EXPORTIT int reb_integrator_ias15_dense_output(struct reb_simulation* const r, const double t, struct reb_particle* const particles);
+
 /**
  * @brief Cleanup all temporarily stored integrator values.
  * @param r The rebound simulation to be considered
@@ -717,6 +981,21 @@ EXPORTIT int reb_remove(struct reb_simulation* const r, int index, int keepSorte
  */
 EXPORTIT int reb_remove_by_id(struct reb_simulation* const r, int id, int keepSorted);
 
+/**
+ * @brief Get a pointer to a particle by its id.
+ * @details If particle_lookup_enabled is set, a hash table is used and the
+ * lookup is O(1). Otherwise the particles array is searched linearly.
+ * The hash table is rebuilt if particle_lookup_stale is set, for example 
+ * because ids were changed manually after particles were added, or if the 
+ * entry found does not match the particle. Ids that are not in the table
+ * are not searched for otherwise.
+ * @param r The rebound simulation to be considered
+ * @param id The id of the particle.
+ * @return A pointer to the particle, or NULL if no particle with this id was found.
+ * Note that the pointer becomes invalid when particles are added or removed.
+ */
+EXPORTIT struct reb_particle* reb_get_particle_by_id(struct reb_simulation* const r, int id);
+
 /**
  * @brief Run the heartbeat function and check for escaping/colliding particles.
  * @details You rarely want to call this function yourself. It is used internally to
@@ -893,6 +1172,165 @@ void reb_output_binary_positions(struct reb_simulation* r, char* filename);
  * @param filename Output filename.
  */
 void reb_output_velocity_dispersion(struct reb_simulation* r, char* filename);
+
+/**
+ * @brief Write the profiling results to a CSV file.
+ * @details One line is written for each category and thread. Lines with 
+ * the thread column set to -1 contain the sum over all threads.
+ * The parallel_calls and parallel_time columns contain the scopes opened 
+ * inside OpenMP parallel regions. Times are given in seconds. 
+ * @param r The rebound simulation to be considered
+ * @param filename Output filename.
+ */
+EXPORTIT void reb_output_profiling_csv(struct reb_simulation* r, char* filename);
+
+/**
+ * @brief Write the profiling results to a JSON file.
+ * @param r The rebound simulation to be considered
+ * @param filename Output filename.
+ */
+EXPORTIT void reb_output_profiling_json(struct reb_simulation* r, char* filename);
+
+/**
+ * @brief Write the timeline trace to a file in the Chrome trace format.
+ * @details The file can be opened with chrome://tracing or https://ui.perfetto.dev.
+ * Each OpenMP thread is shown as a separate thread, each MPI node as a separate process.
+ * Only the most recent trace_capacity events per thread are kept. 
+ * The events are not removed from the buffer. Use reb_profiling_reset() to clear it.
+ * @param r The rebound simulation to be considered
+ * @param filename Output filename.
+ */
+EXPORTIT void reb_output_trace(struct reb_simulation* r, char* filename);
+/** @} */
+/** @} */
+
+/**
+ * \name Profiling functions
+ * @{
+ */
+/**
+ * @defgroup ProfilingRebFunctions List of the profiling functions for REBOUND
+ * @details Profiling is enabled by setting profiling_enabled to 1.
+ * Counters are kept separately for each OpenMP thread. Scopes opened by the
+ * master thread outside of parallel regions make up the exclusive times,
+ * which add up to the wall time. Scopes opened by any thread inside parallel
+ * regions are reported separately, see reb_profiling_get_parallel_time().
+ * In all functions below, a thread argument of -1 returns the sum over all threads.
+ * @{
+ */
+/**
+ * @brief Resets all profiling counters and clears the trace.
+ * @param r The rebound simulation to be considered
+ */
+EXPORTIT void reb_profiling_reset(struct reb_simulation* const r);
+
+/**
+ * @brief Returns the name of a profiling category.
+ * @param cat Profiling category
+ * @return Name of the category or NULL if cat is not a valid category.
+ */
+EXPORTIT const char* reb_profiling_get_name(int cat);
+
+/**
+ * @brief Returns the parent of a profiling category.
+ * @param cat Profiling category
+ * @return Parent category or -1 if cat is a top-level category.
+ */
+EXPORTIT int reb_profiling_get_parent(int cat);
+
+/**
+ * @brief Returns the number of threads for which profiling counters are kept.
+ * @param r The rebound simulation to be considered
+ */
+EXPORTIT int reb_profiling_get_threads_N(const struct reb_simulation* const r);
+
+/**
+ * @brief Returns the time spent in a category, excluding its subcategories.
+ * @param r The rebound simulation to be considered
+ * @param cat Profiling category
+ * @param thread Thread number or -1.
+ * @return Time in seconds.
+ */
+EXPORTIT double reb_profiling_get_time(const struct reb_simulation* const r, int cat, int thread);
+
+/**
+ * @brief Returns the time spent in a category, including its subcategories.
+ * @param r The rebound simulation to be considered
+ * @param cat Profiling category
+ * @param thread Thread number or -1.
+ * @return Time in seconds.
+ */
+EXPORTIT double reb_profiling_get_time_inclusive(const struct reb_simulation* const r, int cat, int thread);
+
+/**
+ * @brief Returns how many times a category has been entered.
+ * @param r The rebound simulation to be considered
+ * @param cat Profiling category
+ * @param thread Thread number or -1.
+ */
+EXPORTIT long reb_profiling_get_calls(const struct reb_simulation* const r, int cat, int thread);
+
+/**
+ * @brief Returns the time a thread spent in a category inside OpenMP parallel regions.
+ * @details The time is inclusive and not part of reb_profiling_get_time(). 
+ * Comparing the threads shows the load imbalance of a parallel loop.
+ * @param r The rebound simulation to be considered
+ * @param cat Profiling category
+ * @param thread Thread number or -1.
+ * @return Time in seconds.
+ */
+EXPORTIT double reb_profiling_get_parallel_time(const struct reb_simulation* const r, int cat, int thread);
+
+/**
+ * @brief Returns how many times a category has been entered inside OpenMP parallel regions.
+ * @param r The rebound simulation to be considered
+ * @param cat Profiling category
+ * @param thread Thread number or -1.
+ */
+EXPORTIT long reb_profiling_get_parallel_calls(const struct reb_simulation* const r, int cat, int thread);
+
+/**
+ * @brief Returns the name of a hardware performance counter.
+ * @param counter Hardware counter
+ * @return Name of the counter or NULL if counter is not valid.
+ */
+EXPORTIT const char* reb_profiling_get_hw_name(int counter);
+
+/**
+ * @brief Returns 1 if hardware performance counters could be opened, 0 otherwise.
+ * @details Only meaningful after at least one timestep has been done with
+ * profiling_hw_counters set to 1.
+ * @param r The rebound simulation to be considered
+ */
+EXPORTIT int reb_profiling_hw_available(const struct reb_simulation* const r);
+
+/**
+ * @brief Returns the value of a hardware counter accumulated in a category, excluding its subcategories.
+ * @details Each thread uses its own group of counters. The master thread counts the 
+ * scopes it opens, including its share of parallel regions. The other threads only
+ * count the scopes they open inside parallel regions.
+ * @param r The rebound simulation to be considered
+ * @param cat Profiling category
+ * @param counter Hardware counter
+ * @param thread Thread number or -1.
+ */
+EXPORTIT unsigned long long reb_profiling_get_hw(const struct reb_simulation* const r, int cat, int counter, int thread);
+
+/**
+ * @brief Returns the value of a hardware counter accumulated in a category, including its subcategories.
+ * @param r The rebound simulation to be considered
+ * @param cat Profiling category
+ * @param counter Hardware counter
+ * @param thread Thread number or -1.
+ */
+EXPORTIT unsigned long long reb_profiling_get_hw_inclusive(const struct reb_simulation* const r, int cat, int counter, int thread);
+
+/**
+ * @brief Returns the wall time since profiling counters were allocated or last reset.
+ * @param r The rebound simulation to be considered
+ * @return Time in seconds.
+ */
+EXPORTIT double reb_profiling_get_wall_time(const struct reb_simulation* const r);
 /** @} */
 /** @} */
 
@@ -25,6 +25,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
@@ -32,6 +33,8 @@
 #include "rebound.h"
 #include "boundary.h"
 #include "tree.h"
+#include "collision.h"
+#include "integrator_leapfrog.h"
 #ifdef MPI
 #include "communication_mpi.h"
 #endif // MPI
@@ -63,6 +66,44 @@ static int reb_reb_tree_get_octant_for_particle_in_cell(const struct reb_particl
   */
 static struct reb_treecell *reb_tree_add_particle_to_cell(struct reb_simulation* const r, struct reb_treecell *node, int pt, struct reb_treecell *parent, int o);
 
+/**
+  * @brief Returns a zeroed tree cell from the simulation's cell pool.
+  * @details Cells are carved out of slabs. A new slab is only allocated
+  * when the free list is empty. The slab size doubles the total number of 
+  * cells each time, so the number of system allocations grows only 
+  * logarithmically with the size of the tree.
+  * @param r REBOUND simulation to operate on
+  */
+static struct reb_treecell* reb_tree_cell_alloc(struct reb_simulation* const r){
+	if (r->tree_cell_free==NULL){
+		int n = r->tree_cell_allocatedN>256?r->tree_cell_allocatedN:256;
+		struct reb_treecell* slab = malloc(sizeof(struct reb_treecell)*n);
+		for (int i=0;i<n-1;i++){
+			slab[i].oct[0] = &(slab[i+1]);
+		}
+		slab[n-1].oct[0] = NULL;
+		r->tree_cell_free = slab;
+		r->tree_cell_slabs = realloc(r->tree_cell_slabs,sizeof(struct reb_treecell*)*(r->tree_cell_slabs_N+1));
+		r->tree_cell_slabs[r->tree_cell_slabs_N] = slab;
+		r->tree_cell_slabs_N++;
+		r->tree_cell_allocatedN += n;
+	}
+	struct reb_treecell* node = r->tree_cell_free;
+	r->tree_cell_free = node->oct[0];
+	memset(node, 0, sizeof(struct reb_treecell));
+	return node;
+}
+
+/**
+  * @brief Returns a tree cell to the simulation's cell pool.
+  * @param r REBOUND simulation to operate on
+  * @param node Cell to be released. Its children are not released.
+  */
+static void reb_tree_cell_free(struct reb_simulation* const r, struct reb_treecell* node){
+	node->oct[0] = r->tree_cell_free;
+	r->tree_cell_free = node;
+}
+
 void reb_tree_add_particle_to_tree(struct reb_simulation* const r, int pt){
 	if (r->tree_root==NULL){
 		r->tree_root = calloc(r->root_nx*r->root_ny*r->root_nz,sizeof(struct reb_treecell*));
@@ -82,7 +123,7 @@ static struct reb_treecell *reb_tree_add_particle_to_cell(struct reb_simulation*
 	struct reb_particle* const particles = r->particles;
 	// Initialize a new node
 	if (node == NULL) {
-		node = calloc(1, sizeof(struct reb_treecell));
+		node = reb_tree_cell_alloc(r);
 		struct reb_particle p = particles[pt];
 		if (parent == NULL){ // The new node is a root
 			node->w = r->root_size;
@@ -176,12 +217,12 @@ static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r,
 		}
 		// Check if the node requires derefinement.
 		if (node->pt == 0) {	// The node is empty.
-			free(node);
+			reb_tree_cell_free(r, node);
 			return NULL;
 		} else if (node->pt == -1) { // The node becomes a leaf.
 			node->pt = node->oct[test]->pt;
 			r->particles[node->pt].c = node;
-			free(node->oct[test]);
+			reb_tree_cell_free(r, node->oct[test]);
 			node->oct[test]=NULL;
 			return node;
 		}
@@ -191,13 +232,20 @@ static struct reb_treecell *reb_tree_update_cell(struct reb_simulation* const r,
 	if (reb_tree_particle_is_inside_cell(r, node) == 0) {
 		int oldpos = node->pt;
 		struct reb_particle reinsertme = r->particles[oldpos];
+		reb_particle_lookup_delete(r, reinsertme.id);
 		(r->N)--;
 		r->particles[oldpos] = r->particles[r->N];
 		r->particles[oldpos].c->pt = oldpos;
+		if (oldpos<r->N){
+			reb_particle_lookup_insert(r, r->particles[oldpos].id, oldpos);
+		}
+		// The particle is reinserted at the end.
+		reb_collision_neighbours_swap(r, oldpos, r->N);
+		reb_integrator_leapfrog_swap(r, oldpos, r->N);
         if (!isnan(reinsertme.y)){ // Do not reinsert if flagged for removal
 		    reb_add(r, reinsertme);
         }
-		free(node);
+		reb_tree_cell_free(r, node);
 		return NULL;
 	} else {
 		r->particles[node->pt].c = node;
@@ -270,6 +318,47 @@ static void reb_tree_update_gravity_data_in_cell(const struct reb_simulation* co
 	}
 }
 
+/**
+  * @brief The function calculates the largest radius of all particles in a node.
+  */
+static void reb_tree_update_collision_data_in_cell(const struct reb_simulation* const r, struct reb_treecell *node){
+	if (node->pt < 0) {
+		// Non-leaf nodes
+		node->rmax = 0;
+		for (int o=0; o<8; o++) {
+			struct reb_treecell* d = node->oct[o];
+			if (d!=NULL){
+				reb_tree_update_collision_data_in_cell(r, d);
+				if (d->rmax>node->rmax){
+					node->rmax = d->rmax;
+				}
+			}
+		}
+	}else{
+		// Leaf nodes
+		const struct reb_particle p = r->particles[node->pt];
+		node->rmax = p.r;
+		if (r->collision_continuous){
+			// Include the distance the particle moved during the last timestep.
+			node->rmax += r->dt_last_done*sqrt(p.vx*p.vx + p.vy*p.vy + p.vz*p.vz);
+		}
+	}
+}
+
+void reb_tree_update_collision_data(struct reb_simulation* const r){
+	for(int i=0;i<r->root_n;i++){
+#ifdef MPI
+		if (reb_communication_mpi_rootbox_is_local(r, i)==1){
+#endif // MPI
+			if (r->tree_root[i]!=NULL){
+				reb_tree_update_collision_data_in_cell(r, r->tree_root[i]);
+			}
+#ifdef MPI
+		}
+#endif // MPI
+	}
+}
+
 void reb_tree_update_gravity_data(struct reb_simulation* const r){
 	for(int i=0;i<r->root_n;i++){
 #ifdef MPI
@@ -300,22 +389,18 @@ EXPORTIT void reb_tree_update(struct reb_simulation* const r){
 	}
     r->tree_needs_update= 0;
 }
-static void reb_tree_delete_cell(struct reb_treecell* node){
-	if (node==NULL){
-		return;
-	}
-	for (int o=0; o<8; o++) {
-		reb_tree_delete_cell(node->oct[o]);
-	}
-}
-
 void reb_tree_delete(struct reb_simulation* const r){
-	if (r->tree_root!=NULL){
-		for(int i=0;i<r->root_n;i++){
-			reb_tree_delete_cell(r->tree_root[i]);
-		}
-		free(r->tree_root);
+	// All cells live in the pool. No need to walk the tree.
+	for(int i=0;i<r->tree_cell_slabs_N;i++){
+		free(r->tree_cell_slabs[i]);
 	}
+	free(r->tree_cell_slabs);
+	r->tree_cell_slabs = NULL;
+	r->tree_cell_slabs_N = 0;
+	r->tree_cell_allocatedN = 0;
+	r->tree_cell_free = NULL;
+	free(r->tree_root);
+	r->tree_root = NULL;
 }
 
 
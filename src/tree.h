@@ -40,6 +40,7 @@ struct reb_treecell {
 	double mx; /**< The x position of the center of mass of a cell */
 	double my; /**< The y position of the center of mass of a cell */
 	double mz; /**< The z position of the center of mass of a cell */
+	double rmax; /**< The largest radius of all particles in a cell. If collision_continuous is set, this includes the distance the particles moved during the last timestep. */
 #ifdef QUADRUPOLE
 	double mxx; /**< The xx component of the quadrupole tensor of mass of a cell */
 	double mxy; /**< The xy component of the quadrupole tensor of mass of a cell */
@@ -61,6 +62,13 @@ struct reb_treecell {
   */
 EXPORTIT void reb_tree_update(struct reb_simulation* const r);
 
+/**
+  * @brief Calculates the largest particle radius of every cell.
+  * @details Needs to be called after the tree has been updated and before it is used for the collision search.
+  * @param r Rebound simulation to operate on
+  */
+void reb_tree_update_collision_data(struct reb_simulation* const r);
+
 /**
   * @brief The wrap function calls reb_tree_update_gravity_data_in_cell() for each tree.
   * @param r Rebound simulation to operate on